@@ -56,8 +56,11 @@ commands = [
     loom.runner.tare,
     loom.runner.sparsify,
     loom.runner.shuffle,
+    loom.runner.columnize,
+    loom.runner.decolumnize,
     loom.runner.infer,
     loom.runner.posterior_enum,
+    loom.runner.snapshot,
     loom.runner.query,
     loom.crossvalidate.crossvalidate,
 ]
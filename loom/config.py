@@ -41,6 +41,10 @@ DEFAULTS = {
         'big_data_size': 1e9,
         'max_reject_iters': 100,
         'checkpoint_period_sec': 1e9,
+        'checkpoint_delta_limit': 0,
+        'resident_rows': False,
+        'write_snapshots': True,
+        'columnar_rows': False,
     },
     'kernels': {
         'cat': {
@@ -63,14 +67,20 @@ DEFAULTS = {
     'posterior_enum': {
         'sample_count': 100,
         'sample_skip': 10,
+        'chain_count': 1,
     },
     'generate': {
         'row_count': 100,
         'density': 0.5,
         'sample_skip': 10,
+        'parallel': False,
     },
     'query': {
         'parallel': True,
+        'frozen': False,
+        'cache_size': 0,
+        'lazy': False,
+        'lazy_mem_bytes': 0,
     },
 }
 
@@ -47,6 +47,7 @@ import loom.schema
 import loom.schema_pb2
 import loom.cFormat
 import loom.documented
+import loom.runner
 parsable = parsable.Parsable()
 
 OTHER_DECODE = '_OTHER'
@@ -373,15 +374,28 @@ def _import_dir(import_file, args):
         stride = id_stride * part_count
         parts_out.append(part_out)
         tasks.append((part_in, part_out, offset, stride, misc))
-    with tempdir():
-        loom.util.parallel_map(import_file, tasks)
-        # It is safe use open instead of open_compressed even for .gz files;
-        # see http://stackoverflow.com/questions/8005114
-        with open(file_out, 'wb') as whole:
-            for part_out in parts_out:
-                with open(part_out, 'rb') as part:
-                    shutil.copyfileobj(part, whole)
-                os.remove(part_out)
+
+    # parts are imported concurrently, so each import gets a share of the
+    # OpenMP threads rather than all of them
+    worker_count = min(loom.util.THREADS, part_count)
+    omp_num_threads = os.environ.get('OMP_NUM_THREADS')
+    thread_count = int(omp_num_threads or loom.util.THREADS)
+    os.environ['OMP_NUM_THREADS'] = str(max(1, thread_count / worker_count))
+    try:
+        with tempdir():
+            loom.util.parallel_map(import_file, tasks)
+            # It is safe use open instead of open_compressed even for .gz
+            # files; see http://stackoverflow.com/questions/8005114
+            with open(file_out, 'wb') as whole:
+                for part_out in parts_out:
+                    with open(part_out, 'rb') as part:
+                        shutil.copyfileobj(part, whole)
+                    os.remove(part_out)
+    finally:
+        if omp_num_threads is None:
+            del os.environ['OMP_NUM_THREADS']
+        else:
+            os.environ['OMP_NUM_THREADS'] = omp_num_threads
 
 
 def _import_rows(import_file, rows_csv_in, file_out, misc):
@@ -425,9 +439,31 @@ def import_rowids(rows_csv_in, rowids_out, id_field=None):
     _import_rows(_import_rowids_file, rows_csv_in, rowids_out, id_field)
 
 
+def _make_encoding_protobuf(encoding_in, encoding_out):
+    encoding = loom.schema_pb2.Encoding()
+    for encoder in json_load(encoding_in):
+        message = encoding.encoders.add()
+        message.name = encoder['name']
+        message.model = encoder['model']
+        for symbol, code in encoder.get('symbols', {}).iteritems():
+            message.symbols.append(unicode(symbol))
+            message.codes.append(code)
+    with open_compressed(encoding_out, 'wb') as f:
+        f.write(encoding.SerializeToString())
+
+
 def _import_rows_file(args):
-    rows_csv_in, rows_out, id_offset, id_stride, encoding_in = args
+    rows_csv_in, rows_out, id_offset, id_stride, encodings = args
     assert os.path.isfile(rows_csv_in)
+    encoding_in, encoding_pb = encodings
+    if encoding_pb is not None and not rows_csv_in.endswith('.bz2'):
+        loom.runner.import_csv(
+            encoding_in=encoding_pb,
+            rows_csv_in=rows_csv_in,
+            rows_out=rows_out,
+            id_offset=id_offset,
+            id_stride=id_stride)
+        return
     encoders = json_load(encoding_in)
     message = loom.cFormat.Row()
     add_field = {
@@ -468,13 +504,24 @@ def _import_rows_file(args):
 @loom.documented.transform(
     inputs=['ingest.encoding', 'ingest.rows_csv'],
     outputs=['ingest.rows'])
-def import_rows(encoding_in, rows_csv_in, rows_out):
+def import_rows(encoding_in, rows_csv_in, rows_out, native=True):
     '''
     Import rows from csv format to protobuf-stream format.
     rows_csv_in can be a csv file or a directory containing csv files.
     Any csv file may be be raw .csv, or compressed .csv.gz or .csv.bz2.
+    If native, import .csv and .csv.gz files with loom_import.
     '''
-    _import_rows(_import_rows_file, rows_csv_in, rows_out, encoding_in)
+    encoding_in = os.path.abspath(encoding_in)
+    rows_csv_in = os.path.abspath(rows_csv_in)
+    rows_out = os.path.abspath(rows_out)
+    with tempdir():
+        if native:
+            encoding_pb = os.path.abspath('encoding.pb.gz')
+            _make_encoding_protobuf(encoding_in, encoding_pb)
+        else:
+            encoding_pb = None
+        encodings = (encoding_in, encoding_pb)
+        _import_rows(_import_rows_file, rows_csv_in, rows_out, encodings)
 
 
 @parsable.command
@@ -44,6 +44,7 @@ import loom.query
 import loom.group
 
 SAMPLE_COUNT = 1000
+PREDICT_BATCH_SIZE = 100
 
 
 class CsvWriter(object):
@@ -322,19 +323,30 @@ class PreQL(object):
         if id_offset and header[0] in self._feature_names:
             raise ValueError('id field conflict: {}'.format(header[0]))
         writer.writerow(header)
+        batch = []
         for row in reader:
-            if id_offset:
-                row_id = row[0]
-            conditioning_row = self.encode_row(row, header)
-            to_sample = [value is None for value in conditioning_row]
-            samples = self._query_server.sample(
-                to_sample,
-                conditioning_row,
-                count)
+            batch.append(row)
+            if len(batch) == PREDICT_BATCH_SIZE:
+                self._predict_batch(batch, header, count, writer, id_offset)
+                batch = []
+        if batch:
+            self._predict_batch(batch, header, count, writer, id_offset)
+
+    def _predict_batch(self, rows, header, count, writer, id_offset):
+        conditioning_rows = [self.encode_row(row, header) for row in rows]
+        to_samples = [
+            [value is None for value in conditioning_row]
+            for conditioning_row in conditioning_rows
+        ]
+        batch_samples = self._query_server.batch_sample(
+            to_samples,
+            conditioning_rows,
+            count)
+        for row, samples in izip(rows, batch_samples):
             for sample in samples:
                 sample = self.decode_row(sample, header)
                 if id_offset:
-                    sample[0] = row_id
+                    sample[0] = row[0]
                 writer.writerow(sample)
 
     def relate(self, columns, result_out=None, sample_count=SAMPLE_COUNT):
@@ -565,9 +577,10 @@ class PreQL(object):
         query_sets = map(self._cols_to_mask, query_feature_sets)
         target_labels = map(min, target_feature_sets)
         query_labels = map(min, query_feature_sets)
-        entropys = self._query_server.entropy(
-            row_sets=target_sets,
-            col_sets=query_sets,
+        feature_sets = list(set(target_sets) | set(query_sets))
+        positions = {s: i for i, s in enumerate(feature_sets)}
+        mi_matrix = self._query_server.mutual_information_matrix(
+            feature_sets=feature_sets,
             conditioning_row=conditioning_row,
             sample_count=sample_count)
         writer.writerow([None] + query_labels)
@@ -588,11 +601,10 @@ class PreQL(object):
                             conditioning_row=forgetful_conditioning_row,
                             sample_count=sample_count)
                     else:
-                        normalized_mi = self._normalized_mutual_information(
-                            target_set,
-                            query_set,
-                            entropys=entropys,
-                            sample_count=sample_count)
+                        i = positions[target_set]
+                        j = positions[query_set]
+                        normalized_mi = normalize_mutual_information(
+                            mi_matrix[i][j].mean)
                 result_row.append(normalized_mi)
             writer.writerow(result_row)
 
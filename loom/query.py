@@ -28,6 +28,7 @@
 
 import uuid
 from itertools import chain
+from itertools import izip
 from collections import namedtuple
 import numpy
 from distributions.io.stream import protobuf_stream_read
@@ -140,23 +141,26 @@ class QueryServer(object):
         request.id = str(uuid.uuid4())
         return request
 
-    def sample(self, to_sample, conditioning_row=None, sample_count=None):
+    def _set_sample_request(
+            self,
+            message,
+            to_sample,
+            conditioning_row,
+            sample_count):
         if sample_count is None:
             sample_count = DEFAULTS['sample_sample_count']
         if conditioning_row is None:
             conditioning_row = [None for _ in to_sample]
         assert len(to_sample) == len(conditioning_row)
-        request = self.request()
-        data_row_to_protobuf(conditioning_row, request.sample.data)
-        request.sample.to_sample.sparsity = DENSE
-        request.sample.to_sample.dense[:] = to_sample
-        request.sample.sample_count = sample_count
-        self.protobuf_server.send(request)
-        response = self.protobuf_server.receive()
-        if response.error:
-            raise Exception('\n'.join(response.error))
+        data_row_to_protobuf(conditioning_row, message.data)
+        message.to_sample.sparsity = DENSE
+        message.to_sample.dense[:] = to_sample
+        message.sample_count = sample_count
+        return conditioning_row
+
+    def _get_samples(self, message, to_sample, conditioning_row):
         samples = []
-        for sample in response.sample.samples:
+        for sample in message.samples:
             data_out = protobuf_to_data_row(sample)
             for i, val in enumerate(data_out):
                 if val is None:
@@ -165,6 +169,74 @@ class QueryServer(object):
             samples.append(data_out)
         return samples
 
+    def sample(
+            self,
+            to_sample,
+            conditioning_row=None,
+            sample_count=None,
+            seed=None):
+        '''
+        Seeded requests are reproducible, and may be served from the
+        server's result cache if config.query.cache_size is nonzero.
+        '''
+        request = self.request()
+        conditioning_row = self._set_sample_request(
+            request.sample,
+            to_sample,
+            conditioning_row,
+            sample_count)
+        if seed is not None:
+            request.sample.seed = seed
+        self.protobuf_server.send(request)
+        response = self.protobuf_server.receive()
+        if response.error:
+            raise Exception('\n'.join(response.error))
+        return self._get_samples(response.sample, to_sample, conditioning_row)
+
+    def batch_sample(
+            self,
+            to_samples,
+            conditioning_rows,
+            sample_count=None,
+            seeds=None):
+        '''
+        Like sample(), but sends many conditioning rows in one request,
+        which the server fills in parallel. Returns one list of samples
+        per conditioning row. If given, seeds[i] seeds the i-th row as
+        sample(..., seed=seeds[i]) would.
+        '''
+        assert len(to_samples) == len(conditioning_rows)
+        if seeds is None:
+            seeds = [None for _ in to_samples]
+        assert len(seeds) == len(to_samples)
+        request = self.request()
+        messages = []
+        for seed in seeds:
+            message = request.batch_sample.requests.add()
+            if seed is not None:
+                message.seed = seed
+            messages.append(message)
+        conditioning_rows = [
+            self._set_sample_request(
+                message,
+                to_sample,
+                conditioning_row,
+                sample_count)
+            for message, to_sample, conditioning_row
+            in izip(messages, to_samples, conditioning_rows)
+        ]
+        self.protobuf_server.send(request)
+        response = self.protobuf_server.receive()
+        if response.error:
+            raise Exception('\n'.join(response.error))
+        responses = response.batch_sample.responses
+        assert len(responses) == len(conditioning_rows)
+        return [
+            self._get_samples(message, to_sample, conditioning_row)
+            for message, to_sample, conditioning_row
+            in izip(responses, to_samples, conditioning_rows)
+        ]
+
     def _send_score(self, row):
         request = self.request()
         data_row_to_protobuf(row, request.score.data)
@@ -286,6 +358,42 @@ class QueryServer(object):
             + entropys[feature_union].variance
         return Estimate(mi, variance)
 
+    def mutual_information_matrix(
+            self,
+            feature_sets,
+            conditioning_row=None,
+            sample_count=None):
+        '''
+        Estimate the mutual information between every pair of feature_sets
+        conditioned on conditioning_row, from a single shared set of samples.
+        Returns a square list of lists of Estimates.
+        '''
+        if sample_count is None:
+            sample_count = DEFAULTS['mutual_information_sample_count']
+        request = self.request()
+        if conditioning_row is None:
+            none_to_protobuf(request.mutual_information_matrix.conditional)
+        else:
+            data_row_to_protobuf(
+                conditioning_row,
+                request.mutual_information_matrix.conditional)
+        for feature_set in feature_sets:
+            feature_set_to_protobuf(
+                feature_set,
+                request.mutual_information_matrix.feature_sets)
+        request.mutual_information_matrix.sample_count = sample_count
+        self.protobuf_server.send(request)
+        response = self.protobuf_server.receive()
+        if response.error:
+            raise Exception('\n'.join(response.error))
+        means = response.mutual_information_matrix.means
+        variances = response.mutual_information_matrix.variances
+        size = len(feature_sets)
+        assert len(means) == size * size, means
+        assert len(variances) == size * size, variances
+        estimates = map(Estimate, means, variances)
+        return [estimates[i * size: (i + 1) * size] for i in xrange(size)]
+
     def score_derivative(
             self,
             update_row,
@@ -319,12 +427,18 @@ class QueryServer(object):
 
 
 class ProtobufServer(object):
-    def __init__(self, root, config=None, debug=False, profile=None):
+    def __init__(
+            self,
+            root,
+            config=None,
+            debug=False,
+            profile=None,
+            log_out=None):
         self.root = root
         self.proc = loom.runner.query(
             root_in=root,
             config_in=config,
-            log_out=None,
+            log_out=log_out,
             debug=debug,
             profile=profile,
             block=False)
@@ -352,6 +466,16 @@ class ProtobufServer(object):
         self.close()
 
 
-def get_server(root, config=None, debug=False, profile=None):
-    protobuf_server = ProtobufServer(root, config, debug, profile)
+def get_server(
+        root,
+        config=None,
+        debug=False,
+        profile=None,
+        log_out=None):
+    protobuf_server = ProtobufServer(
+        root,
+        config,
+        debug,
+        profile,
+        log_out)
     return QueryServer(protobuf_server)
@@ -129,6 +129,33 @@ def profilers():
         print '  {} = {}'.format(key, ' '.join(value))
 
 
+@parsable.command
+def import_csv(
+        encoding_in,
+        rows_csv_in,
+        rows_out,
+        id_offset=0,
+        id_stride=1,
+        debug=False,
+        profile=None):
+    '''
+    Import rows from a .csv or .csv.gz file, given a protobuf encoding.
+    '''
+    check_call_files(
+        command=[
+            'import',
+            encoding_in,
+            rows_csv_in,
+            rows_out,
+            id_offset,
+            id_stride,
+        ],
+        debug=debug,
+        profile=profile,
+        infiles=[encoding_in, rows_csv_in],
+        outfiles=[rows_out])
+
+
 @parsable.command
 @loom.documented.transform(
     inputs=['ingest.schema_row', 'ingest.rows'],
@@ -137,13 +164,31 @@ def tare(
         schema_row_in,
         rows_in,
         tares_out,
+        sample_count=0,
+        confidence=0.999,
+        tare_count=1,
+        shuffled=False,
         debug=False,
         profile=None):
     '''
     Find tare rows for a datset, i.e., rows of per-column most-likely values.
+    If sample_count > 0, estimate tares from a uniform sample of at most that
+    many rows, stopping once every column is settled at the given confidence.
+    Sampling reads all rows, unless shuffled promises that rows_in is already
+    in random order, in which case only the first sample_count are read.
+    If tare_count > 1, find up to that many tares by k-modes.
     '''
     check_call_files(
-        command=['tare', schema_row_in, rows_in, tares_out],
+        command=[
+            'tare',
+            schema_row_in,
+            rows_in,
+            tares_out,
+            sample_count,
+            confidence,
+            tare_count,
+            int(shuffled),
+        ],
         debug=debug,
         profile=profile,
         infiles=[schema_row_in, rows_in],
@@ -159,13 +204,22 @@ def sparsify(
         tares_in,
         rows_in='-',
         rows_out='-',
+        dedup=False,
         debug=False,
         profile=None):
     '''
     Sparsify dataset WRT tare rows.
+    If dedup, collapse rows with identical diffs into one row with dup_ids.
     '''
     check_call_files(
-        command=['sparsify', schema_row_in, tares_in, rows_in, rows_out],
+        command=[
+            'sparsify',
+            schema_row_in,
+            tares_in,
+            rows_in,
+            rows_out,
+            int(dedup),
+        ],
         debug=debug,
         profile=profile,
         infiles=[schema_row_in, tares_in, rows_in],
@@ -195,6 +249,49 @@ def shuffle(
         outfiles=[rows_out])
 
 
+@parsable.command
+@loom.documented.transform(
+    inputs=['ingest.schema_row', 'samples.0.shuffled'],
+    outputs=['samples.0.columns'])
+def columnize(
+        schema_row_in,
+        rows_in,
+        columns_out,
+        block_size=65536,
+        debug=False,
+        profile=None):
+    '''
+    Convert a shuffled dataset to a columnar file that infer can read.
+    '''
+    assert rows_in != columns_out, 'cannot columnize rows in-place'
+    check_call_files(
+        command=[
+            'columnize',
+            schema_row_in,
+            rows_in,
+            columns_out,
+            block_size,
+        ],
+        debug=debug,
+        profile=profile,
+        infiles=[schema_row_in, rows_in],
+        outfiles=[columns_out])
+
+
+@parsable.command
+def decolumnize(rows_in, rows_out, debug=False, profile=None):
+    '''
+    Convert a columnar file back to a row stream, e.g. for inspection.
+    '''
+    assert rows_in != rows_out, 'cannot decolumnize rows in-place'
+    check_call_files(
+        command=['decolumnize', rows_in, rows_out],
+        debug=debug,
+        profile=profile,
+        infiles=[rows_in],
+        outfiles=[rows_out])
+
+
 @parsable.command
 @loom.documented.transform(
     inputs=[
@@ -344,6 +441,29 @@ def posterior_enum(
         outfiles=[samples_out])
 
 
+@parsable.command
+def snapshot(
+        command,
+        model_in,
+        groups,
+        assign=None,
+        debug=False,
+        profile=None):
+    '''
+    Convert between protobuf group/assignment files and native snapshots.
+    command is 'native' (protobuf -> snapshot) or 'protobuf' (the reverse).
+    Snapshots live at groups + '.bin' and assign with suffix '.bin'.
+    '''
+    assert command in ['native', 'protobuf'], command
+    assign = optional_file(assign)
+    check_call_files(
+        command=['snapshot', command, model_in, groups, assign],
+        debug=debug,
+        profile=profile,
+        infiles=[model_in, groups],
+        outfiles=[])
+
+
 @parsable.command
 def query(
         root_in,
@@ -53,6 +53,7 @@ BASENAMES = {
         'config': 'config.pb.gz',
         'init': 'init.pb.gz',
         'shuffled': 'shuffled.pbs.gz',
+        'columns': 'shuffled.cols',
         'model': 'model.pb.gz',
         'groups': 'groups',
         'assign': 'assign.pbs.gz',
@@ -80,6 +81,7 @@ ERRORS = {
     'diffs': 'First sparsify dataset',
     'init': 'First init',
     'shuffled': 'First shuffle',
+    'columns': 'First columnize',
 }
 
 
@@ -103,6 +103,8 @@ def ingest(
         schema=None,
         rows_csv=None,
         id_field=None,
+        tare_count=1,
+        dedup=False,
         debug=False):
     '''
     Ingest dataset with optional json config.
@@ -111,6 +113,8 @@ def ingest(
         schema          Json schema file, e.g., {"feature1": "nich"}
         rows_csv        File or directory of csv files or csv.gz files
         id_field        Column name of id field in input csv
+        tare_count      Maximum number of tare rows to sparsify against
+        dedup           Whether to collapse rows with identical diffs
         debug           Whether to run debug versions of C++ code
     Environment variables:
         LOOM_THREADS    Number of concurrent ingest tasks
@@ -157,15 +161,18 @@ def ingest(
         schema_row_in=paths['ingest']['schema_row'],
         rows_in=paths['ingest']['rows'],
         tares_out=paths['ingest']['tares'],
+        tare_count=tare_count,
         debug=debug)
 
-    tare_count = sum(1 for _ in protobuf_stream_load(paths['ingest']['tares']))
-    LOG('sparsifying rows WRT {} tare rows'.format(tare_count))
+    tares = paths['ingest']['tares']
+    found_count = sum(1 for _ in protobuf_stream_load(tares))
+    LOG('sparsifying rows WRT {} tare rows'.format(found_count))
     loom.runner.sparsify(
         schema_row_in=paths['ingest']['schema_row'],
         tares_in=paths['ingest']['tares'],
         rows_in=paths['ingest']['rows'],
         rows_out=paths['ingest']['diffs'],
+        dedup=dedup,
         debug=debug)
     loom.config.config_dump({}, paths['query']['config'])
 
@@ -240,11 +247,22 @@ def infer_one(name, seed=0, config=None, debug=False):
         rows_out=sample['shuffled'],
         seed=seed,
         debug=debug)
+    rows_in = sample['shuffled']
+
+    loom.config.fill_in_defaults(config)
+    if config['schedule']['columnar_rows']:
+        LOG('columnizing rows')
+        loom.runner.columnize(
+            schema_row_in=paths['ingest']['schema_row'],
+            rows_in=sample['shuffled'],
+            columns_out=sample['columns'],
+            debug=debug)
+        rows_in = sample['columns']
 
     LOG('inferring, watch {}'.format(sample['infer_log']))
     loom.runner.infer(
         config_in=sample['config'],
-        rows_in=sample['shuffled'],
+        rows_in=rows_in,
         tares_in=paths['ingest']['tares'],
         model_in=sample['init'],
         model_out=sample['model'],
@@ -105,6 +105,28 @@ def test_import_rows(encoding, rows, rows_csv, **unused):
         assert_equal(actual_count, expected_count)
 
 
+@for_each_dataset
+def test_import_rows_native(encoding, rows_csv, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        rows = {}
+        for native in [False, True]:
+            rows[native] = os.path.abspath('rows.{}.pbs.gz'.format(native))
+            loom.format.import_rows(
+                encoding_in=encoding,
+                rows_csv_in=rows_csv,
+                rows_out=rows[native],
+                native=native)
+            assert_found(rows[native])
+        expected = load_rows(rows[False])
+        actual = load_rows(rows[True])
+        assert_equal(len(actual), len(expected))
+        actual.sort(key=lambda row: row.id)
+        expected.sort(key=lambda row: row.id)
+        expected_data = [row.diff for row in expected]
+        actual_data = [row.diff for row in actual]
+        assert_close(actual_data, expected_data)
+
+
 @for_each_dataset
 def test_export_rows(encoding, rows, **unused):
     with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
@@ -26,16 +26,19 @@
 # TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 # USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+import os
 from itertools import izip
 from nose.tools import assert_equal
 from nose.tools import assert_set_equal
 from nose.tools import assert_not_equal
 from nose.tools import assert_true
+from nose.tools import assert_almost_equal
 from distributions.dbg.random import sample_bernoulli
 from distributions.io.stream import json_load
 from distributions.io.stream import open_compressed
+from distributions.io.stream import protobuf_stream_load
 from distributions.fileutil import tempdir
-from loom.schema_pb2 import ProductValue, CrossCat, Query
+from loom.schema_pb2 import ProductValue, CrossCat, Query, LogMessage
 from loom.test.util import for_each_dataset
 import loom.query
 from loom.query import protobuf_to_data_row
@@ -182,6 +185,110 @@ def test_batch_score(root, model, rows, **unused):
         assert_equal(len(scores), len(rows))
 
 
+@for_each_dataset
+def test_batch_sample(root, model, rows, **unused):
+    requests = get_example_requests(model, rows, 'sample')
+    with loom.query.get_server(root, debug=True) as server:
+        conditioning_rows = [
+            protobuf_to_data_row(request.sample.data)
+            for request in requests
+        ]
+        to_samples = [
+            request.sample.to_sample.dense[:]
+            for request in requests
+        ]
+        sample_count = 3
+        batch_samples = server.batch_sample(
+            to_samples,
+            conditioning_rows,
+            sample_count)
+        assert_equal(len(batch_samples), len(requests))
+        for samples, to_sample, conditioning_row in izip(
+                batch_samples,
+                to_samples,
+                conditioning_rows):
+            assert_equal(len(samples), sample_count)
+            for sample in samples:
+                assert_equal(len(sample), len(conditioning_row))
+                for sampled, value, condition in izip(
+                        to_sample,
+                        sample,
+                        conditioning_row):
+                    if not sampled:
+                        assert_equal(value, condition)
+
+        seeds = range(len(requests))
+        batch_samples = server.batch_sample(
+            to_samples,
+            conditioning_rows,
+            sample_count,
+            seeds=seeds)
+        for samples, to_sample, conditioning_row, seed in izip(
+                batch_samples,
+                to_samples,
+                conditioning_rows,
+                seeds):
+            expected = server.sample(
+                to_sample,
+                conditioning_row,
+                sample_count,
+                seed=seed)
+            assert_equal(samples, expected)
+
+
+@for_each_dataset
+def test_seeded_sample_is_reproducible(root, model, rows, **unused):
+    requests = get_example_requests(model, rows, 'sample')
+    with loom.query.get_server(root, debug=True) as server:
+        for request in requests:
+            conditioning_row = protobuf_to_data_row(request.sample.data)
+            to_sample = request.sample.to_sample.dense[:]
+            expected = server.sample(to_sample, conditioning_row, 3, seed=0)
+            actual = server.sample(to_sample, conditioning_row, 3, seed=0)
+            assert_equal(actual, expected)
+
+
+@for_each_dataset
+def test_cached_query(root, schema, rows, **unused):
+    feature_count = len(json_load(schema))
+    feature_sets = [frozenset([i]) for i in xrange(feature_count)]
+    kwargs = {
+        'row_sets': feature_sets,
+        'col_sets': feature_sets,
+        'sample_count': 10
+    }
+    rows = load_rows(rows)
+    target_row = protobuf_to_data_row(rows[0].diff)
+    with tempdir():
+        config = os.path.abspath('config.pb.gz')
+        log = os.path.abspath('log.pbs.gz')
+        loom.config.config_dump({'query': {'cache_size': 64}}, config)
+        with loom.query.get_server(
+                root,
+                config=config,
+                debug=True,
+                log_out=log) as server:
+            expected = server.entropy(**kwargs)
+            actual = server.entropy(**kwargs)
+            assert_equal(actual, expected)
+            server.score_derivative(target_row, score_rows=None)
+            server.entropy(**kwargs)
+
+        message = LogMessage()
+        for string in protobuf_stream_load(log):
+            message.ParseFromString(string)
+            if message.args.query.HasField('cache_hits'):
+                break
+        else:
+            raise AssertionError('no cache status logged')
+
+    # the second call hits, and the call after ScoreDerivative misses
+    hits = message.args.query.cache_hits
+    misses = message.args.query.cache_misses
+    assert_true(hits > 0)
+    assert_equal(misses, 2 * hits)
+
+
 @for_each_dataset
 def test_score_derivative_runs(root, rows, **unused):
     with loom.query.get_server(root, debug=True) as server:
@@ -208,6 +315,20 @@ def test_score_derivative_against_existing_runs(root, rows, **unused):
         assert len(results) == 1
 
 
+@for_each_dataset
+def test_score_derivative_is_sorted(root, rows, **unused):
+    with loom.query.get_server(root, debug=True) as server:
+        rows = load_rows(rows)
+        target_row = protobuf_to_data_row(rows[0].diff)
+        results = server.score_derivative(
+            target_row,
+            score_rows=None,
+            row_limit=3)
+        assert len(results) == min(3, len(rows))
+        score_diffs = [score_diff for _, score_diff in results]
+        assert_equal(score_diffs, sorted(score_diffs, reverse=True))
+
+
 @for_each_dataset
 def test_seed(root, model, rows, **unused):
     requests = get_example_requests(model, rows, 'mixed')
@@ -230,6 +351,54 @@ def test_seed(root, model, rows, **unused):
     assert_not_equal(responses1, responses3)
 
 
+@for_each_dataset
+def test_frozen_score(root, model, rows, **unused):
+    requests = get_example_requests(model, rows, 'score')
+    with tempdir():
+        loom.config.config_dump({}, 'config.pb.gz')
+        with loom.query.ProtobufServer(root, config='config.pb.gz') as server:
+            expected = [get_response(server, req) for req in requests]
+
+    with tempdir():
+        loom.config.config_dump({'query': {'frozen': True}}, 'config.pb.gz')
+        with loom.query.ProtobufServer(root, config='config.pb.gz') as server:
+            actual = [get_response(server, req) for req in requests]
+
+    for request, expected_response, actual_response in izip(
+            requests,
+            expected,
+            actual):
+        check_response(request, actual_response)
+        assert_almost_equal(
+            expected_response.score.score,
+            actual_response.score.score,
+            places=3)
+
+
+@for_each_dataset
+def test_lazy_score(root, model, rows, **unused):
+    requests = get_example_requests(model, rows, 'score')
+    with tempdir():
+        with loom.query.ProtobufServer(root) as server:
+            expected = [get_response(server, req) for req in requests]
+
+        # a tiny budget evicts all but the kinds of the current request
+        config = {'query': {'lazy': True, 'lazy_mem_bytes': 1}}
+        loom.config.config_dump(config, 'config.pb.gz')
+        with loom.query.ProtobufServer(root, config='config.pb.gz') as server:
+            actual = [get_response(server, req) for req in requests]
+
+    for request, expected_response, actual_response in izip(
+            requests,
+            expected,
+            actual):
+        check_response(request, actual_response)
+        assert_almost_equal(
+            expected_response.score.score,
+            actual_response.score.score,
+            places=3)
+
+
 @for_each_dataset
 def test_tiled_entropy(root, schema, **unused):
     feature_count = len(json_load(schema))
@@ -245,3 +414,18 @@ def test_tiled_entropy(root, schema, **unused):
             print 'tile_size = {}'.format(tile_size)
             actual = set(server.entropy(tile_size=tile_size, **kwargs))
             assert_set_equal(expected, actual)
+
+
+@for_each_dataset
+def test_mutual_information_matrix(root, schema, **unused):
+    feature_count = len(json_load(schema))
+    feature_sets = [frozenset([i]) for i in xrange(feature_count)]
+    with loom.query.get_server(root, debug=True) as server:
+        matrix = server.mutual_information_matrix(
+            feature_sets,
+            sample_count=10)
+    assert_equal(len(matrix), feature_count)
+    for i in xrange(feature_count):
+        assert_equal(len(matrix[i]), feature_count)
+        for j in xrange(feature_count):
+            assert_equal(matrix[i][j], matrix[j][i])
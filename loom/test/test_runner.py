@@ -27,16 +27,24 @@
 # USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 import os
+from copy import deepcopy
 from nose.tools import assert_equal
+from nose.tools import assert_false
 from nose.tools import assert_true
 from loom.test.util import assert_found
 from loom.test.util import CLEANUP_ON_ERROR
 from loom.test.util import for_each_dataset
+from loom.test.util import load_rows
 from distributions.fileutil import tempdir
 from distributions.io.stream import open_compressed
+from distributions.io.stream import protobuf_stream_dump
 from distributions.io.stream import protobuf_stream_load
+from loom.schema_pb2 import Assignment
+from loom.schema_pb2 import Checkpoint
 from loom.schema_pb2 import CrossCat
 from loom.schema_pb2 import ProductModel
+from loom.schema_pb2 import ProductValue
+from loom.schema_pb2 import Row
 import loom.config
 import loom.runner
 
@@ -167,6 +175,83 @@ def test_tare(rows, schema_row, **unused):
         assert_found(tares)
 
 
+def load_tares(filename):
+    tares = []
+    for string in protobuf_stream_load(filename):
+        tare = ProductValue()
+        tare.ParseFromString(string)
+        tares.append(tare)
+    return tares
+
+
+def check_tare_is_valid(schema_row, tare):
+    sizes = [
+        len(schema_row.booleans),
+        len(schema_row.counts),
+        len(schema_row.reals),
+    ]
+    assert_equal(tare.observed.sparsity, ProductValue.Observed.DENSE)
+    assert_equal(len(tare.observed.dense), sum(sizes))
+    begin = 0
+    observed_counts = []
+    for size in sizes:
+        observed_counts.append(sum(tare.observed.dense[begin: begin + size]))
+        begin += size
+    assert_equal(len(tare.booleans), observed_counts[0])
+    assert_equal(len(tare.counts), observed_counts[1])
+    assert_equal(len(tare.reals), observed_counts[2])
+
+
+@for_each_dataset
+def test_tare_sample(rows, schema_row, **unused):
+    with open_compressed(schema_row) as f:
+        schema = ProductValue()
+        schema.ParseFromString(f.read())
+    row_count = sum(1 for _ in protobuf_stream_load(rows))
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        expected = os.path.abspath('expected.pbs.gz')
+        loom.runner.tare(
+            schema_row_in=schema_row,
+            rows_in=rows,
+            tares_out=expected)
+        assert_found(expected)
+        expected = load_tares(expected)
+
+        # a sample of every row, read in random order, settles on the tare
+        # of the full pass
+        sampled = os.path.abspath('sampled.pbs.gz')
+        loom.runner.tare(
+            schema_row_in=schema_row,
+            rows_in=rows,
+            tares_out=sampled,
+            sample_count=row_count)
+        assert_found(sampled)
+        assert_equal(load_tares(sampled), expected)
+
+        shuffled_rows = os.path.abspath('shuffled.pbs.gz')
+        loom.runner.shuffle(rows_in=rows, rows_out=shuffled_rows)
+        prefixed = os.path.abspath('prefixed.pbs.gz')
+        loom.runner.tare(
+            schema_row_in=schema_row,
+            rows_in=shuffled_rows,
+            tares_out=prefixed,
+            sample_count=row_count,
+            shuffled=True)
+        assert_found(prefixed)
+        assert_equal(load_tares(prefixed), expected)
+
+        tiny = os.path.abspath('tiny.pbs.gz')
+        loom.runner.tare(
+            schema_row_in=schema_row,
+            rows_in=rows,
+            tares_out=tiny,
+            sample_count=1,
+            debug=True)
+        assert_found(tiny)
+        for tare in load_tares(tiny):
+            check_tare_is_valid(schema, tare)
+
+
 @for_each_dataset
 def test_sparsify(rows, schema_row, **unused):
     with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
@@ -186,6 +271,162 @@ def test_sparsify(rows, schema_row, **unused):
         assert_found(diffs)
 
 
+def make_bimodal_rows(schema_row_in, rows_out, row_count=1000):
+    with open_compressed(schema_row_in) as f:
+        schema_row = ProductValue()
+        schema_row.ParseFromString(f.read())
+
+    def rows():
+        row = Row()
+        for i in xrange(row_count):
+            row.Clear()
+            row.id = i
+            mode = i % 2
+            pos = row.diff.pos
+            pos.observed.sparsity = ProductValue.Observed.DENSE
+            pos.observed.dense[:] = [True] * len(schema_row.observed.dense)
+            pos.booleans[:] = [bool(mode)] * len(schema_row.booleans)
+            pos.counts[:] = [mode] * len(schema_row.counts)
+            pos.reals[:] = [0.5] * len(schema_row.reals)
+            row.diff.neg.observed.sparsity = ProductValue.Observed.NONE
+            yield row.SerializeToString()
+
+    protobuf_stream_dump(rows(), rows_out)
+    return len(schema_row.booleans) + len(schema_row.counts)
+
+
+def load_diffs(filename):
+    diffs = []
+    for string in protobuf_stream_load(filename):
+        row = Row()
+        row.ParseFromString(string)
+        diffs.append(row.diff)
+    return diffs
+
+
+def get_diff_size(diff):
+    return sum(
+        len(value.booleans) + len(value.counts) + len(value.reals)
+        for value in [diff.pos, diff.neg])
+
+
+@for_each_dataset
+def test_sparsify_multiple_tares(schema_row, init, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        rows = os.path.abspath('rows.pbs.gz')
+        if not make_bimodal_rows(schema_row, rows):
+            return
+        sizes = {}
+        for tare_count in [1, 3]:
+            tares = os.path.abspath('tares.{}.pbs.gz'.format(tare_count))
+            diffs = os.path.abspath('diffs.{}.pbs.gz'.format(tare_count))
+            loom.runner.tare(
+                schema_row_in=schema_row,
+                rows_in=rows,
+                tares_out=tares,
+                tare_count=tare_count)
+            assert_found(tares)
+            loom.runner.sparsify(
+                schema_row_in=schema_row,
+                tares_in=tares,
+                rows_in=rows,
+                rows_out=diffs,
+                debug=True)
+            assert_found(diffs)
+            sizes[tare_count] = sum(map(get_diff_size, load_diffs(diffs)))
+
+        found_count = sum(1 for _ in protobuf_stream_load(tares))
+        assert_true(found_count > 1, 'found only {} tare'.format(found_count))
+        tareids = set(i for diff in load_diffs(diffs) for i in diff.tares)
+        assert_true(
+            any(i > 0 for i in tareids),
+            'no row uses a tare other than the first')
+        assert_true(tareids <= set(range(found_count)))
+        assert_true(
+            sizes[3] < sizes[1],
+            'diffs did not shrink: {} vs {}'.format(sizes[3], sizes[1]))
+
+        config_in = os.path.abspath('config.pb.gz')
+        assign_out = os.path.abspath('assign.pbs.gz')
+        loom.config.config_dump({'schedule': {'extra_passes': 0.0}}, config_in)
+        loom.runner.infer(
+            config_in=config_in,
+            rows_in=diffs,
+            tares_in=tares,
+            model_in=init,
+            assign_out=assign_out,
+            debug=True)
+        assign_count = sum(1 for _ in protobuf_stream_load(assign_out))
+        assert_equal(assign_count, 1000)
+
+
+# deterministic given a seed, so that equivalent inputs can be compared
+SEQUENTIAL_CONFIG = {
+    'schedule': {'extra_passes': 1.5},
+    'kernels': {
+        'cat': {'row_queue_capacity': 0},
+        'hyper': {'parallel': False},
+        'kind': {'iterations': 0},
+    },
+}
+
+
+def check_infer(config, rows_in, tares, init, row_count):
+    config = deepcopy(config)
+    loom.config.fill_in_defaults(config)
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        config_in = os.path.abspath('config.pb.gz')
+        assign_out = os.path.abspath('assign.pbs.gz')
+        loom.config.config_dump(config, config_in)
+        loom.runner.infer(
+            config_in=config_in,
+            rows_in=rows_in,
+            tares_in=tares,
+            model_in=init,
+            assign_out=assign_out,
+            debug=True)
+        assignments = load_assignments(assign_out)
+    assert_equal(len(assignments), row_count)
+    return assignments
+
+
+def dump_duplicated_rows(rows_in, rows_out):
+    originals = load_rows(rows_in)
+    copies = deepcopy(originals)
+    for row in copies:
+        row.id += len(originals)
+    protobuf_stream_dump(
+        (row.SerializeToString() for row in originals + copies),
+        rows_out)
+    return len(originals) + len(copies)
+
+
+@for_each_dataset
+def test_infer_dedup(rows, schema_row, tares, init, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        duplicated = os.path.abspath('duplicated.pbs.gz')
+        row_count = dump_duplicated_rows(rows, duplicated)
+        diffs = os.path.abspath('diffs.pbs.gz')
+        loom.runner.sparsify(
+            schema_row_in=schema_row,
+            tares_in=tares,
+            rows_in=duplicated,
+            rows_out=diffs,
+            dedup=True,
+            debug=True)
+        assert_found(diffs)
+        deduped = load_rows(diffs)
+        dup_ids = set(i for row in deduped for i in row.dup_ids)
+        assert_true(dup_ids, 'no duplicate rows were found')
+        assert_equal(len(deduped) + len(dup_ids), row_count)
+
+        for config in CONFIGS:
+            assignments = check_infer(config, diffs, tares, init, row_count)
+            rowids = set(rowid for rowid, _ in assignments)
+            assert_equal(len(rowids), row_count)
+            assert_true(dup_ids <= rowids, 'duplicate rows were not assigned')
+
+
 @for_each_dataset
 def test_shuffle(diffs, **unused):
     with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
@@ -198,6 +439,125 @@ def test_shuffle(diffs, **unused):
         assert_found(rows_out)
 
 
+@for_each_dataset
+def test_infer_columnar(schema_row, tares, shuffled, init, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        row_count = sum(1 for _ in protobuf_stream_load(shuffled))
+        columns = os.path.abspath('shuffled.cols')
+        loom.runner.columnize(
+            schema_row_in=schema_row,
+            rows_in=shuffled,
+            columns_out=columns,
+            block_size=64,
+            debug=True)
+        assert_found(columns)
+
+        for config in CONFIGS:
+            check_infer(config, columns, tares, init, row_count)
+
+        expected = check_infer(
+            SEQUENTIAL_CONFIG, shuffled, tares, init, row_count)
+        actual = check_infer(
+            SEQUENTIAL_CONFIG, columns, tares, init, row_count)
+        assert_equal(actual, expected)
+
+
+def check_columnar_round_trip(schema_row, rows_in):
+    columns = os.path.abspath('rows.cols')
+    rows_out = os.path.abspath('decolumnized.pbs.gz')
+    loom.runner.columnize(
+        schema_row_in=schema_row,
+        rows_in=rows_in,
+        columns_out=columns,
+        block_size=64,
+        debug=True)
+    assert_found(columns)
+    loom.runner.decolumnize(rows_in=columns, rows_out=rows_out, debug=True)
+    assert_found(rows_out)
+    expected = load_rows(rows_in)
+    actual = load_rows(rows_out)
+    assert_equal(len(actual), len(expected))
+    for expected_row, actual_row in zip(expected, actual):
+        assert_equal(actual_row, expected_row)
+    return expected
+
+
+@for_each_dataset
+def test_columnar_round_trip(schema_row, rows, tares, shuffled, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        duplicated = os.path.abspath('duplicated.pbs.gz')
+        dump_duplicated_rows(rows, duplicated)
+        deduped = os.path.abspath('deduped.pbs.gz')
+        loom.runner.sparsify(
+            schema_row_in=schema_row,
+            tares_in=tares,
+            rows_in=duplicated,
+            rows_out=deduped,
+            dedup=True,
+            debug=True)
+
+        checked = []
+        for rows_in in [rows, shuffled, deduped]:
+            checked += check_columnar_round_trip(schema_row, rows_in)
+
+        sparsities = set(
+            value.observed.sparsity
+            for row in checked
+            for value in [row.diff.pos, row.diff.neg])
+        assert_true(ProductValue.Observed.DENSE in sparsities)
+        assert_true(any(row.diff.tares for row in checked))
+        assert_true(any(row.dup_ids for row in checked))
+
+
+def with_resident_rows(config):
+    config = deepcopy(config)
+    config.setdefault('schedule', {})['resident_rows'] = True
+    return config
+
+
+@for_each_dataset
+def test_infer_resident(tares, shuffled, init, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        row_count = sum(1 for _ in protobuf_stream_load(shuffled))
+        for config in CONFIGS:
+            check_infer(
+                with_resident_rows(config), shuffled, tares, init, row_count)
+
+        expected = check_infer(
+            SEQUENTIAL_CONFIG, shuffled, tares, init, row_count)
+        actual = check_infer(
+            with_resident_rows(SEQUENTIAL_CONFIG),
+            shuffled,
+            tares,
+            init,
+            row_count)
+        assert_equal(actual, expected)
+
+
+@for_each_dataset
+def test_infer_without_snapshots(tares, shuffled, init, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        config = {'schedule': {'extra_passes': 0.0, 'write_snapshots': False}}
+        config_in = os.path.abspath('config.pb.gz')
+        model_out = os.path.abspath('model.pb.gz')
+        groups_out = os.path.abspath('groups')
+        assign_out = os.path.abspath('assign.pbs.gz')
+        os.mkdir(groups_out)
+        loom.config.config_dump(config, config_in)
+        loom.runner.infer(
+            config_in=config_in,
+            rows_in=shuffled,
+            tares_in=tares,
+            model_in=init,
+            model_out=model_out,
+            groups_out=groups_out,
+            assign_out=assign_out,
+            debug=True)
+        assert_found(model_out, groups_out, assign_out)
+        assert_false(os.path.exists(groups_out + '.bin'))
+        assert_false(os.path.exists('assign.bin'))
+
+
 @for_each_dataset
 def test_infer(name, tares, shuffled, init, **unused):
     with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
@@ -243,6 +603,17 @@ def test_infer(name, tares, shuffled, init, **unused):
                 assign_count = sum(1 for _ in protobuf_stream_load(assign_out))
                 assert_equal(assign_count, row_count)
 
+                assert_found(groups_out + '.bin', 'assign.bin')
+                for command in ['protobuf', 'native']:
+                    loom.runner.snapshot(
+                        command,
+                        model_out,
+                        groups_out,
+                        assign_out,
+                        debug=True)
+                assign_count = sum(1 for _ in protobuf_stream_load(assign_out))
+                assert_equal(assign_count, row_count)
+
             print 'row_count: {}'.format(row_count)
             print 'group_counts: {}'.format(' '.join(map(str, group_counts)))
             for group_count in group_counts:
@@ -251,6 +622,85 @@ def test_infer(name, tares, shuffled, init, **unused):
                     'groups are all singletons')
 
 
+def load_assignments(filename):
+    assignments = []
+    for string in protobuf_stream_load(filename):
+        assignment = Assignment()
+        assignment.ParseFromString(string)
+        assignments.append(
+            (assignment.rowid, tuple(assignment.groupids)))
+    return assignments
+
+
+def run_checkpoints(config, shuffled, tares, init):
+    config_in = os.path.abspath('config.pb.gz')
+    loom.config.config_dump(config, config_in)
+    delta_limit = config['schedule']['checkpoint_delta_limit']
+
+    inputs = {'model_in': init}
+    checkpoint = Checkpoint()
+    step = 0
+    delta_count = 0
+    while not checkpoint.finished:
+        step_dir = os.path.abspath(str(step))
+        outputs = {
+            'model_out': os.path.join(step_dir, 'model.pb.gz'),
+            'groups_out': os.path.join(step_dir, 'groups'),
+            'assign_out': os.path.join(step_dir, 'assign.pbs.gz'),
+            'checkpoint_out': os.path.join(step_dir, 'checkpoint.pb.gz'),
+        }
+        os.makedirs(outputs['groups_out'])
+        loom.runner.infer(
+            config_in=config_in,
+            rows_in=shuffled,
+            tares_in=tares,
+            debug=True,
+            **dict(inputs, **outputs))
+        with open_compressed(outputs['checkpoint_out']) as f:
+            checkpoint.ParseFromString(f.read())
+        assert_true(len(checkpoint.assign_deltas) <= delta_limit)
+        delta_count = max(delta_count, len(checkpoint.assign_deltas))
+        inputs = {
+            key.replace('_out', '_in'): value
+            for key, value in outputs.iteritems()
+        }
+        step += 1
+
+    assert_equal(len(checkpoint.assign_deltas), 0)
+    return load_assignments(inputs['assign_in']), delta_count
+
+
+@for_each_dataset
+def test_infer_delta_checkpoints(name, tares, shuffled, init, **unused):
+    row_count = sum(1 for _ in protobuf_stream_load(shuffled))
+    config = {
+        'schedule': {
+            'extra_passes': 1.5,
+            'checkpoint_period_sec': 0,
+        },
+        'kernels': {
+            'cat': {'row_queue_capacity': 0},
+            'hyper': {'parallel': False},
+            'kind': {'iterations': 0},
+        },
+    }
+    results = {}
+    for delta_limit in [0, 2]:
+        config['schedule']['checkpoint_delta_limit'] = delta_limit
+        with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+            results[delta_limit] = run_checkpoints(
+                deepcopy(config),
+                shuffled,
+                tares,
+                init)
+
+    full, full_delta_count = results[0]
+    chained, _ = results[2]
+    assert_equal(full_delta_count, 0)
+    assert_equal(len(full), row_count)
+    assert_equal(chained, full)
+
+
 @for_each_dataset
 def test_posterior_enum(name, tares, diffs, init, **unused):
     with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
@@ -282,6 +732,39 @@ def test_posterior_enum(name, tares, diffs, init, **unused):
         assert_equal(actual_count, config['posterior_enum']['sample_count'])
 
 
+@for_each_dataset
+def test_posterior_enum_chains(name, tares, diffs, init, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        config_in = os.path.abspath('config.pb.gz')
+        config = {
+            'posterior_enum': {
+                'sample_count': 7,
+                'sample_skip': 1,
+                'chain_count': 3,
+            },
+            'kernels': {
+                'kind': {
+                    'row_queue_capacity': 8,
+                    'score_parallel': False,
+                },
+            },
+        }
+        loom.config.config_dump(config, config_in)
+        assert_found(config_in)
+
+        samples_out = os.path.abspath('samples.pbs.gz')
+        loom.runner.posterior_enum(
+            config_in=config_in,
+            model_in=init,
+            tares_in=tares,
+            rows_in=diffs,
+            samples_out=samples_out,
+            debug=True)
+        assert_found(samples_out)
+        actual_count = sum(1 for _ in protobuf_stream_load(samples_out))
+        assert_equal(actual_count, config['posterior_enum']['sample_count'])
+
+
 @for_each_dataset
 def test_generate(model, **unused):
     for row_count in [0, 1, 100]:
@@ -312,3 +795,34 @@ def test_generate(model, **unused):
                 group_counts = get_group_counts(groups_out)
                 print 'group_counts: {}'.format(
                     ' '.join(map(str, group_counts)))
+
+
+@for_each_dataset
+def test_generate_parallel(model, **unused):
+    for row_count in [0, 1, 1000]:
+        with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+            config_in = os.path.abspath('config.pb.gz')
+            config = {
+                'generate': {
+                    'row_count': row_count,
+                    'parallel': True,
+                },
+            }
+            loom.config.config_dump(config, config_in)
+
+            rows_out = os.path.abspath('rows.pbs.gz')
+            groups_out = os.path.abspath('groups')
+            assign_out = os.path.abspath('assign.pbs.gz')
+            loom.runner.generate(
+                config_in=config_in,
+                model_in=model,
+                rows_out=rows_out,
+                groups_out=groups_out,
+                assign_out=assign_out,
+                debug=True)
+            assert_found(rows_out, groups_out, assign_out)
+
+            rowids = [row.id for row in load_rows(rows_out)]
+            assert_equal(rowids, range(row_count))
+            assign_count = sum(1 for _ in protobuf_stream_load(assign_out))
+            assert_equal(assign_count, row_count)
@@ -32,6 +32,7 @@ import loom.store
 import loom.datasets
 import loom.tasks
 import loom.query
+from loom.test.util import assert_found
 from loom.test.util import for_each_dataset
 from loom.test.test_query import get_example_requests, check_response
 
@@ -62,3 +63,15 @@ def test_all(name, schema, rows_csv, **unused):
             pbserver.send(request)
             response = pbserver.receive()
             check_response(request, response)
+
+
+@for_each_dataset
+def test_infer_columnar_rows(name, schema, rows_csv, **unused):
+    name = os.path.join(name, 'test_tasks_columnar')
+    paths = loom.store.get_paths(name, sample_count=1)
+    loom.datasets.clean(name)
+    loom.tasks.ingest(name, schema, rows_csv, debug=True)
+    config = {'schedule': {'extra_passes': 2, 'columnar_rows': True}}
+    loom.tasks.infer_one(name, config=config, debug=True)
+    sample = paths['samples'][0]
+    assert_found(sample['columns'], sample['model'], sample['assign'])
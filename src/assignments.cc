@@ -27,9 +27,12 @@
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <loom/assignments.hpp>
+#include <algorithm>
 #include <unordered_map>
 #include <distributions/trivial_hash.hpp>
 #include <loom/protobuf.hpp>
+#include <loom/snapshot.hpp>
+#include <loom/store.hpp>
 
 namespace loom
 {
@@ -38,6 +41,7 @@ void Assignments::init (size_t kind_count)
 {
     clear();
     values_.resize(kind_count);
+    set_delta_base();
 }
 
 void Assignments::clear ()
@@ -63,17 +67,34 @@ void Assignments::load (const char * filename)
             values_[i].push(assignment.groupids(i));
         }
     }
+    set_delta_base();
 }
 
-void Assignments::dump (
-        const char * filename,
-        const std::vector<std::vector<uint32_t>> & sorted_to_globals) const
+void Assignments::set_delta_base ()
 {
-    const size_t row_count = this->row_count();
     const size_t kind_count = this->kind_count();
+    base_row_count_ = keys_.size();
+    base_pop_count_ = keys_.pop_count();
+    base_group_counts_.assign(kind_count, 0);
+    for (size_t k = 0; k < kind_count; ++k) {
+        size_t & group_count = base_group_counts_[k];
+        const auto & values = values_[k];
+        for (size_t r = 0, size = values.size(); r < size; ++r) {
+            group_count = std::max(group_count, size_t(values[r]) + 1);
+        }
+    }
+    kinds_changed_ = false;
+}
+
+namespace
+{
+typedef distributions::TrivialHash<Assignments::Value> Hash;
+typedef std::unordered_map<Assignments::Value, Assignments::Value, Hash> Map;
 
-    typedef distributions::TrivialHash<Value> Hash;
-    typedef std::unordered_map<Value, Value, Hash> Map;
+std::vector<Map> get_global_to_sorteds (
+        const std::vector<std::vector<uint32_t>> & sorted_to_globals)
+{
+    const size_t kind_count = sorted_to_globals.size();
     std::vector<Map> global_to_sorteds(kind_count);
     for (size_t k = 0; k < kind_count; ++k) {
         Map & global_to_sorted = global_to_sorteds[k];
@@ -83,20 +104,255 @@ void Assignments::dump (
             global_to_sorted[sorted_to_global[g]] = g;
         }
     }
+    return global_to_sorteds;
+}
 
-    protobuf::OutFile file(filename);
-    protobuf::Assignment assignment;
+inline Assignments::Value get_sorted (
+        const Map & global_to_sorted,
+        uint32_t global)
+{
+    auto i = global_to_sorted.find(global);
+    LOOM_ASSERT1(i != global_to_sorted.end(), "bad id: " << global);
+    return i->second;
+}
+
+const char * assign_snapshot_magic = "LOOMASN";
+const uint32_t delta_removed_group = 0xffffffff;
+} // anonymous namespace
+
+void Assignments::dump (
+        const char * filename,
+        const std::vector<std::vector<uint32_t>> & sorted_to_globals) const
+{
+    const size_t row_count = this->row_count();
+    const size_t kind_count = this->kind_count();
+    const std::vector<Map> global_to_sorteds =
+        get_global_to_sorteds(sorted_to_globals);
+
+    auto dump_rows = [&](protobuf::OutFile & file, size_t begin, size_t end){
+        protobuf::Assignment assignment;
+        for (size_t r = begin; r < end; ++r) {
+            assignment.clear_groupids();
+            assignment.set_rowid(keys_[r]);
+            for (size_t k = 0; k < kind_count; ++k) {
+                uint32_t global = values_[k][r];
+                assignment.add_groupids(
+                    get_sorted(global_to_sorteds[k], global));
+            }
+            file.write_stream(assignment);
+        }
+    };
+
+    if (not snapshot::is_file(filename)) {
+        protobuf::OutFile file(filename);
+        dump_rows(file, 0, row_count);
+        return;
+    }
+
+    // Chunks of rows are serialized and compressed in parallel, then
+    // appended in order, a batch at a time to bound memory.  Gzip readers
+    // accept a file of concatenated members.
+    const bool compressed = protobuf::endswith(filename, ".gz");
+    const size_t chunk_size = 1UL << 16;
+    const size_t batch_size = 64;
+    const size_t chunk_count = (row_count + chunk_size - 1) / chunk_size;
+    std::vector<std::string> chunks(std::min(chunk_count, batch_size));
+    BinaryOutFile file(filename);
+    for (size_t batch = 0; batch < chunk_count; batch += batch_size) {
+        const size_t batch_end = std::min(chunk_count, batch + batch_size);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t c = batch; c < batch_end; ++c) {
+            std::string & chunk = chunks[c - batch];
+            chunk.clear();
+            protobuf::OutFile chunk_file(chunk, compressed);
+            const size_t begin = c * chunk_size;
+            const size_t end = std::min(row_count, begin + chunk_size);
+            dump_rows(chunk_file, begin, end);
+        }
+
+        for (size_t c = batch; c < batch_end; ++c) {
+            const std::string & chunk = chunks[c - batch];
+            file.write(chunk.data(), chunk.size());
+        }
+    }
+}
+
+// layout: header, source fingerprint, rowids[row_count],
+// groupids[kind_count][row_count]
+bool Assignments::snapshot_is_fresh (
+        const char * filename,
+        const char * source) const
+{
+    if (not snapshot::exists(filename)) {
+        return false;
+    }
+    MappedFile file(filename);
+    if (not snapshot::has_header(file, assign_snapshot_magic)) {
+        return false;
+    }
+    const auto & header = * file.at<snapshot::Header>(0);
+    if (header.size0 != kind_count()) {
+        return false;
+    }
+    const size_t row_count = header.size1;
+    const size_t size = sizeof(header) + sizeof(snapshot::Fingerprint) +
+        (sizeof(Key) + sizeof(Value) * header.size0) * row_count;
+    if (file.size() != size) {
+        return false;
+    }
+    const auto & fingerprint =
+        * file.at<snapshot::Fingerprint>(sizeof(header));
+    return snapshot::matches(fingerprint, source);
+}
+
+void Assignments::snapshot_load (const char * filename)
+{
+    clear();
+
+    MappedFile file(filename);
+    const auto & header = snapshot::check_header(file, assign_snapshot_magic);
+    const size_t kind_count = this->kind_count();
+    const size_t row_count = header.size1;
+    LOOM_ASSERT_EQ(header.size0, kind_count);
+
+    size_t offset = sizeof(header) + sizeof(snapshot::Fingerprint);
+    const Key * rowids = file.at<Key>(offset, row_count);
     for (size_t r = 0; r < row_count; ++r) {
-        assignment.clear_groupids();
-        assignment.set_rowid(keys_[r]);
+        keys_.push(rowids[r]);
+    }
+    offset += sizeof(Key) * row_count;
+
+    for (size_t k = 0; k < kind_count; ++k) {
+        const Value * groupids = file.at<Value>(offset, row_count);
+        auto & values = values_[k];
+        for (size_t r = 0; r < row_count; ++r) {
+            values.push(groupids[r]);
+        }
+        offset += sizeof(Value) * row_count;
+    }
+    set_delta_base();
+}
+
+void Assignments::delta_load (const Delta & delta)
+{
+    const size_t kind_count = this->kind_count();
+    LOOM_ASSERT_LE(delta.pop_count(), keys_.size());
+    LOOM_ASSERT_EQ(delta.remaps_size(), kind_count);
+
+    for (size_t i = 0, size = delta.pop_count(); i < size; ++i) {
+        keys_.pop();
+        for (auto & values : values_) {
+            values.pop();
+        }
+    }
+
+    const size_t row_count = this->row_count();
+    for (size_t k = 0; k < kind_count; ++k) {
+        const auto & remap = delta.remaps(k).sorted();
+        auto & values = values_[k];
+        for (size_t r = 0; r < row_count; ++r) {
+            const Value value = values[r];
+            LOOM_ASSERT_LT(value, remap.size());
+            const Value sorted = remap.Get(value);
+            LOOM_ASSERT_NE(sorted, delta_removed_group);
+            values.set(r, sorted);
+        }
+    }
+
+    protobuf::InFile file(delta.pushed().c_str());
+    protobuf::Assignment assignment;
+    while (file.try_read_stream(assignment)) {
+        LOOM_ASSERT_EQ(assignment.groupids_size(), kind_count);
+        keys_.push(assignment.rowid());
         for (size_t k = 0; k < kind_count; ++k) {
-            const Map & global_to_sorted = global_to_sorteds[k];
-            uint32_t global = values_[k][r];
-            auto i = global_to_sorted.find(global);
-            LOOM_ASSERT1(i != global_to_sorted.end(), "bad id: " << global);
-            assignment.add_groupids(i->second);
+            values_[k].push(assignment.groupids(k));
+        }
+    }
+    set_delta_base();
+}
+
+void Assignments::delta_dump (
+        const char * filename,
+        const std::vector<std::vector<uint32_t>> & sorted_to_globals,
+        Delta & delta) const
+{
+    LOOM_ASSERT(can_dump_delta(), "kinds changed since assignments loaded");
+    const size_t row_count = this->row_count();
+    const size_t kind_count = this->kind_count();
+    const std::vector<Map> global_to_sorteds =
+        get_global_to_sorteds(sorted_to_globals);
+
+    // rows are popped from the front and pushed to the back, so the base
+    // rows that remain precede every pushed row; pops replayed by
+    // delta_load precede the base and so are not counted
+    const size_t pop_count = std::min(
+        keys_.pop_count() - base_pop_count_,
+        base_row_count_);
+    const size_t kept_count = base_row_count_ - pop_count;
+    LOOM_ASSERT_LE(kept_count, row_count);
+    delta.set_pop_count(pop_count);
+
+    // after a load, each group's global id is its sorted position
+    delta.clear_remaps();
+    for (size_t k = 0; k < kind_count; ++k) {
+        const Map & global_to_sorted = global_to_sorteds[k];
+        auto & remap = * delta.add_remaps()->mutable_sorted();
+        for (size_t g = 0; g < base_group_counts_[k]; ++g) {
+            auto i = global_to_sorted.find(g);
+            remap.Add(
+                i == global_to_sorted.end() ? delta_removed_group : i->second);
+        }
+    }
+
+    {
+        protobuf::OutFile file(filename);
+        protobuf::Assignment assignment;
+        for (size_t r = kept_count; r < row_count; ++r) {
+            assignment.clear_groupids();
+            assignment.set_rowid(keys_[r]);
+            for (size_t k = 0; k < kind_count; ++k) {
+                uint32_t global = values_[k][r];
+                assignment.add_groupids(
+                    get_sorted(global_to_sorteds[k], global));
+            }
+            file.write_stream(assignment);
+        }
+    }
+    delta.set_pushed(store::get_absolute_path(filename));
+}
+
+void Assignments::snapshot_dump (
+        const char * filename,
+        const char * source,
+        const std::vector<std::vector<uint32_t>> & sorted_to_globals) const
+{
+    const size_t row_count = this->row_count();
+    const size_t kind_count = this->kind_count();
+    const std::vector<Map> global_to_sorteds =
+        get_global_to_sorteds(sorted_to_globals);
+
+    BinaryOutFile file(filename);
+    file.write_pod(snapshot::make_header(
+        assign_snapshot_magic,
+        kind_count,
+        row_count));
+    file.write_pod(snapshot::fingerprint(source));
+
+    std::vector<Key> rowids(row_count);
+    for (size_t r = 0; r < row_count; ++r) {
+        rowids[r] = keys_[r];
+    }
+    file.write(rowids.data(), row_count);
+
+    std::vector<Value> groupids(row_count);
+    for (size_t k = 0; k < kind_count; ++k) {
+        const Map & global_to_sorted = global_to_sorteds[k];
+        const auto & values = values_[k];
+        for (size_t r = 0; r < row_count; ++r) {
+            groupids[r] = get_sorted(global_to_sorted, values[r]);
         }
-        file.write_stream(assignment);
+        file.write(groupids.data(), row_count);
     }
 }
 
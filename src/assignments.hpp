@@ -32,6 +32,7 @@
 #include <utility>
 #include <distributions/vector.hpp>
 #include <loom/common.hpp>
+#include <loom/protobuf.hpp>
 
 namespace loom
 {
@@ -40,26 +41,74 @@ class Assignments : noncopyable
 {
 public:
 
+    //------------------------------------------------------------------------
+    // Queue
+    //
+    // Design Goals:
+    //  * Provide FIFO push/pop and random access to unsigned integers.
+    //  * Use few bits per entry: entries live in a ring of fixed-size
+    //    chunks, each bit-packed at the width of its widest entry.
+    //    A chunk is widened in place when a wider value is written to it,
+    //    so small groupids take a byte or less and rowids take only the
+    //    bits of the largest id, rather than 32 or 64 bits.
+    //  * Free memory as chunks are popped.
+
     template<class T>
     class Queue
     {
     public:
 
-        bool empty () const { return queue_.empty(); }
-        size_t size () const { return queue_.size(); }
+        Queue () : chunks_(), begin_(0), size_(0), pop_count_(0) {}
+
+        bool empty () const { return size_ == 0; }
+        size_t size () const { return size_; }
+
+        T front () const { return (* this)[0]; }
+        T back () const { return (* this)[size_ - 1]; }
+
+        T operator[] (size_t i) const
+        {
+            if (LOOM_DEBUG_LEVEL >= 2) {
+                LOOM_ASSERT_LT(i, size_);
+            }
+            const size_t pos = begin_ + i;
+            return chunks_[pos / chunk_size].get(pos % chunk_size);
+        }
+
+        void set (size_t i, T t)
+        {
+            if (LOOM_DEBUG_LEVEL >= 2) {
+                LOOM_ASSERT_LT(i, size_);
+            }
+            const size_t pos = begin_ + i;
+            chunks_[pos / chunk_size].set(pos % chunk_size, t);
+        }
 
-        const T & front () const { return queue_.front(); }
-        const T & back () const { return queue_.back(); }
-        const T & operator[] (size_t i) const { return queue_[i]; }
+        // counts pops since the last clear
+        size_t pop_count () const { return pop_count_; }
 
-        void clear () { queue_.clear(); }
+        void clear ()
+        {
+            chunks_.clear();
+            begin_ = 0;
+            size_ = 0;
+            pop_count_ = 0;
+        }
 
-        void push (const T & t) { queue_.push_back(t); }
+        void push (const T & t)
+        {
+            const size_t pos = begin_ + size_;
+            if (pos == chunks_.size() * chunk_size) {
+                chunks_.push_back(Chunk());
+            }
+            chunks_.back().set(pos % chunk_size, t);
+            ++size_;
+        }
 
         bool try_push (const T & t)
         {
             if (LOOM_UNLIKELY(empty()) or LOOM_LIKELY(t != front())) {
-                queue_.push_back(t);
+                push(t);
                 return true;
             } else {
                 return false;
@@ -70,30 +119,138 @@ public:
         {
             LOOM_ASSERT1(not empty(), "cannot pop from empty queue");
             const T t = front();
-            queue_.pop_front();
+            --size_;
+            ++pop_count_;
+            if (++begin_ == chunk_size) {
+                chunks_.pop_front();
+                begin_ = 0;
+            }
             return t;
         }
 
-        typedef typename std::deque<T>::const_iterator iterator;
-        iterator begin () const { return queue_.begin(); }
-        iterator end () const { return queue_.end(); }
-
     private:
 
-        std::deque<T> queue_;
+        typedef uint64_t Word;
+        enum { word_bits = 64 };
+        enum { chunk_size = 4096 };
+
+        struct Chunk
+        {
+            size_t width;
+            std::vector<Word> words;
+
+            Chunk () : width(0), words() {}
+
+            T get (size_t i) const
+            {
+                if (width == 0) {
+                    return 0;
+                }
+                const size_t bit = i * width;
+                const size_t w = bit / word_bits;
+                const size_t offset = bit % word_bits;
+                Word value = words[w] >> offset;
+                if (offset + width > word_bits) {
+                    value |= words[w + 1] << (word_bits - offset);
+                }
+                return value & mask(width);
+            }
+
+            void set (size_t i, T t)
+            {
+                const Word value = t;
+                const size_t required = value ? 64 - __builtin_clzll(value) : 0;
+                if (LOOM_UNLIKELY(required > width)) {
+                    widen(required);
+                }
+                if (width == 0) {
+                    return;
+                }
+                const size_t bit = i * width;
+                const size_t w = bit / word_bits;
+                const size_t offset = bit % word_bits;
+                words[w] &= ~(mask(width) << offset);
+                words[w] |= value << offset;
+                if (offset + width > word_bits) {
+                    const size_t shift = word_bits - offset;
+                    words[w + 1] &= ~(mask(width) >> shift);
+                    words[w + 1] |= value >> shift;
+                }
+            }
+
+            void widen (size_t new_width)
+            {
+                Chunk wide;
+                wide.width = new_width;
+                wide.words.resize(chunk_size * new_width / word_bits, 0);
+                for (size_t i = 0; i < chunk_size and width; ++i) {
+                    wide.set(i, get(i));
+                }
+                std::swap(width, wide.width);
+                words.swap(wide.words);
+            }
+
+            static Word mask (size_t width)
+            {
+                return width == word_bits ? ~Word(0) : (Word(1) << width) - 1;
+            }
+        };
+
+        std::deque<Chunk> chunks_;
+        size_t begin_;
+        size_t size_;
+        size_t pop_count_;
     };
 
     typedef uint64_t Key;
     typedef uint32_t Value;
 
+    Assignments () :
+        keys_(),
+        values_(),
+        base_row_count_(0),
+        base_pop_count_(0),
+        base_group_counts_(),
+        kinds_changed_(false)
+    {
+    }
+
     void init (size_t kind_count);
     void clear ();
     void load (const char * filename);
     void dump (
             const char * filename,
             const std::vector<std::vector<uint32_t>> & sorted_to_globals) const;
-    Queue<Value> & packed_add () { return values_.packed_add(); }
-    void packed_remove (size_t i) { values_.packed_remove(i); }
+
+    // a native snapshot is fresh only while its protobuf source is unchanged
+    bool snapshot_is_fresh (const char * filename, const char * source) const;
+    void snapshot_load (const char * filename);
+    void snapshot_dump (
+            const char * filename,
+            const char * source,
+            const std::vector<std::vector<uint32_t>> & sorted_to_globals) const;
+
+    // Deltas relative to the last load record rows popped from the front,
+    // rows pushed to the back, and how sorted groupids were relabeled.
+    // They are exact only while the set of kinds is unchanged.
+    typedef protobuf::Checkpoint::AssignDelta Delta;
+    bool can_dump_delta () const { return not kinds_changed_; }
+    void delta_load (const Delta & delta);
+    void delta_dump (
+            const char * filename,
+            const std::vector<std::vector<uint32_t>> & sorted_to_globals,
+            Delta & delta) const;
+
+    Queue<Value> & packed_add ()
+    {
+        kinds_changed_ = true;
+        return values_.packed_add();
+    }
+    void packed_remove (size_t i)
+    {
+        kinds_changed_ = true;
+        values_.packed_remove(i);
+    }
 
     size_t row_count () const { return keys_.size(); }
     size_t kind_count () const { return values_.size(); }
@@ -112,8 +269,15 @@ public:
 
 private:
 
+    // marks the current state as the base of the next delta
+    void set_delta_base ();
+
     Queue<Key> keys_;
     distributions::Packed_<Queue<Value>> values_;
+    size_t base_row_count_;
+    size_t base_pop_count_;
+    std::vector<size_t> base_group_counts_;
+    bool kinds_changed_;
 };
 
 } // namespace loom
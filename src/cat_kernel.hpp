@@ -39,6 +39,14 @@ namespace loom
 
 using ::distributions::sample_from_scores_overwrite;
 
+//----------------------------------------------------------------------------
+// Cat Kernel
+//
+// A deduplicated row of multiplicity n is added in one step: its partial
+// diffs are scored once per kind, then all n group assignments are sampled
+// from that same posterior.  Assignments still hold one entry per input row,
+// in the order protobuf::row_id() lists them.
+
 class CatKernel : noncopyable
 {
 public:
@@ -65,14 +73,27 @@ public:
             const protobuf::Row & row,
             protobuf::Assignment & packed_assignment_out);
 
+    void add_row (
+            rng_t & rng,
+            const protobuf::Row & row,
+            std::vector<protobuf::Assignment> & packed_assignments_out);
+
     void add_row (
             rng_t & rng,
             const protobuf::Row & row,
             Assignments & assignments);
 
+    // as above, for a row already split and simplified into partial_diffs
+    void add_row (
+            rng_t & rng,
+            const protobuf::Row & row,
+            const std::vector<ProductValue::Diff> & partial_diffs,
+            Assignments & assignments);
+
     void process_add_task (
             CrossCat::Kind & kind,
             const ProductValue::Diff & partial_diff,
+            size_t count,
             VectorFloat & scores,
             Groupids & groupids,
             rng_t & rng);
@@ -87,9 +108,16 @@ public:
             const protobuf::Row & row,
             Assignments & assignments);
 
+    void remove_row (
+            rng_t & rng,
+            const protobuf::Row & row,
+            const std::vector<ProductValue::Diff> & partial_diffs,
+            Assignments & assignments);
+
     void process_remove_task (
             CrossCat::Kind & kind,
             const ProductValue::Diff & partial_diff,
+            size_t count,
             Groupids & groupids,
             rng_t & rng);
 
@@ -97,6 +125,18 @@ public:
 
 private:
 
+    void add_split_row (
+            rng_t & rng,
+            const protobuf::Row & row,
+            const std::vector<ProductValue::Diff> & partial_diffs,
+            Assignments & assignments);
+
+    void remove_split_row (
+            rng_t & rng,
+            const protobuf::Row & row,
+            const std::vector<ProductValue::Diff> & partial_diffs,
+            Assignments & assignments);
+
     CrossCat & cross_cat_;
     std::vector<ProductValue::Diff> partial_diffs_;
     VectorFloat scores_;
@@ -118,25 +158,16 @@ inline void CatKernel::add_row_noassign (
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
 
+    const size_t count = protobuf::row_multiplicity(row);
     const size_t kind_count = cross_cat_.kinds.size();
     for (size_t i = 0; i < kind_count; ++i) {
-        const auto & partial_diff = partial_diffs_[i];
-        auto & kind = cross_cat_.kinds[i];
-        ProductModel & model = kind.model;
-        auto & mixture = kind.mixture;
-
-        if (cross_cat_.tares.empty()) {
-            auto & value = partial_diff.pos();
-            model.add_value(value, rng);
-            mixture.score_value(model, value, scores_, rng);
-            size_t groupid = sample_from_scores_overwrite(rng, scores_);
-            mixture.add_value(model, groupid, value, rng);
-        } else {
-            model.add_diff(partial_diff, rng);
-            mixture.score_diff(model, partial_diff, scores_, rng);
-            size_t groupid = sample_from_scores_overwrite(rng, scores_);
-            mixture.add_diff(model, groupid, partial_diff, rng);
-        }
+        cross_cat_.add_copies(
+            cross_cat_.kinds[i],
+            partial_diffs_[i],
+            count,
+            scores_,
+            rng,
+            [](size_t){});
     }
 }
 
@@ -146,6 +177,7 @@ inline void CatKernel::add_row (
         protobuf::Assignment & packed_assignment_out)
 {
     Timer::Scope timer(timer_);
+    LOOM_ASSERT_EQ(protobuf::row_multiplicity(row), 1);
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
     packed_assignment_out.set_rowid(row.id());
@@ -153,25 +185,46 @@ inline void CatKernel::add_row (
 
     const size_t kind_count = cross_cat_.kinds.size();
     for (size_t i = 0; i < kind_count; ++i) {
-        const auto & partial_diff = partial_diffs_[i];
-        auto & kind = cross_cat_.kinds[i];
-        ProductModel & model = kind.model;
-        auto & mixture = kind.mixture;
+        cross_cat_.add_copies(
+            cross_cat_.kinds[i],
+            partial_diffs_[i],
+            1,
+            scores_,
+            rng,
+            [&](size_t groupid){
+                packed_assignment_out.add_groupids(groupid);
+            });
+    }
+}
 
-        size_t groupid;
-        if (cross_cat_.tares.empty()) {
-            auto & value = partial_diff.pos();
-            model.add_value(value, rng);
-            mixture.score_value(model, value, scores_, rng);
-            groupid = sample_from_scores_overwrite(rng, scores_);
-            mixture.add_value(model, groupid, value, rng);
-        } else {
-            model.add_diff(partial_diff, rng);
-            mixture.score_diff(model, partial_diff, scores_, rng);
-            groupid = sample_from_scores_overwrite(rng, scores_);
-            mixture.add_diff(model, groupid, partial_diff, rng);
-        }
-        packed_assignment_out.add_groupids(groupid);
+inline void CatKernel::add_row (
+        rng_t & rng,
+        const protobuf::Row & row,
+        std::vector<protobuf::Assignment> & packed_assignments_out)
+{
+    Timer::Scope timer(timer_);
+    cross_cat_.splitter.split(row.diff(), partial_diffs_);
+    cross_cat_.simplify(partial_diffs_);
+
+    const size_t count = protobuf::row_multiplicity(row);
+    packed_assignments_out.resize(count);
+    for (size_t c = 0; c < count; ++c) {
+        packed_assignments_out[c].set_rowid(protobuf::row_id(row, c));
+        packed_assignments_out[c].clear_groupids();
+    }
+
+    const size_t kind_count = cross_cat_.kinds.size();
+    for (size_t i = 0; i < kind_count; ++i) {
+        size_t c = 0;
+        cross_cat_.add_copies(
+            cross_cat_.kinds[i],
+            partial_diffs_[i],
+            count,
+            scores_,
+            rng,
+            [&](size_t groupid){
+                packed_assignments_out[c++].add_groupids(groupid);
+            });
     }
 }
 
@@ -181,16 +234,39 @@ inline void CatKernel::add_row (
         Assignments & assignments)
 {
     Timer::Scope timer(timer_);
-    bool ok = assignments.rowids().try_push(row.id());
-    LOOM_ASSERT1(ok, "duplicate row: " << row.id());
-
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
+    add_split_row(rng, row, partial_diffs_, assignments);
+}
+
+inline void CatKernel::add_row (
+        rng_t & rng,
+        const protobuf::Row & row,
+        const std::vector<ProductValue::Diff> & partial_diffs,
+        Assignments & assignments)
+{
+    Timer::Scope timer(timer_);
+    add_split_row(rng, row, partial_diffs, assignments);
+}
+
+inline void CatKernel::add_split_row (
+        rng_t & rng,
+        const protobuf::Row & row,
+        const std::vector<ProductValue::Diff> & partial_diffs,
+        Assignments & assignments)
+{
+    const size_t count = protobuf::row_multiplicity(row);
+    for (size_t c = 0; c < count; ++c) {
+        bool ok = assignments.rowids().try_push(protobuf::row_id(row, c));
+        LOOM_ASSERT1(ok, "duplicate row: " << protobuf::row_id(row, c));
+    }
+
     const size_t kind_count = cross_cat_.kinds.size();
     for (size_t i = 0; i < kind_count; ++i) {
         process_add_task(
             cross_cat_.kinds[i],
-            partial_diffs_[i],
+            partial_diffs[i],
+            count,
             scores_,
             assignments.groupids(i),
             rng);
@@ -200,28 +276,21 @@ inline void CatKernel::add_row (
 inline void CatKernel::process_add_task (
         CrossCat::Kind & kind,
         const ProductValue::Diff & partial_diff,
+        size_t count,
         VectorFloat & scores,
         Groupids & groupids,
         rng_t & rng)
 {
-    ProductModel & model = kind.model;
-    auto & mixture = kind.mixture;
-
-    size_t groupid;
-    if (cross_cat_.tares.empty()) {
-        auto & value = partial_diff.pos();
-        model.add_value(value, rng);
-        mixture.score_value(model, value, scores, rng);
-        groupid = sample_from_scores_overwrite(rng, scores);
-        mixture.add_value(model, groupid, value, rng);
-    } else {
-        model.add_diff(partial_diff, rng);
-        mixture.score_diff(model, partial_diff, scores, rng);
-        groupid = sample_from_scores_overwrite(rng, scores);
-        mixture.add_diff(model, groupid, partial_diff, rng);
-    }
-    size_t global_groupid = mixture.id_tracker.packed_to_global(groupid);
-    groupids.push(global_groupid);
+    const auto & id_tracker = kind.mixture.id_tracker;
+    cross_cat_.add_copies(
+        kind,
+        partial_diff,
+        count,
+        scores,
+        rng,
+        [&](size_t groupid){
+            groupids.push(id_tracker.packed_to_global(groupid));
+        });
 }
 
 inline void CatKernel::remove_row (
@@ -230,6 +299,7 @@ inline void CatKernel::remove_row (
         const protobuf::Assignment & packed_assignment)
 {
     Timer::Scope timer(timer_);
+    LOOM_ASSERT_EQ(protobuf::row_multiplicity(row), 1);
     if (LOOM_DEBUG_LEVEL >= 1) {
         LOOM_ASSERT_EQ(packed_assignment.rowid(), row.id());
     }
@@ -261,18 +331,41 @@ inline void CatKernel::remove_row (
         Assignments & assignments)
 {
     Timer::Scope timer(timer_);
-    const auto rowid = assignments.rowids().pop();
-    if (LOOM_DEBUG_LEVEL >= 1) {
-        LOOM_ASSERT_EQ(rowid, row.id());
-    }
-
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
+    remove_split_row(rng, row, partial_diffs_, assignments);
+}
+
+inline void CatKernel::remove_row (
+        rng_t & rng,
+        const protobuf::Row & row,
+        const std::vector<ProductValue::Diff> & partial_diffs,
+        Assignments & assignments)
+{
+    Timer::Scope timer(timer_);
+    remove_split_row(rng, row, partial_diffs, assignments);
+}
+
+inline void CatKernel::remove_split_row (
+        rng_t & rng,
+        const protobuf::Row & row,
+        const std::vector<ProductValue::Diff> & partial_diffs,
+        Assignments & assignments)
+{
+    const size_t count = protobuf::row_multiplicity(row);
+    for (size_t c = 0; c < count; ++c) {
+        const auto rowid = assignments.rowids().pop();
+        if (LOOM_DEBUG_LEVEL >= 1) {
+            LOOM_ASSERT_EQ(rowid, protobuf::row_id(row, c));
+        }
+    }
+
     const size_t kind_count = cross_cat_.kinds.size();
     for (size_t i = 0; i < kind_count; ++i) {
         process_remove_task(
             cross_cat_.kinds[i],
-            partial_diffs_[i],
+            partial_diffs[i],
+            count,
             assignments.groupids(i),
             rng);
     }
@@ -281,21 +374,24 @@ inline void CatKernel::remove_row (
 inline void CatKernel::process_remove_task (
         CrossCat::Kind & kind,
         const ProductValue::Diff & partial_diff,
+        size_t count,
         Groupids & groupids,
         rng_t & rng)
 {
     ProductModel & model = kind.model;
     auto & mixture = kind.mixture;
 
-    auto global_groupid = groupids.pop();
-    auto groupid = mixture.id_tracker.global_to_packed(global_groupid);
-    if (cross_cat_.tares.empty()) {
-        auto & value = partial_diff.pos();
-        mixture.remove_value(model, groupid, value, rng);
-        model.remove_value(value, rng);
-    } else {
-        mixture.remove_diff(model, groupid, partial_diff, rng);
-        model.remove_diff(partial_diff, rng);
+    for (size_t c = 0; c < count; ++c) {
+        auto global_groupid = groupids.pop();
+        auto groupid = mixture.id_tracker.global_to_packed(global_groupid);
+        if (cross_cat_.tares.empty()) {
+            auto & value = partial_diff.pos();
+            mixture.remove_value(model, groupid, value, rng);
+            model.remove_value(value, rng);
+        } else {
+            mixture.remove_diff(model, groupid, partial_diff, rng);
+            model.remove_diff(partial_diff, rng);
+        }
     }
 }
 
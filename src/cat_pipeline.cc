@@ -80,9 +80,7 @@ void CatPipeline::start_threads (size_t parser_threads)
         add_thread(1,
             [i, this, parser_threads](Task & task, ThreadState &){
             if (not task.parsed.test_and_set()) {
-                task.row.ParseFromArray(task.raw.data(), task.raw.size());
-                cross_cat_.splitter.split(task.row.diff(), task.partial_diffs);
-                cross_cat_.simplify(task.partial_diffs);
+                rows_.parse_split(task.raw, cross_cat_, task.split, false);
             }
         });
     }
@@ -90,13 +88,18 @@ void CatPipeline::start_threads (size_t parser_threads)
     // add/remove
     auto & rowids = assignments_.rowids();
     add_thread(2, [&rowids](const Task & task, ThreadState &){
-        if (task.add) {
-            bool ok = rowids.try_push(task.row.id());
-            LOOM_ASSERT1(ok, "duplicate row: " << task.row.id());
-        } else {
-            const auto rowid = rowids.pop();
-            if (LOOM_DEBUG_LEVEL >= 1) {
-                LOOM_ASSERT_EQ(rowid, task.row.id());
+        const auto & row = * task.split.row;
+        const size_t count = protobuf::row_multiplicity(row);
+        for (size_t c = 0; c < count; ++c) {
+            const auto id = protobuf::row_id(row, c);
+            if (task.add) {
+                bool ok = rowids.try_push(id);
+                LOOM_ASSERT1(ok, "duplicate row: " << id);
+            } else {
+                const auto rowid = rowids.pop();
+                if (LOOM_DEBUG_LEVEL >= 1) {
+                    LOOM_ASSERT_EQ(rowid, id);
+                }
             }
         }
     });
@@ -108,17 +111,21 @@ void CatPipeline::start_threads (size_t parser_threads)
             [i, this, &kind, &groupids]
             (const Task & task, ThreadState & thread)
         {
+            const auto & partial_diff = (* task.split.partial_diffs)[i];
+            const size_t count = protobuf::row_multiplicity(* task.split.row);
             if (task.add) {
                 cat_kernel_.process_add_task(
                     kind,
-                    task.partial_diffs[i],
+                    partial_diff,
+                    count,
                     thread.scores,
                     groupids,
                     thread.rng);
             } else {
                 cat_kernel_.process_remove_task(
                     kind,
-                    task.partial_diffs[i],
+                    partial_diff,
+                    count,
                     groupids,
                     thread.rng);
             }
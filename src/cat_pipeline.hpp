@@ -72,8 +72,7 @@ private:
         std::atomic_flag parsed;
         bool add;
         std::vector<char> raw;
-        protobuf::Row row;
-        std::vector<ProductValue::Diff> partial_diffs;
+        StreamInterval::SplitRow split;
 
         Task () : parsed(ATOMIC_FLAG_INIT) {}
     };
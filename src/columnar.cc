@@ -0,0 +1,545 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <loom/columnar.hpp>
+#include <loom/snapshot.hpp>
+
+namespace loom
+{
+
+// layout: header, blocks[block_count], block_offsets[block_count], footer
+// block layout: BlockHeader, ids[n], dup_begins[n + 1], dup_ids[],
+//   tare_begins[n + 1], tares[], sparsities[2][n], columns[column_count],
+//   then per column: bits[words], ranks[words], values[]
+// Every array starts at a multiple of 8 bytes.
+
+namespace
+{
+
+const char * columnar_magic = "LOOMCOL";
+
+struct BlockHeader
+{
+    uint64_t row_count;
+    uint64_t dup_count;
+    uint64_t tare_count;
+    uint64_t column_count;
+};
+
+struct ColumnEntry
+{
+    uint32_t part;
+    uint32_t featureid;
+    uint64_t offset;
+};
+
+struct Footer
+{
+    uint64_t booleans_size;
+    uint64_t counts_size;
+    uint64_t reals_size;
+    uint64_t record_count;
+    uint64_t row_count;
+    uint64_t block_count;
+};
+
+inline size_t word_count (size_t row_count)
+{
+    return (row_count + 63) / 64;
+}
+
+inline size_t padded (size_t size)
+{
+    return (size + 7) / 8 * 8;
+}
+
+template<class T>
+inline void append (std::string & out, const T * data, size_t count)
+{
+    out.append(reinterpret_cast<const char *>(data), sizeof(T) * count);
+    out.resize(padded(out.size()), '\0');
+}
+
+void build_block (
+        const ValueSchema & schema,
+        const protobuf::Row * rows,
+        size_t row_count,
+        std::string & out)
+{
+    const size_t feature_count = schema.total_size();
+    const size_t booleans_end = schema.booleans_size;
+    const size_t counts_end = booleans_end + schema.counts_size;
+    const size_t words = word_count(row_count);
+
+    std::vector<uint64_t> ids(row_count);
+    std::vector<uint32_t> dup_begins(1, 0);
+    std::vector<uint64_t> dup_ids;
+    std::vector<uint32_t> tare_begins(1, 0);
+    std::vector<uint32_t> tares;
+    std::vector<uint8_t> sparsities(2 * row_count);
+    std::vector<std::vector<uint64_t>> bits(2 * feature_count);
+    std::vector<std::string> values(2 * feature_count);
+
+    for (size_t r = 0; r < row_count; ++r) {
+        const protobuf::Row & row = rows[r];
+        ids[r] = row.id();
+        for (auto id : row.dup_ids()) {
+            dup_ids.push_back(id);
+        }
+        dup_begins.push_back(dup_ids.size());
+        for (auto tare : row.diff().tares()) {
+            tares.push_back(tare);
+        }
+        tare_begins.push_back(tares.size());
+
+        for (size_t part = 0; part < 2; ++part) {
+            const ProductValue & value =
+                part ? row.diff().neg() : row.diff().pos();
+            sparsities[part * row_count + r] = value.observed().sparsity();
+            size_t booleans_pos = 0;
+            size_t counts_pos = 0;
+            size_t reals_pos = 0;
+            schema.for_each(value.observed(), [&](size_t f){
+                const size_t c = part * feature_count + f;
+                if (bits[c].empty()) {
+                    bits[c].resize(words, 0);
+                }
+                bits[c][r / 64] |= uint64_t(1) << (r % 64);
+                std::string & column = values[c];
+                if (f < booleans_end) {
+                    const uint8_t data = value.booleans(booleans_pos++);
+                    column.append(reinterpret_cast<const char *>(& data), 1);
+                } else if (f < counts_end) {
+                    const uint32_t data = value.counts(counts_pos++);
+                    column.append(reinterpret_cast<const char *>(& data), 4);
+                } else {
+                    const float data = value.reals(reals_pos++);
+                    column.append(reinterpret_cast<const char *>(& data), 4);
+                }
+            });
+            LOOM_ASSERT1(
+                booleans_pos == size_t(value.booleans_size()) and
+                counts_pos == size_t(value.counts_size()) and
+                reals_pos == size_t(value.reals_size()),
+                "observed does not match values in row " << row.id());
+        }
+    }
+
+    std::vector<ColumnEntry> columns;
+    for (size_t c = 0; c < bits.size(); ++c) {
+        if (not bits[c].empty()) {
+            ColumnEntry entry = {
+                uint32_t(c / feature_count),
+                uint32_t(c % feature_count),
+                0};
+            columns.push_back(entry);
+        }
+    }
+
+    BlockHeader header = {
+        row_count,
+        dup_ids.size(),
+        tares.size(),
+        columns.size()};
+    out.clear();
+    append(out, & header, 1);
+    append(out, ids.data(), ids.size());
+    append(out, dup_begins.data(), dup_begins.size());
+    append(out, dup_ids.data(), dup_ids.size());
+    append(out, tare_begins.data(), tare_begins.size());
+    append(out, tares.data(), tares.size());
+    append(out, sparsities.data(), sparsities.size());
+    const size_t columns_pos = out.size();
+    append(out, columns.data(), columns.size());
+
+    std::vector<uint32_t> ranks(words);
+    for (size_t i = 0; i < columns.size(); ++i) {
+        auto & entry = columns[i];
+        const size_t c = entry.part * feature_count + entry.featureid;
+        uint32_t rank = 0;
+        for (size_t w = 0; w < words; ++w) {
+            ranks[w] = rank;
+            rank += __builtin_popcountll(bits[c][w]);
+        }
+        entry.offset = out.size();
+        append(out, bits[c].data(), words);
+        append(out, ranks.data(), words);
+        append(out, values[c].data(), values[c].size());
+    }
+    const size_t columns_size = sizeof(ColumnEntry) * columns.size();
+    memcpy(& out[columns_pos], columns.data(), columns_size);
+}
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+// Reading
+
+bool ColumnarRows::is_columnar (const char * filename)
+{
+    if (not snapshot::is_file(filename)) {
+        return false;
+    }
+    int fid = open(filename, O_RDONLY);
+    if (fid == -1) {
+        return false;
+    }
+    char magic[sizeof(snapshot::Header::magic)] = {0};
+    const bool success = ::read(fid, magic, sizeof(magic)) == sizeof(magic);
+    close(fid);
+    return success and strncmp(magic, columnar_magic, sizeof(magic)) == 0;
+}
+
+ColumnarRows::ColumnarRows (const char * filename) :
+    file_(filename),
+    schema_(),
+    block_size_(0),
+    record_count_(0),
+    row_count_(0),
+    blocks_()
+{
+    const auto & header = snapshot::check_header(file_, columnar_magic);
+    block_size_ = header.size0;
+    LOOM_ASSERT_LT(0, block_size_);
+
+    LOOM_ASSERT_LE(sizeof(header) + sizeof(Footer), file_.size());
+    const size_t footer_pos = file_.size() - sizeof(Footer);
+    const Footer & footer = * file_.at<Footer>(footer_pos);
+    schema_.booleans_size = footer.booleans_size;
+    schema_.counts_size = footer.counts_size;
+    schema_.reals_size = footer.reals_size;
+    LOOM_ASSERT_EQ(schema_.total_size(), header.size1);
+    record_count_ = footer.record_count;
+    row_count_ = footer.row_count;
+
+    const size_t block_count = footer.block_count;
+    LOOM_ASSERT_EQ(
+        block_count,
+        (record_count_ + block_size_ - 1) / block_size_);
+    const uint64_t * offsets = file_.at<uint64_t>(
+        footer_pos - sizeof(uint64_t) * block_count,
+        block_count);
+
+    blocks_.resize(block_count);
+    for (size_t b = 0; b < block_count; ++b) {
+        const size_t begin = offsets[b];
+        size_t offset = begin;
+        const auto & block_header = * file_.at<BlockHeader>(offset);
+        offset += sizeof(BlockHeader);
+        const size_t row_count = block_header.row_count;
+        const size_t dup_count = block_header.dup_count;
+        const size_t tare_count = block_header.tare_count;
+        const size_t column_count = block_header.column_count;
+        const size_t words = word_count(row_count);
+        LOOM_ASSERT_EQ(
+            row_count,
+            std::min(block_size_, record_count_ - b * block_size_));
+
+        Block & block = blocks_[b];
+        block.row_count = row_count;
+        block.ids = file_.at<uint64_t>(offset, row_count);
+        offset += padded(sizeof(uint64_t) * row_count);
+        block.dup_begins = file_.at<uint32_t>(offset, row_count + 1);
+        offset += padded(sizeof(uint32_t) * (row_count + 1));
+        block.dup_ids = file_.at<uint64_t>(offset, dup_count);
+        offset += padded(sizeof(uint64_t) * dup_count);
+        block.tare_begins = file_.at<uint32_t>(offset, row_count + 1);
+        offset += padded(sizeof(uint32_t) * (row_count + 1));
+        block.tares = file_.at<uint32_t>(offset, tare_count);
+        offset += padded(sizeof(uint32_t) * tare_count);
+        block.sparsities[0] = file_.at<uint8_t>(offset, 2 * row_count);
+        block.sparsities[1] = block.sparsities[0] + row_count;
+        offset += padded(2 * row_count);
+
+        const ColumnEntry * entries =
+            file_.at<ColumnEntry>(offset, column_count);
+        block.columns.resize(column_count);
+        for (size_t i = 0; i < column_count; ++i) {
+            const ColumnEntry & entry = entries[i];
+            LOOM_ASSERT_LT(entry.part, 2);
+            LOOM_ASSERT_LT(entry.featureid, schema_.total_size());
+            Column & column = block.columns[i];
+            column.part = entry.part;
+            column.featureid = entry.featureid;
+            size_t pos = begin + entry.offset;
+            column.bits = file_.at<uint64_t>(pos, words);
+            pos += padded(sizeof(uint64_t) * words);
+            column.ranks = file_.at<uint32_t>(pos, words);
+            pos += padded(sizeof(uint32_t) * words);
+            column.values = file_.at<char>(pos);
+        }
+    }
+}
+
+size_t ColumnarRows::multiplicity (size_t index) const
+{
+    size_t pos;
+    const Block & block = this->block(index, pos);
+    return 1 + block.dup_begins[pos + 1] - block.dup_begins[pos];
+}
+
+uint64_t ColumnarRows::row_id (size_t index, size_t i) const
+{
+    size_t pos;
+    const Block & block = this->block(index, pos);
+    return i ? block.dup_ids[block.dup_begins[pos] + i - 1] : block.ids[pos];
+}
+
+bool ColumnarRows::append_value (
+        const Column & column,
+        size_t pos,
+        ProductValue & value) const
+{
+    const size_t word = pos / 64;
+    const uint64_t bit = uint64_t(1) << (pos % 64);
+    const uint64_t bits = column.bits[word];
+    if (not (bits & bit)) {
+        return false;
+    }
+    const size_t k =
+        column.ranks[word] + __builtin_popcountll(bits & (bit - 1));
+    const size_t f = column.featureid;
+    const size_t booleans_end = schema_.booleans_size;
+    const size_t counts_end = booleans_end + schema_.counts_size;
+    if (f < booleans_end) {
+        value.add_booleans(reinterpret_cast<const uint8_t *>(column.values)[k]);
+    } else if (f < counts_end) {
+        value.add_counts(reinterpret_cast<const uint32_t *>(column.values)[k]);
+    } else {
+        value.add_reals(reinterpret_cast<const float *>(column.values)[k]);
+    }
+    return true;
+}
+
+void ColumnarRows::read_ids (size_t index, protobuf::Row & row) const
+{
+    size_t pos;
+    const Block & block = this->block(index, pos);
+    row.Clear();
+    row.set_id(block.ids[pos]);
+    const uint32_t dup_end = block.dup_begins[pos + 1];
+    for (size_t i = block.dup_begins[pos]; i < dup_end; ++i) {
+        row.add_dup_ids(block.dup_ids[i]);
+    }
+}
+
+void ColumnarRows::read (size_t index, protobuf::Row & row) const
+{
+    read_ids(index, row);
+    size_t pos;
+    const Block & block = this->block(index, pos);
+
+    auto & diff = * row.mutable_diff();
+    const uint32_t tare_end = block.tare_begins[pos + 1];
+    for (size_t i = block.tare_begins[pos]; i < tare_end; ++i) {
+        diff.add_tares(block.tares[i]);
+    }
+
+    ProductValue * values[2] = {diff.mutable_pos(), diff.mutable_neg()};
+    ProductValue::Observed::Sparsity sparsities[2];
+    for (size_t part = 0; part < 2; ++part) {
+        auto & observed = * values[part]->mutable_observed();
+        sparsities[part] = static_cast<ProductValue::Observed::Sparsity>(
+            block.sparsities[part][pos]);
+        observed.set_sparsity(sparsities[part]);
+        if (sparsities[part] == ProductValue::Observed::DENSE) {
+            observed.mutable_dense()->Resize(schema_.total_size(), false);
+        }
+    }
+
+    for (const Column & column : block.columns) {
+        ProductValue & value = * values[column.part];
+        if (not append_value(column, pos, value)) {
+            continue;
+        }
+        const size_t f = column.featureid;
+        switch (sparsities[column.part]) {
+            case ProductValue::Observed::DENSE:
+                value.mutable_observed()->set_dense(f, true);
+                break;
+            case ProductValue::Observed::SPARSE:
+                value.mutable_observed()->add_sparse(f);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void ColumnarRows::read_split (
+        size_t index,
+        const ValueSplitter & splitter,
+        std::vector<ProductValue::Diff> & partial_diffs) const
+{
+    if (LOOM_DEBUG_LEVEL >= 1) {
+        LOOM_ASSERT_EQ(splitter.schema(), schema_);
+    }
+    size_t pos;
+    const Block & block = this->block(index, pos);
+    const size_t part_count = splitter.part_count();
+    const uint32_t tare_begin = block.tare_begins[pos];
+    const uint32_t tare_end = block.tare_begins[pos + 1];
+
+    ProductValue::Observed::Sparsity sparsities[2];
+    for (size_t part = 0; part < 2; ++part) {
+        sparsities[part] = static_cast<ProductValue::Observed::Sparsity>(
+            block.sparsities[part][pos]);
+    }
+
+    partial_diffs.resize(part_count);
+    for (size_t p = 0; p < part_count; ++p) {
+        auto & diff = partial_diffs[p];
+        ValueSchema::clear(diff);
+        ProductValue * values[2] = {diff.mutable_pos(), diff.mutable_neg()};
+        for (size_t part = 0; part < 2; ++part) {
+            auto & observed = * values[part]->mutable_observed();
+            observed.set_sparsity(sparsities[part]);
+            if (sparsities[part] == ProductValue::Observed::DENSE) {
+                const size_t size = splitter.schema(p).total_size();
+                observed.mutable_dense()->Resize(size, false);
+            }
+        }
+        for (size_t i = tare_begin; i < tare_end; ++i) {
+            diff.add_tares(block.tares[i]);
+        }
+    }
+
+    // columns are sorted by featureid within each part, as are the
+    // features of each kind, so values land in order
+    for (const Column & column : block.columns) {
+        const size_t f = column.featureid;
+        auto & diff = partial_diffs[splitter.partid(f)];
+        ProductValue & value =
+            column.part ? * diff.mutable_neg() : * diff.mutable_pos();
+        if (not append_value(column, pos, value)) {
+            continue;
+        }
+        switch (sparsities[column.part]) {
+            case ProductValue::Observed::DENSE:
+                value.mutable_observed()->set_dense(splitter.part_pos(f), true);
+                break;
+            case ProductValue::Observed::SPARSE:
+                value.mutable_observed()->add_sparse(splitter.part_pos(f));
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (LOOM_DEBUG_LEVEL >= 3) {
+        protobuf::Row row;
+        std::vector<ProductValue::Diff> expected;
+        read(index, row);
+        splitter.split(row.diff(), expected);
+        LOOM_ASSERT_EQ(partial_diffs.size(), expected.size());
+        for (size_t p = 0; p < part_count; ++p) {
+            LOOM_ASSERT_EQ(partial_diffs[p].pos(), expected[p].pos());
+            LOOM_ASSERT_EQ(partial_diffs[p].neg(), expected[p].neg());
+            LOOM_ASSERT(
+                partial_diffs[p].tares() == expected[p].tares(),
+                "tares differ in row " << row.id());
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Writing
+
+void columnize_rows (
+        const ValueSchema & schema,
+        const char * rows_in,
+        const char * columns_out,
+        size_t block_size)
+{
+    LOOM_ASSERT_LT(0, block_size);
+    LOOM_ASSERT(
+        snapshot::is_file(columns_out),
+        "columnar output must be a file: " << columns_out);
+
+    // Blocks are built in parallel, a batch at a time to bound memory,
+    // then appended in order.
+    const size_t batch_size = 16;
+    std::vector<std::vector<protobuf::Row>> batch(batch_size);
+    std::vector<size_t> row_counts(batch_size);
+    std::vector<std::string> blocks(batch_size);
+
+    protobuf::InFile rows(rows_in);
+    BinaryOutFile file(columns_out);
+    file.write_pod(snapshot::make_header(
+        columnar_magic,
+        block_size,
+        schema.total_size()));
+
+    Footer footer;
+    memset(& footer, 0, sizeof(footer));
+    footer.booleans_size = schema.booleans_size;
+    footer.counts_size = schema.counts_size;
+    footer.reals_size = schema.reals_size;
+    std::vector<uint64_t> offsets;
+
+    bool done = false;
+    while (not done) {
+        size_t block_count = 0;
+        while (block_count < batch_size and not done) {
+            auto & block = batch[block_count];
+            block.resize(block_size);
+            size_t & row_count = row_counts[block_count];
+            row_count = 0;
+            while (row_count < block_size and
+                   rows.try_read_stream(block[row_count]))
+            {
+                const auto & row = block[row_count++];
+                footer.row_count += protobuf::row_multiplicity(row);
+            }
+            footer.record_count += row_count;
+            done = (row_count < block_size);
+            if (row_count) {
+                ++block_count;
+            }
+        }
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t b = 0; b < block_count; ++b) {
+            build_block(schema, batch[b].data(), row_counts[b], blocks[b]);
+        }
+
+        for (size_t b = 0; b < block_count; ++b) {
+            offsets.push_back(file.position());
+            file.write(blocks[b].data(), blocks[b].size());
+        }
+    }
+
+    footer.block_count = offsets.size();
+    file.write(offsets.data(), offsets.size());
+    file.write_pod(footer);
+}
+
+} // namespace loom
@@ -0,0 +1,175 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <loom/common.hpp>
+#include <loom/protobuf.hpp>
+#include <loom/product_value.hpp>
+#include <loom/mapped_file.hpp>
+
+namespace loom
+{
+
+//----------------------------------------------------------------------------
+// Columnar row files
+//
+// Design Goals:
+//  * Serve Row messages by index, from one mmap, without varint decoding.
+//  * Group rows into fixed-size blocks; within a block store ids, dup_ids
+//    and tares as flat arrays, and each (pos/neg, feature) pair as an
+//    observed bitmap plus a typed array of the observed values.
+//  * Store only columns observed somewhere in a block, so that a row of a
+//    tare-compressed dataset costs work proportional to the features that
+//    differ from the tare within its block, not to the schema width.
+//  * Keep each column contiguous, so readers of a feature subset only
+//    touch the pages of those columns.
+//  * Split rows among kinds straight from the columns, so inference never
+//    builds the full diff of a row only to split it again.
+//
+// Rows read back are equal to the rows written, including the sparsity
+// representation of their observed fields.
+
+class ColumnarRows : noncopyable
+{
+public:
+
+    explicit ColumnarRows (const char * filename);
+
+    // checks for the magic header, without mapping the whole file
+    static bool is_columnar (const char * filename);
+
+    size_t record_count () const { return record_count_; }
+    size_t row_count () const { return row_count_; }
+
+    size_t multiplicity (size_t index) const;
+    uint64_t row_id (size_t index, size_t i) const;
+
+    void read (size_t index, protobuf::Row & row) const;
+
+    // reads only id and dup_ids, leaving the diff empty
+    void read_ids (size_t index, protobuf::Row & row) const;
+
+    // reads a row's diff already split among the splitter's parts,
+    // equal to splitter.split() of the diff that read() would return
+    void read_split (
+            size_t index,
+            const ValueSplitter & splitter,
+            std::vector<ProductValue::Diff> & partial_diffs) const;
+
+private:
+
+    struct Column
+    {
+        uint32_t part;
+        uint32_t featureid;
+        const uint64_t * bits;
+        const uint32_t * ranks;
+        const char * values;
+    };
+
+    struct Block
+    {
+        size_t row_count;
+        const uint64_t * ids;
+        const uint32_t * dup_begins;
+        const uint64_t * dup_ids;
+        const uint32_t * tare_begins;
+        const uint32_t * tares;
+        const uint8_t * sparsities[2];
+        std::vector<Column> columns;
+    };
+
+    // returns whether the column observes the block's row at pos, and if
+    // so appends its value to value
+    bool append_value (
+            const Column & column,
+            size_t pos,
+            ProductValue & value) const;
+
+    const Block & block (size_t index, size_t & pos) const
+    {
+        LOOM_ASSERT2(index < record_count_, "bad index: " << index);
+        pos = index % block_size_;
+        return blocks_[index / block_size_];
+    }
+
+    MappedFile file_;
+    ValueSchema schema_;
+    size_t block_size_;
+    size_t record_count_;
+    size_t row_count_;
+    std::vector<Block> blocks_;
+};
+
+// Reads rows in order from either a protobuf stream or a columnar file.
+class RowReader : noncopyable
+{
+public:
+
+    explicit RowReader (const char * rows_in) :
+        columns_(
+            ColumnarRows::is_columnar(rows_in)
+                ? new ColumnarRows(rows_in)
+                : nullptr),
+        stream_(columns_ ? nullptr : new protobuf::InFile(rows_in)),
+        position_(0)
+    {
+    }
+
+    bool try_read_stream (protobuf::Row & row)
+    {
+        if (columns_) {
+            if (position_ == columns_->record_count()) {
+                return false;
+            }
+            columns_->read(position_++, row);
+            return true;
+        } else {
+            return stream_->try_read_stream(row);
+        }
+    }
+
+private:
+
+    std::unique_ptr<ColumnarRows> columns_;
+    std::unique_ptr<protobuf::InFile> stream_;
+    size_t position_;
+};
+
+// Converts a row stream to a columnar file, blocks of rows at a time.
+void columnize_rows (
+        const ValueSchema & schema,
+        const char * rows_in,
+        const char * columns_out,
+        size_t block_size);
+
+} // namespace loom
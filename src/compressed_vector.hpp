@@ -35,43 +35,37 @@
 namespace loom
 {
 
-template<class Value>
+// A vector of hashable values that stores each distinct value only once.
+
+template<class Value, class Hash = std::hash<Value>>
 class CompressedVector
 {
     typedef uint32_t id_t;
-    typedef std::unordered_map<std::string, id_t> Map;
+    typedef std::unordered_map<Value, id_t, Hash> Map;
 
-    Map string_to_id_;
-    std::vector<const std::string *> id_to_string_;
+    Map value_to_id_;
+    std::vector<const Value *> id_to_value_;
     std::vector<id_t> pos_to_id_;
 
     bool is_initialized () const
     {
-        return id_to_string_.size() == string_to_id_.size();
+        return id_to_value_.size() == value_to_id_.size();
     }
 
 public:
 
     void push_back (const Value & value)
     {
-        // never freed
-        static thread_local Map::value_type * to_insert = nullptr;
-        construct_if_null(to_insert);
-
-        value.SerializeToString(const_cast<std::string *>(& to_insert->first));
-        auto inserted = string_to_id_.insert(*to_insert);
-        id_t & id = inserted.first->second;
-        if (LOOM_UNLIKELY(inserted.second)) {
-            id = string_to_id_.size() - 1;
-        }
-        pos_to_id_.push_back(id);
+        const id_t new_id = value_to_id_.size();
+        auto inserted = value_to_id_.insert(std::make_pair(value, new_id));
+        pos_to_id_.push_back(inserted.first->second);
     }
 
     void init_index ()
     {
-        id_to_string_.resize(string_to_id_.size());
-        for (const auto & pair : string_to_id_) {
-            id_to_string_[pair.second] = &pair.first;
+        id_to_value_.resize(value_to_id_.size());
+        for (const auto & pair : value_to_id_) {
+            id_to_value_[pair.second] = &pair.first;
         }
 
         if (LOOM_DEBUG_LEVEL >= 1) {
@@ -86,17 +80,17 @@ public:
             LOOM_ASSERT(is_initialized(), "index is not initialized");
         }
 
-        return id_to_string_.size();
+        return id_to_value_.size();
     }
 
-    void unique_value (size_t id, Value & value) const
+    const Value & unique_value (size_t id) const
     {
         if (LOOM_DEBUG_LEVEL >= 1) {
             LOOM_ASSERT(is_initialized(), "index is not initialized");
-            LOOM_ASSERT_LT(id, id_to_string_.size());
+            LOOM_ASSERT_LT(id, id_to_value_.size());
         }
 
-        value.ParseFromString(*id_to_string_[id]);
+        return *id_to_value_[id];
     }
 
     id_t unique_id (size_t pos) const
@@ -31,6 +31,7 @@
 #include <distributions/io/protobuf.hpp>
 #include <loom/protobuf_stream.hpp>
 #include <loom/store.hpp>
+#include <loom/snapshot.hpp>
 #include <loom/cross_cat.hpp>
 #include <loom/infer_grid.hpp>
 
@@ -52,7 +53,11 @@ void CrossCat::model_load (const char * filename)
 {
     protobuf::CrossCat message;
     protobuf::InFile(filename).read(message);
+    model_load(message);
+}
 
+void CrossCat::model_load (const protobuf::CrossCat & message)
+{
     schema.clear();
     tares.clear();
     featureid_to_kindid.clear();
@@ -113,7 +118,13 @@ void CrossCat::model_load (const char * filename)
 void CrossCat::model_dump (const char * filename) const
 {
     protobuf::CrossCat message;
+    model_dump(message);
+    protobuf::OutFile(filename).write(message);
+}
 
+void CrossCat::model_dump (protobuf::CrossCat & message) const
+{
+    message.Clear();
     for (const auto & kind : kinds) {
         auto & message_kind = * message.add_kinds();
 
@@ -132,13 +143,18 @@ void CrossCat::model_dump (const char * filename) const
     topology.protobuf_dump(* message.mutable_topology());
 
     * message.mutable_hyper_prior() = hyper_prior;
-
-    protobuf::OutFile(filename).write(message);
 }
 
 void CrossCat::tares_load (const char * filename, rng_t & rng)
 {
-    tares = protobuf_stream_load<ProductValue>(filename);
+    tares_init(protobuf_stream_load<ProductValue>(filename), rng);
+}
+
+void CrossCat::tares_init (
+        const std::vector<ProductValue> & values,
+        rng_t & rng)
+{
+    tares = values;
     for (auto & tare : tares) {
         schema.normalize_small(* tare.mutable_observed());
     }
@@ -152,12 +168,10 @@ void CrossCat::mixture_load (
         rng_t & rng)
 {
     const size_t kind_count = kinds.size();
-    const size_t feature_count = featureid_to_kindid.size();
-    auto seed = rng();
+    const auto seed = rng();
 
     #pragma omp parallel for schedule(dynamic, 1)
     for (size_t kindid = 0; kindid < kind_count; ++kindid) {
-        rng_t rng(seed + kindid);
         Kind & kind = kinds[kindid];
         std::string filename = store::get_mixture_path(dirname, kindid);
         kind.mixture.maintaining_cache = true;
@@ -166,7 +180,16 @@ void CrossCat::mixture_load (
             filename.c_str(),
             empty_group_count);
     }
-    seed += kind_count;
+
+    mixture_load_finish(empty_group_count, seed + kind_count);
+}
+
+void CrossCat::mixture_load_finish (
+        size_t empty_group_count,
+        uint64_t seed)
+{
+    const size_t kind_count = kinds.size();
+    const size_t feature_count = featureid_to_kindid.size();
 
     #pragma omp parallel for schedule(dynamic, 1)
     for (size_t featureid = 0; featureid < feature_count; ++featureid) {
@@ -196,12 +219,58 @@ void CrossCat::mixture_load (
     }
 }
 
+void CrossCat::mixture_load_kind (
+        const char * dirname,
+        size_t kindid,
+        size_t empty_group_count,
+        uint64_t seed)
+{
+    Kind & kind = kinds[kindid];
+    std::string filename = store::get_mixture_path(dirname, kindid);
+    kind.mixture.maintaining_cache = true;
+    kind.mixture.load_step_1_of_3(
+        kind.model,
+        filename.c_str(),
+        empty_group_count);
+
+    // seeds match those of mixture_load_finish
+    for (size_t featureid : kind.featureids) {
+        rng_t rng(seed + featureid);
+        kind.mixture.load_step_2_of_3(
+            kind.model,
+            featureid,
+            empty_group_count,
+            rng);
+    }
+    seed += featureid_to_kindid.size();
+
+    if (not tares.empty()) {
+        rng_t rng(seed + kindid);
+        kind.mixture.load_step_3_of_3(kind.model, rng);
+    }
+
+    kind.mixture.validate(kind.model);
+}
+
+void CrossCat::mixture_unload_kind (
+        size_t kindid,
+        size_t empty_group_count,
+        rng_t & rng)
+{
+    Kind & kind = kinds[kindid];
+    const std::vector<int> counts(empty_group_count, 0);
+    kind.mixture.maintaining_cache = true;
+    kind.mixture.init_unobserved(kind.model, counts, rng);
+}
+
 void CrossCat::mixture_dump (
         const char * dirname,
         const std::vector<std::vector<uint32_t>> & sorted_to_globals) const
 {
     const size_t kind_count = kinds.size();
     LOOM_ASSERT(kind_count, "kind_count == 0, nothing to do");
+
+    #pragma omp parallel for schedule(dynamic, 1)
     for (size_t kindid = 0; kindid < kind_count; ++kindid) {
         const Kind & kind = kinds[kindid];
         const auto & sorted_to_global = sorted_to_globals[kindid];
@@ -210,6 +279,152 @@ void CrossCat::mixture_dump (
     }
 }
 
+// layout: header, model entry, kind entries[kind_count], model,
+// then each kind's block of groups, aligned
+namespace
+{
+struct SnapshotEntry
+{
+    snapshot::Fingerprint source;
+    uint64_t offset;
+    uint64_t size;
+};
+
+const char * cross_cat_snapshot_magic = "LOOMXCT";
+} // anonymous namespace
+
+bool CrossCat::snapshot_is_fresh (
+        const char * filename,
+        const char * model_in,
+        const char * groups_in)
+{
+    typedef SnapshotEntry Entry;
+    if (not snapshot::exists(filename)) {
+        return false;
+    }
+    MappedFile file(filename);
+    if (not snapshot::has_header(file, cross_cat_snapshot_magic)) {
+        return false;
+    }
+    const auto & header = * file.at<snapshot::Header>(0);
+    const size_t kind_count = header.size0;
+    size_t offset = sizeof(header);
+    if (file.size() < offset + sizeof(Entry) * (1 + kind_count)) {
+        return false;
+    }
+
+    const Entry & model = * file.at<Entry>(offset);
+    if (not snapshot::matches(model.source, model_in)) {
+        return false;
+    }
+    const Entry * kinds = file.at<Entry>(offset + sizeof(Entry), kind_count);
+    for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+        const auto source = store::get_mixture_path(groups_in, kindid);
+        if (not snapshot::matches(kinds[kindid].source, source)) {
+            return false;
+        }
+    }
+    const auto extra = store::get_mixture_path(groups_in, kind_count);
+    return not snapshot::exists(extra);
+}
+
+void CrossCat::snapshot_load (
+        const char * filename,
+        size_t empty_group_count,
+        rng_t & rng)
+{
+    typedef SnapshotEntry Entry;
+    MappedFile file(filename);
+    const auto & header = snapshot::check_header(
+        file,
+        cross_cat_snapshot_magic);
+    const size_t kind_count = header.size0;
+    size_t offset = sizeof(header);
+    const Entry & model = * file.at<Entry>(offset);
+    const Entry * entries = file.at<Entry>(offset + sizeof(Entry), kind_count);
+
+    protobuf::CrossCat message;
+    bool success = message.ParseFromArray(
+        file.at<char>(model.offset, model.size),
+        model.size);
+    LOOM_ASSERT(success, "failed to parse model from " << filename);
+    model_load(message);
+    LOOM_ASSERT_EQ(kinds.size(), kind_count);
+    LOOM_ASSERT_EQ(featureid_to_kindid.size(), header.size1);
+
+    const auto seed = rng();
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+        Kind & kind = kinds[kindid];
+        const Entry & entry = entries[kindid];
+        kind.mixture.maintaining_cache = true;
+        kind.mixture.snapshot_load_step_1_of_3(
+            kind.model,
+            file.at<char>(entry.offset, entry.size),
+            entry.size,
+            empty_group_count);
+    }
+
+    mixture_load_finish(empty_group_count, seed + kind_count);
+}
+
+void CrossCat::snapshot_dump (
+        const char * filename,
+        const char * model_source,
+        const char * groups_source,
+        const std::vector<std::vector<uint32_t>> & sorted_to_globals) const
+{
+    typedef SnapshotEntry Entry;
+    const size_t kind_count = kinds.size();
+    LOOM_ASSERT(kind_count, "kind_count == 0, nothing to do");
+
+    std::string model_data;
+    {
+        protobuf::CrossCat message;
+        model_dump(message);
+        message.SerializeToString(& model_data);
+    }
+
+    std::vector<std::string> blocks(kind_count);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+        kinds[kindid].mixture.snapshot_dump(
+            blocks[kindid],
+            sorted_to_globals[kindid]);
+    }
+
+    const snapshot::Fingerprint none = {0, 0};
+    Entry model = {
+        model_source ? snapshot::fingerprint(model_source) : none,
+        sizeof(snapshot::Header) + sizeof(Entry) * (1 + kind_count),
+        model_data.size()};
+    std::vector<Entry> entries(kind_count);
+    size_t offset = model.offset + model.size;
+    for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+        const auto source = store::get_mixture_path(groups_source, kindid);
+        offset = snapshot::align_up(offset);
+        entries[kindid].source = snapshot::fingerprint(source);
+        entries[kindid].offset = offset;
+        entries[kindid].size = blocks[kindid].size();
+        offset += blocks[kindid].size();
+    }
+
+    BinaryOutFile file(filename);
+    file.write_pod(snapshot::make_header(
+        cross_cat_snapshot_magic,
+        kind_count,
+        featureid_to_kindid.size()));
+    file.write_pod(model);
+    file.write(entries.data(), kind_count);
+    file.write(model_data.data(), model_data.size());
+    for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+        file.pad_to(snapshot::alignment);
+        LOOM_ASSERT_EQ(file.position(), entries[kindid].offset);
+        file.write(blocks[kindid].data(), blocks[kindid].size());
+    }
+}
+
 std::vector<std::vector<uint32_t>> CrossCat::get_sorted_groupids () const
 {
     std::vector<std::vector<uint32_t>> sorted_to_globals(kinds.size());
@@ -57,9 +57,12 @@ struct CrossCat : noncopyable
     std::vector<uint32_t> featureid_to_kindid;
 
     void model_load (const char * filename);
+    void model_load (const protobuf::CrossCat & message);
     void model_dump (const char * filename) const;
+    void model_dump (protobuf::CrossCat & message) const;
 
     void tares_load (const char * filename, rng_t & rng);
+    void tares_init (const std::vector<ProductValue> & values, rng_t & rng);
 
     void mixture_init_unobserved (
             size_t empty_group_count,
@@ -68,10 +71,44 @@ struct CrossCat : noncopyable
             const char * dirname,
             size_t empty_group_count,
             rng_t & rng);
+    // after loading each kind's groups via load_step_1_of_3,
+    // builds caches; seed must be rng() + kinds.size()
+    void mixture_load_finish (
+            size_t empty_group_count,
+            uint64_t seed);
+    // loads and caches a single kind, leaving other kinds untouched;
+    // the result depends only on seed, not on the order kinds are loaded
+    void mixture_load_kind (
+            const char * dirname,
+            size_t kindid,
+            size_t empty_group_count,
+            uint64_t seed);
+    // frees a single kind's groups, leaving it unobserved
+    void mixture_unload_kind (
+            size_t kindid,
+            size_t empty_group_count,
+            rng_t & rng);
     void mixture_dump (
             const char * dirname,
             const std::vector<std::vector<uint32_t>> & sorted_to_globals) const;
 
+    // A native snapshot holds the model and every kind's groups, and is
+    // fresh only while the protobuf files it was written beside are
+    // unchanged.  Loading a snapshot replaces model_load and mixture_load.
+    static bool snapshot_is_fresh (
+            const char * filename,
+            const char * model_in,
+            const char * groups_in);
+    void snapshot_load (
+            const char * filename,
+            size_t empty_group_count,
+            rng_t & rng);
+    void snapshot_dump (
+            const char * filename,
+            const char * model_source,
+            const char * groups_source,
+            const std::vector<std::vector<uint32_t>> & sorted_to_globals) const;
+
     std::vector<std::vector<uint32_t>> get_sorted_groupids () const;
 
     void update_splitter ();
@@ -81,6 +118,19 @@ struct CrossCat : noncopyable
 
     void simplify (std::vector<ProductValue::Diff> & partial_diffss) const;
 
+    // Adds count copies of partial_diff to kind, as for a deduplicated row:
+    // the copies are scored once, then each copy's group is sampled from
+    // that same posterior.  Calls fun(packed groupid) after each copy is
+    // added to its group.
+    template<class Fun>
+    void add_copies (
+            Kind & kind,
+            const ProductValue::Diff & partial_diff,
+            size_t count,
+            VectorFloat & scores,
+            rng_t & rng,
+            const Fun & fun) const;
+
     float score_data (rng_t & rng) const;
 
     void validate () const;
@@ -101,6 +151,52 @@ inline void CrossCat::simplify (
 #endif // LOOM_SIMPLIFY_DURING_INFERENCE
 }
 
+template<class Fun>
+inline void CrossCat::add_copies (
+        Kind & kind,
+        const ProductValue::Diff & partial_diff,
+        size_t count,
+        VectorFloat & scores,
+        rng_t & rng,
+        const Fun & fun) const
+{
+    ProductModel & model = kind.model;
+    auto & mixture = kind.mixture;
+    const bool dense = tares.empty();
+
+    if (dense) {
+        auto & value = partial_diff.pos();
+        for (size_t c = 0; c < count; ++c) {
+            model.add_value(value, rng);
+        }
+        mixture.score_value(model, value, scores, rng);
+    } else {
+        for (size_t c = 0; c < count; ++c) {
+            model.add_diff(partial_diff, rng);
+        }
+        mixture.score_diff(model, partial_diff, scores, rng);
+    }
+
+    auto add = [&](size_t groupid){
+        if (dense) {
+            mixture.add_value(model, groupid, partial_diff.pos(), rng);
+        } else {
+            mixture.add_diff(model, groupid, partial_diff, rng);
+        }
+        fun(groupid);
+    };
+
+    if (LOOM_LIKELY(count == 1)) {
+        add(distributions::sample_from_scores_overwrite(rng, scores));
+    } else {
+        // adding copies only appends empty groups, so packed ids stay valid
+        distributions::scores_to_probs(scores);
+        for (size_t c = 0; c < count; ++c) {
+            add(distributions::sample_from_probs(rng, scores));
+        }
+    }
+}
+
 inline void CrossCat::validate () const
 {
     if (LOOM_DEBUG_LEVEL >= 1) {
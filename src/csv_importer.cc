@@ -0,0 +1,535 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/csv_importer.hpp>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <unordered_map>
+#include <zlib.h>
+#include <omp.h>
+#include <loom/protobuf_stream.hpp>
+#include <loom/snapshot.hpp>
+
+namespace loom
+{
+
+namespace
+{
+
+const size_t chunk_bytes = 1UL << 22;
+const uint32_t empty_slot = 0xffffffff;
+
+// Byte lookup table for the field scanner, which skips runs of ordinary
+// bytes without branching on each delimiter.
+struct FieldEnds
+{
+    bool table[256];
+
+    FieldEnds ()
+    {
+        std::fill(table, table + 256, false);
+        table[static_cast<unsigned char>(',')] = true;
+        table[static_cast<unsigned char>('\n')] = true;
+    }
+
+    bool operator() (char c) const
+    {
+        return table[static_cast<unsigned char>(c)];
+    }
+};
+const FieldEnds is_field_end;
+
+inline bool is_space (char c)
+{
+    return c == ' ' or c == '\t' or c == '\n' or c == '\r'
+        or c == '\v' or c == '\f';
+}
+
+inline bool equals (const char * begin, const char * end, const char * word)
+{
+    const size_t size = end - begin;
+    return strlen(word) == size and memcmp(begin, word, size) == 0;
+}
+
+// Reads a gzip or plain csv file in chunks that end on record boundaries,
+// counting records with the same quoting rules as python's csv module.
+class ChunkReader : noncopyable
+{
+public:
+
+    explicit ChunkReader (const char * filename) :
+        filename_(filename),
+        file_(gzopen(filename, "rb")),
+        tail_(),
+        row_count_(0)
+    {
+        LOOM_ASSERT(file_, "failed to open " << filename);
+    }
+
+    ~ChunkReader ()
+    {
+        gzclose(file_);
+    }
+
+    bool try_read (std::string & text, size_t & first_row)
+    {
+        enum { FIELD_START, UNQUOTED, QUOTED, QUOTE_IN_QUOTED };
+        int state = FIELD_START;
+        size_t scanned = 0;
+        size_t records = 0;
+        size_t boundary = 0;
+        size_t boundary_records = 0;
+
+        text.swap(tail_);
+        tail_.clear();
+        while (true) {
+            const size_t old_size = text.size();
+            text.resize(old_size + chunk_bytes);
+            const int size = gzread(file_, & text[old_size], chunk_bytes);
+            LOOM_ASSERT(size >= 0, "failed to read " << filename_);
+            text.resize(old_size + size);
+
+            for (const size_t end = text.size(); scanned < end; ++scanned) {
+                const char c = text[scanned];
+                switch (state) {
+                    case FIELD_START:
+                    case UNQUOTED:
+                    case QUOTE_IN_QUOTED:
+                        if (c == '\n') {
+                            state = FIELD_START;
+                            boundary = scanned + 1;
+                            boundary_records = ++records;
+                        } else if (c == ',') {
+                            state = FIELD_START;
+                        } else if (c == '"' and state != UNQUOTED) {
+                            state = QUOTED;
+                        } else {
+                            state = UNQUOTED;
+                        }
+                        break;
+
+                    case QUOTED:
+                        if (c == '"') {
+                            state = QUOTE_IN_QUOTED;
+                        }
+                        break;
+                }
+            }
+
+            if (size == 0) {
+                LOOM_ASSERT(state != QUOTED, "unterminated quote in "
+                    << filename_);
+                if (boundary != text.size()) {
+                    ++records;
+                }
+                first_row = row_count_;
+                row_count_ += records;
+                return not text.empty();
+            } else if (boundary) {
+                tail_.assign(text, boundary, std::string::npos);
+                text.resize(boundary);
+                first_row = row_count_;
+                row_count_ += boundary_records;
+                return true;
+            }
+        }
+    }
+
+private:
+
+    const std::string filename_;
+    gzFile file_;
+    std::string tail_;
+    size_t row_count_;
+};
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+// SymbolTable
+
+void CsvImporter::SymbolTable::init (
+        const protobuf::Encoding::Encoder & encoder)
+{
+    LOOM_ASSERT_EQ(encoder.symbols_size(), encoder.codes_size());
+    const size_t size = encoder.symbols_size();
+    symbols_.assign(encoder.symbols().begin(), encoder.symbols().end());
+    codes_.assign(encoder.codes().begin(), encoder.codes().end());
+
+    size_t capacity = 16;
+    while (capacity < 2 * size) {
+        capacity *= 2;
+    }
+    mask_ = capacity - 1;
+    slots_.assign(capacity, empty_slot);
+    for (size_t i = 0; i < size; ++i) {
+        const std::string & symbol = symbols_[i];
+        const char * begin = symbol.data();
+        size_t slot = hash(begin, begin + symbol.size()) & mask_;
+        while (slots_[slot] != empty_slot) {
+            LOOM_ASSERT(symbols_[slots_[slot]] != symbol,
+                "repeated symbol " << symbol << " in " << encoder.name());
+            slot = (slot + 1) & mask_;
+        }
+        slots_[slot] = i;
+    }
+}
+
+inline size_t CsvImporter::SymbolTable::hash (
+        const char * begin,
+        const char * end)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (; begin != end; ++begin) {
+        hash = (hash ^ static_cast<unsigned char>(*begin)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+inline bool CsvImporter::SymbolTable::find (
+        const char * begin,
+        const char * end,
+        uint32_t & code) const
+{
+    const size_t size = end - begin;
+    size_t slot = hash(begin, end) & mask_;
+    while (slots_[slot] != empty_slot) {
+        const size_t i = slots_[slot];
+        const std::string & symbol = symbols_[i];
+        if (symbol.size() == size and memcmp(symbol.data(), begin, size) == 0) {
+            code = codes_[i];
+            return true;
+        }
+        slot = (slot + 1) & mask_;
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+// CsvImporter
+
+CsvImporter::CsvImporter (const protobuf::Encoding & encoding) :
+    features_(encoding.encoders_size())
+{
+    for (size_t i = 0; i < features_.size(); ++i) {
+        const auto & encoder = encoding.encoders(i);
+        Feature & feature = features_[i];
+        feature.name = encoder.name();
+        const std::string & model = encoder.model();
+        if (model == "bb") {
+            feature.type = BOOLEAN;
+        } else if (model == "dd" or model == "dpd" or model == "gp") {
+            feature.type = COUNT;
+        } else if (model == "nich") {
+            feature.type = REAL;
+        } else {
+            LOOM_ERROR("unknown model " << model << " for " << encoder.name());
+        }
+        if (i) {
+            LOOM_ASSERT_LE(features_[i - 1].type, feature.type);
+        }
+        feature.has_symbols = encoder.symbols_size();
+        if (feature.has_symbols) {
+            feature.symbols.init(encoder);
+        }
+    }
+}
+
+// Splits one record into fields in place, unescaping quoted fields.
+char * CsvImporter::parse_record (
+        char * pos,
+        char * end,
+        std::vector<Field> & fields)
+{
+    fields.clear();
+    if (* pos == '\n') {
+        return pos + 1;
+    } else if (* pos == '\r' and pos + 1 != end and pos[1] == '\n') {
+        return pos + 2;
+    }
+
+    while (true) {
+        Field field;
+        if (* pos == '"') {
+            field.begin = ++pos;
+            char * out = pos;
+            while (true) {
+                LOOM_ASSERT(pos != end, "unterminated quote");
+                if (* pos == '"') {
+                    if (pos + 1 != end and pos[1] == '"') {
+                        * out++ = '"';
+                        pos += 2;
+                    } else {
+                        ++pos;
+                        break;
+                    }
+                } else {
+                    * out++ = * pos++;
+                }
+            }
+            // like python's csv, keep any text after the closing quote
+            while (pos != end and not is_field_end(* pos)) {
+                * out++ = * pos++;
+            }
+            field.end = out;
+        } else {
+            field.begin = pos;
+            while (pos != end and not is_field_end(* pos)) {
+                ++pos;
+            }
+            field.end = pos;
+        }
+        if (pos != end and * pos == '\n' and field.end != field.begin and
+            field.end[-1] == '\r') {
+            --field.end;
+        }
+        fields.push_back(field);
+
+        if (pos == end) {
+            return pos;
+        } else if (* pos++ == '\n') {
+            return pos;
+        }
+    }
+}
+
+void CsvImporter::encode_record (
+        const std::vector<Field> & fields,
+        const std::vector<int> & columns,
+        size_t row_number,
+        protobuf::Row & row) const
+{
+    protobuf::ProductValue & value = * row.mutable_diff()->mutable_pos();
+    auto & observed = * value.mutable_observed()->mutable_dense();
+    for (size_t i = 0; i < features_.size(); ++i) {
+        const Feature & feature = features_[i];
+        if (columns[i] < 0) {
+            observed.Add(false);
+            continue;
+        }
+        Field field = fields[columns[i]];
+        while (field.begin != field.end and is_space(* field.begin)) {
+            ++field.begin;
+        }
+        while (field.begin != field.end and is_space(field.end[-1])) {
+            --field.end;
+        }
+        if (field.begin == field.end) {
+            observed.Add(false);
+            continue;
+        }
+        observed.Add(true);
+        auto invalid = [&](){
+            LOOM_ERROR("row " << row_number << " has invalid "
+                << feature.name << " value: "
+                << std::string(field.begin, field.end));
+        };
+
+        uint32_t code = 0;
+        if (feature.has_symbols) {
+            if (not feature.symbols.find(field.begin, field.end, code)) {
+                invalid();
+            }
+        }
+        switch (feature.type) {
+            case BOOLEAN: {
+                if (not feature.has_symbols) {
+                    const char * b = field.begin;
+                    const char * e = field.end;
+                    if (equals(b, e, "1") or equals(b, e, "1.0") or
+                        equals(b, e, "True") or equals(b, e, "true") or
+                        equals(b, e, "t")) {
+                        code = 1;
+                    } else if (equals(b, e, "0") or equals(b, e, "0.0") or
+                        equals(b, e, "False") or equals(b, e, "false") or
+                        equals(b, e, "f")) {
+                        code = 0;
+                    } else {
+                        invalid();
+                    }
+                }
+                value.add_booleans(code);
+            } break;
+
+            case COUNT: {
+                if (not feature.has_symbols) {
+                    * field.end = 0;
+                    char * parsed = nullptr;
+                    const unsigned long count =
+                        strtoul(field.begin, & parsed, 10);
+                    if (parsed != field.end or * field.begin == '-' or
+                        count > 0xffffffffUL) {
+                        invalid();
+                    }
+                    code = count;
+                }
+                value.add_counts(code);
+            } break;
+
+            case REAL: {
+                LOOM_ASSERT(not feature.has_symbols,
+                    "real feature " << feature.name << " has symbols");
+                * field.end = 0;
+                char * parsed = nullptr;
+                const float real = strtof(field.begin, & parsed);
+                if (parsed != field.end) {
+                    invalid();
+                }
+                value.add_reals(real);
+            } break;
+        }
+    }
+}
+
+void CsvImporter::import_chunk (
+        Chunk & chunk,
+        const std::vector<int> & columns,
+        size_t column_count,
+        uint64_t id_offset,
+        uint64_t id_stride,
+        bool compressed) const
+{
+    std::vector<Field> fields;
+    protobuf::Row row;
+    chunk.out.clear();
+    protobuf::OutFile out(chunk.out, compressed);
+    char * pos = & chunk.text[0];
+    char * const end = pos + chunk.text.size();
+    size_t i = chunk.first_row;
+    for (; pos != end; ++i) {
+        pos = parse_record(pos, end, fields);
+        LOOM_ASSERT(fields.size() == column_count,
+            "row " << i << " has wrong length " << fields.size());
+        row.Clear();
+        row.set_id(id_offset + id_stride * i);
+        auto & diff = * row.mutable_diff();
+        diff.mutable_pos()->mutable_observed()->set_sparsity(
+            protobuf::ProductValue::Observed::DENSE);
+        diff.mutable_neg()->mutable_observed()->set_sparsity(
+            protobuf::ProductValue::Observed::NONE);
+        encode_record(fields, columns, i, row);
+        out.write_stream(row);
+    }
+    chunk.row_count = i - chunk.first_row;
+}
+
+size_t CsvImporter::import_rows (
+        const char * rows_csv_in,
+        const char * rows_out,
+        uint64_t id_offset,
+        uint64_t id_stride) const
+{
+    LOOM_ASSERT(snapshot::is_file(rows_out),
+        "import output must be a file, not " << rows_out);
+    ChunkReader reader(rows_csv_in);
+    const size_t batch_size = 2 * std::max(1, omp_get_max_threads());
+
+    // The header is the first record; rows are numbered after it.
+    Chunk first;
+    size_t header_row;
+    LOOM_ASSERT(reader.try_read(first.text, header_row),
+        "missing csv header in " << rows_csv_in);
+    std::vector<Field> header;
+    char * begin = & first.text[0];
+    char * pos = parse_record(begin, begin + first.text.size(), header);
+    std::unordered_map<std::string, int> name_to_column;
+    for (size_t i = 0; i < header.size(); ++i) {
+        name_to_column[std::string(header[i].begin, header[i].end)] = i;
+    }
+    const size_t column_count = header.size();
+    std::vector<int> columns;
+    for (const auto & feature : features_) {
+        auto found = name_to_column.find(feature.name);
+        columns.push_back(found == name_to_column.end() ? -1 : found->second);
+    }
+    first.text.erase(0, pos - begin);
+    first.first_row = 0;
+
+    auto read_batch = [&](std::vector<Chunk> & batch){
+        batch.resize(batch_size);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            size_t first_row;
+            if (not reader.try_read(batch[i].text, first_row)) {
+                batch.resize(i);
+                break;
+            }
+            batch[i].first_row = first_row - 1;
+        }
+    };
+
+    // Chunks flow through a pipeline: one thread reads and decompresses
+    // batch i+1, an OpenMP team parses, encodes and compresses batch i, and
+    // one thread appends batch i-1 in order, as concatenated gzip members.
+    const bool compressed = protobuf::endswith(rows_out, ".gz");
+    BinaryOutFile file(rows_out);
+    std::vector<Chunk> batch(1);
+    std::swap(batch[0], first);
+    std::vector<Chunk> next_batch;
+    std::vector<Chunk> write_batch;
+    std::thread writer;
+    size_t row_count = 0;
+    while (not batch.empty()) {
+        std::thread reader_thread([&](){ read_batch(next_batch); });
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t i = 0; i < batch.size(); ++i) {
+            import_chunk(
+                batch[i],
+                columns,
+                column_count,
+                id_offset,
+                id_stride,
+                compressed);
+        }
+        for (const auto & chunk : batch) {
+            LOOM_ASSERT_EQ(chunk.first_row, row_count);
+            row_count += chunk.row_count;
+        }
+
+        if (writer.joinable()) {
+            writer.join();
+        }
+        std::swap(batch, write_batch);
+        writer = std::thread([&](){
+            for (const auto & chunk : write_batch) {
+                file.write(chunk.out.data(), chunk.out.size());
+            }
+        });
+
+        reader_thread.join();
+        std::swap(batch, next_batch);
+    }
+    if (writer.joinable()) {
+        writer.join();
+    }
+    return row_count;
+}
+
+} // namespace loom
@@ -0,0 +1,123 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <loom/common.hpp>
+#include <loom/protobuf.hpp>
+
+namespace loom
+{
+
+// Imports csv files into row streams, as loom.format.import_rows does:
+// each csv field is stripped, empty fields are unobserved, and features
+// missing from a file's header are unobserved in every row.
+class CsvImporter : noncopyable
+{
+public:
+
+    CsvImporter (const protobuf::Encoding & encoding);
+
+    // Rows are numbered id_offset, id_offset + id_stride, ...
+    // Returns the number of rows imported.
+    size_t import_rows (
+            const char * rows_csv_in,
+            const char * rows_out,
+            uint64_t id_offset = 0,
+            uint64_t id_stride = 1) const;
+
+private:
+
+    struct Field
+    {
+        char * begin;
+        char * end;
+    };
+
+    // Open-addressing hash table from symbol bytes to codes, so that
+    // lookups need not construct a std::string per field.
+    class SymbolTable
+    {
+    public:
+
+        void init (const protobuf::Encoding::Encoder & encoder);
+        bool find (const char * begin, const char * end, uint32_t & code) const;
+
+    private:
+
+        static size_t hash (const char * begin, const char * end);
+
+        std::vector<std::string> symbols_;
+        std::vector<uint32_t> codes_;
+        std::vector<uint32_t> slots_;
+        size_t mask_;
+    };
+
+    enum Type { BOOLEAN, COUNT, REAL };
+
+    struct Feature
+    {
+        std::string name;
+        Type type;
+        bool has_symbols;
+        SymbolTable symbols;
+    };
+
+    struct Chunk
+    {
+        std::string text;
+        size_t first_row;
+        size_t row_count;
+        std::string out;
+    };
+
+    static char * parse_record (
+            char * pos,
+            char * end,
+            std::vector<Field> & fields);
+
+    void encode_record (
+            const std::vector<Field> & fields,
+            const std::vector<int> & columns,
+            size_t row_number,
+            protobuf::Row & row) const;
+
+    void import_chunk (
+            Chunk & chunk,
+            const std::vector<int> & columns,
+            size_t column_count,
+            uint64_t id_offset,
+            uint64_t id_stride,
+            bool compressed) const;
+
+    std::vector<Feature> features_;
+};
+
+} // namespace loom
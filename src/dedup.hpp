@@ -0,0 +1,138 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <loom/common.hpp>
+#include <loom/protobuf.hpp>
+
+namespace loom
+{
+
+//----------------------------------------------------------------------------
+// Row deduplication
+//
+// Rows with identical diffs are collapsed into the first of them, which
+// lists the ids of the others in Row.dup_ids; kernels then add and remove
+// all copies in one step.  Output order is the order of first occurrences.
+//
+// Phase 1 reads the input once, fingerprinting each serialized diff with
+// two independent 64-bit hashes, and records which rows to drop and which
+// ids each kept row absorbs.  Phase 2 rereads the input, copying raw bytes
+// of rows without duplicates and appending dup_ids to the others.
+
+inline void dedup_rows (
+        const char * rows_in,
+        const char * rows_out)
+{
+    struct Fingerprint
+    {
+        uint64_t hash1;
+        uint64_t hash2;
+
+        Fingerprint (const std::string & bytes) :
+            hash1(14695981039346656037ULL),
+            hash2(0x9e3779b97f4a7c15ULL)
+        {
+            for (unsigned char c : bytes) {
+                hash1 = (hash1 ^ c) * 1099511628211ULL;
+                hash2 = (hash2 + c) * 0xff51afd7ed558ccdULL;
+                hash2 ^= hash2 >> 32;
+            }
+        }
+
+        bool operator== (const Fingerprint & other) const
+        {
+            return hash1 == other.hash1 and hash2 == other.hash2;
+        }
+    };
+    struct FingerprintHash
+    {
+        size_t operator() (const Fingerprint & f) const { return f.hash1; }
+    };
+
+    LOOM_ASSERT(
+        std::string(rows_in) != std::string(rows_out),
+        "cannot dedup file in-place: " << rows_in);
+
+    // phase 1: find duplicates
+
+    std::unordered_map<Fingerprint, size_t, FingerprintHash> first_rows;
+    std::unordered_map<size_t, std::vector<uint64_t>> dup_ids;
+    std::vector<bool> dropped;
+    {
+        protobuf::InFile rows(rows_in);
+        LOOM_ASSERT(rows.is_file(), "dedup input is not a file: " << rows_in);
+        protobuf::Row row;
+        std::string bytes;
+        for (size_t index = 0; rows.try_read_stream(row); ++index) {
+            row.diff().SerializeToString(& bytes);
+            auto pair = first_rows.insert(
+                std::make_pair(Fingerprint(bytes), index));
+            const bool is_duplicate = not pair.second;
+            dropped.push_back(is_duplicate);
+            if (is_duplicate) {
+                auto & ids = dup_ids[pair.first->second];
+                const size_t count = protobuf::row_multiplicity(row);
+                for (size_t c = 0; c < count; ++c) {
+                    ids.push_back(protobuf::row_id(row, c));
+                }
+            }
+        }
+    }
+    first_rows.clear();
+
+    // phase 2: write first occurrences
+
+    protobuf::InFile rows(rows_in);
+    protobuf::OutFile deduped(rows_out);
+    protobuf::Row row;
+    std::vector<char> raw;
+    const std::vector<char> & const_raw = raw;
+    for (size_t index = 0; rows.try_read_stream(raw); ++index) {
+        LOOM_ASSERT_LT(index, dropped.size());
+        if (dropped[index]) {
+            continue;
+        }
+        auto i = dup_ids.find(index);
+        if (i == dup_ids.end()) {
+            deduped.write_stream(const_raw);
+        } else {
+            row.ParseFromArray(raw.data(), raw.size());
+            for (auto id : i->second) {
+                row.add_dup_ids(id);
+            }
+            deduped.write_stream(row);
+        }
+    }
+    LOOM_ASSERT_EQ(rows.position(), dropped.size());
+}
+
+} // namespace loom
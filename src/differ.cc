@@ -27,6 +27,11 @@
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <loom/differ.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <thread>
 
 namespace loom
 {
@@ -52,6 +57,33 @@ inline protobuf::ProductValue::Observed get_full (const ValueSchema & schema)
     }
     return observed;
 }
+
+typedef std::vector<char> Message;
+
+const size_t batch_size = 1UL << 12;
+const size_t kmodes_sample_size = 1UL << 14;
+const size_t kmodes_max_iters = 20;
+
+inline void read_batch (
+        protobuf::InFile & rows,
+        std::vector<Message> & batch,
+        size_t max_size = batch_size)
+{
+    batch.resize(std::min(batch_size, max_size));
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (not rows.try_read_stream(batch[i])) {
+            batch.resize(i);
+            break;
+        }
+    }
+}
+
+inline void serialize (const protobuf::Row & row, Message & raw)
+{
+    raw.resize(row.ByteSize());
+    row.SerializeWithCachedSizesToArray(
+        reinterpret_cast<uint8_t *>(raw.data()));
+}
 } // anonymous namespace
 
 Differ::Differ (const ValueSchema & schema) :
@@ -61,8 +93,8 @@ Differ::Differ (const ValueSchema & schema) :
     row_count_(0),
     booleans_(schema.booleans_size),
     counts_(schema.counts_size),
-    small_tare_(),
-    dense_tare_()
+    small_tares_(),
+    dense_tares_()
 {
     set_tare(blank_);
 }
@@ -76,71 +108,433 @@ Differ::Differ (
     row_count_(0),
     booleans_(schema.booleans_size),
     counts_(schema.counts_size),
-    small_tare_(),
-    dense_tare_()
+    small_tares_(),
+    dense_tares_()
 {
     set_tare(tare);
 }
 
+Differ::Differ (
+        const ValueSchema & schema,
+        const std::vector<ProductValue> & tares) :
+    schema_(schema),
+    blank_(get_blank(schema)),
+    full_(get_full(schema)),
+    row_count_(0),
+    booleans_(schema.booleans_size),
+    counts_(schema.counts_size),
+    small_tares_(),
+    dense_tares_()
+{
+    set_tares(tares);
+}
+
 void Differ::set_tare (const ProductValue & tare)
 {
-    schema_.validate(tare);
-    small_tare_ = tare;
-    dense_tare_ = tare;
-    schema_.normalize_small(* small_tare_.mutable_observed());
-    schema_.normalize_dense(* dense_tare_.mutable_observed());
+    set_tares(std::vector<ProductValue>(1, tare));
+}
+
+void Differ::set_tares (const std::vector<ProductValue> & tares)
+{
+    LOOM_ASSERT(not tares.empty(), "no tares");
+    small_tares_ = tares;
+    dense_tares_ = tares;
+    for (size_t i = 0; i < tares.size(); ++i) {
+        schema_.validate(tares[i]);
+        schema_.normalize_small(* small_tares_[i].mutable_observed());
+        schema_.normalize_dense(* dense_tares_[i].mutable_observed());
+    }
 }
 
-void Differ::add_rows (const char * rows_in)
+void Differ::add_rows (
+        const char * rows_in,
+        size_t sample_count,
+        double confidence,
+        size_t tare_count,
+        bool shuffled)
 {
+    LOOM_ASSERT(
+        0 < confidence and confidence < 1,
+        "invalid confidence: " << confidence);
     protobuf::InFile rows(rows_in);
-    protobuf::Row row;
-    while (rows.try_read_stream(row)) {
-        LOOM_ASSERT(not row.diff().tares_size(), "row is already sparsified");
-        const auto & value = row.diff().pos();
-        LOOM_ASSERT_EQ(
-            value.observed().sparsity(),
-            ProductValue::Observed::DENSE);
-
-        auto observed = value.observed().dense().begin();
-        {
-            auto fields = value.booleans().begin();
-            for (auto & summary : booleans_) {
-                if (*observed++) {
-                    summary.add(*fields++);
+    rng_t rng(0);
+
+    // With sample_count, rows are drawn uniformly from the whole input by
+    // reservoir sampling and then visited in random order, so that every
+    // prefix tested for settling is itself a uniform sample.  A shuffled
+    // input is already in random order, so only its prefix is read.
+    std::vector<Message> sample;
+    size_t sample_pos = 0;
+    if (sample_count and shuffled) {
+        Message message;
+        while (sample.size() < sample_count and rows.try_read_stream(message)) {
+            sample.push_back(message);
+        }
+    } else if (sample_count) {
+        Message message;
+        for (size_t seen = 0; rows.try_read_stream(message); ++seen) {
+            if (sample.size() < sample_count) {
+                sample.push_back(message);
+            } else {
+                std::uniform_int_distribution<size_t> pick(0, seen);
+                const size_t pos = pick(rng);
+                if (pos < sample_count) {
+                    sample[pos].swap(message);
                 }
             }
         }
-        {
-            auto fields = value.counts().begin();
-            for (auto & summary : counts_) {
-                if (*observed++) {
-                    summary.add(*fields++);
+        std::shuffle(sample.begin(), sample.end(), rng);
+    }
+    // settling is tested after each batch
+    const size_t look_count = (sample.size() + batch_size - 1) / batch_size;
+
+    // A uniform sample for k-modes is kept by reservoir sampling.
+    const size_t reservoir_size = tare_count > 1 ? kmodes_sample_size : 0;
+    std::vector<Message> reservoir;
+    size_t reservoir_seen = 0;
+    auto read_sample_batch = [&](std::vector<Message> & batch){
+        if (sample_count) {
+            batch.resize(std::min(batch_size, sample.size() - sample_pos));
+            for (auto & message : batch) {
+                message.swap(sample[sample_pos++]);
+            }
+        } else {
+            read_batch(rows, batch);
+        }
+        for (size_t i = 0; reservoir_size and i < batch.size(); ++i) {
+            if (reservoir.size() < reservoir_size) {
+                reservoir.push_back(batch[i]);
+            } else {
+                std::uniform_int_distribution<size_t> pick(0, reservoir_seen);
+                const size_t pos = pick(rng);
+                if (pos < reservoir_size) {
+                    reservoir[pos] = batch[i];
                 }
             }
+            ++reservoir_seen;
+        }
+    };
+
+    // One thread reads and decompresses the next batch of raw rows while
+    // the others parse the current batch into per-thread summaries.
+    std::vector<Message> batch;
+    std::vector<Message> next_batch;
+    read_sample_batch(batch);
+    while (not batch.empty()) {
+        std::thread reader([&](){ read_sample_batch(next_batch); });
+
+        #pragma omp parallel
+        {
+            protobuf::Row row;
+            std::vector<BooleanSummary> booleans(booleans_.size());
+            std::vector<CountSummary> counts(counts_.size());
+
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < batch.size(); ++i) {
+                const Message & message = batch[i];
+                bool parsed =
+                    row.ParseFromArray(message.data(), message.size());
+                LOOM_ASSERT(parsed, "failed to parse row from " << rows_in);
+                _add_row(row, booleans, counts);
+            }
+
+            #pragma omp critical
+            {
+                _merge(booleans_, booleans);
+                _merge(counts_, counts);
+            }
+        }
+        row_count_ += batch.size();
+
+        reader.join();
+        if (sample_count and _tare_is_settled(confidence, look_count)) {
+            break;
+        }
+        std::swap(batch, next_batch);
+    }
+
+    set_tare(_make_tare(booleans_, counts_, row_count_));
+    if (tare_count > 1) {
+        _make_tares(tare_count, reservoir);
+    }
+}
+
+inline void Differ::_add_row (
+        const protobuf::Row & row,
+        std::vector<BooleanSummary> & booleans,
+        std::vector<CountSummary> & counts) const
+{
+    LOOM_ASSERT(not row.diff().tares_size(), "row is already sparsified");
+    _add_value(row.diff().pos(), booleans, counts);
+}
+
+inline void Differ::_add_value (
+        const ProductValue & value,
+        std::vector<BooleanSummary> & booleans,
+        std::vector<CountSummary> & counts) const
+{
+    LOOM_ASSERT_EQ(
+        value.observed().sparsity(),
+        ProductValue::Observed::DENSE);
+
+    auto observed = value.observed().dense().begin();
+    {
+        auto fields = value.booleans().begin();
+        for (auto & summary : booleans) {
+            if (*observed++) {
+                summary.add(*fields++);
+            }
+        }
+    }
+    {
+        auto fields = value.counts().begin();
+        for (auto & summary : counts) {
+            if (*observed++) {
+                summary.add(*fields++);
+            }
         }
-        // do not sparsify reals
-        ++row_count_;
     }
+    // do not sparsify reals
+}
 
-    _make_tare();
+template<class Summaries>
+inline void Differ::_merge (Summaries & destin, const Summaries & source)
+{
+    LOOM_ASSERT_EQ(destin.size(), source.size());
+    for (size_t i = 0, size = destin.size(); i < size; ++i) {
+        destin[i].merge(source[i]);
+    }
 }
 
-void Differ::_make_tare ()
+// A column's tare decision is whether its mode frequency exceeds 1/2.  This
+// is settled when a Hoeffding interval around each observed frequency
+// excludes 1/2, union bounded over all column values and over every look
+// at the growing sample.  Hoeffding's bound also holds for sampling
+// without replacement.
+bool Differ::_tare_is_settled (double confidence, size_t look_count) const
+{
+    const size_t test_count =
+        2 * booleans_.size() + CountSummary::max_count * counts_.size();
+    if (test_count == 0 or row_count_ == 0) {
+        return test_count == 0;
+    }
+    const double error = (1 - confidence) / std::max<size_t>(1, look_count);
+    const double radius = std::sqrt(
+        std::log(2.0 * test_count / error) / (2.0 * row_count_));
+    return _tare_is_settled_type(booleans_, radius)
+        and _tare_is_settled_type(counts_, radius);
+}
+
+template<class Summaries>
+inline bool Differ::_tare_is_settled_type (
+        const Summaries & summaries,
+        double radius) const
+{
+    for (const auto & summary : summaries) {
+        const auto mode = summary.get_mode();
+        const double freq = double(summary.get_count(mode)) / row_count_;
+        if (std::fabs(freq - 0.5) <= radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ProductValue Differ::_make_tare (
+        const std::vector<BooleanSummary> & booleans,
+        const std::vector<CountSummary> & counts,
+        size_t row_count) const
 {
     ProductValue tare;
     auto & observed = * tare.mutable_observed();
     observed.set_sparsity(ProductValue::Observed::DENSE);
 
-    _make_tare_type(observed, booleans_, * tare.mutable_booleans());
-    _make_tare_type(observed, counts_, * tare.mutable_counts());
+    _make_tare_type(observed, booleans, * tare.mutable_booleans(), row_count);
+    _make_tare_type(observed, counts, * tare.mutable_counts(), row_count);
 
     size_t ignored = schema_.reals_size;
     for (size_t i = 0; i < ignored; ++i) {
         observed.add_dense(false);
     }
 
-    set_tare(tare);
+    return tare;
+}
+
+// Tares are refined by k-modes, where the distance from a row to a tare is
+// the number of cells in their diff.  The per-column tare rule of
+// _make_tare_type minimizes this distance summed over a cluster, and
+// additional tares are seeded from rows far from the existing tares.
+void Differ::_make_tares (
+        size_t tare_count,
+        const std::vector<std::vector<char>> & sample)
+{
+    const size_t row_count = sample.size();
+    std::vector<ProductValue> rows(row_count);
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < row_count; ++i) {
+        protobuf::Row row;
+        bool parsed = row.ParseFromArray(sample[i].data(), sample[i].size());
+        LOOM_ASSERT(parsed, "failed to parse row");
+        rows[i] = row.diff().pos();
+    }
+
+    std::vector<size_t> assignments(row_count, 0);
+    std::vector<size_t> costs(row_count, 0);
+    auto assign = [&](){
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < row_count; ++i) {
+            costs[i] = std::numeric_limits<size_t>::max();
+            for (size_t k = 0; k < dense_tares_.size(); ++k) {
+                const size_t cost = _diff_size(rows[i], dense_tares_[k]);
+                if (cost < costs[i]) {
+                    costs[i] = cost;
+                    assignments[i] = k;
+                }
+            }
+        }
+    };
+
+    // A row's gain is how much its diff would shrink given its own tare.
+    const std::vector<BooleanSummary> booleans(booleans_.size());
+    const std::vector<CountSummary> counts(counts_.size());
+    std::vector<ProductValue> self_tares(row_count);
+    std::vector<size_t> self_costs(row_count);
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < row_count; ++i) {
+        auto row_booleans = booleans;
+        auto row_counts = counts;
+        _add_value(rows[i], row_booleans, row_counts);
+        self_tares[i] = _make_tare(row_booleans, row_counts, 1);
+        self_costs[i] = _diff_size(rows[i], self_tares[i]);
+    }
+
+    rng_t rng(0);
+    std::vector<ProductValue> tares = small_tares_;
+    std::vector<size_t> gains(row_count);
+    assign();
+    while (tares.size() < tare_count) {
+        size_t total_gain = 0;
+        for (size_t i = 0; i < row_count; ++i) {
+            gains[i] = costs[i] > self_costs[i] ? costs[i] - self_costs[i] : 0;
+            total_gain += gains[i];
+        }
+        if (total_gain == 0) {
+            break;
+        }
+        std::uniform_int_distribution<size_t> sample_gain(0, total_gain - 1);
+        size_t pos = sample_gain(rng);
+        size_t i = 0;
+        while (pos >= gains[i]) {
+            pos -= gains[i++];
+        }
+        tares.push_back(self_tares[i]);
+        set_tares(tares);
+        assign();
+    }
+
+    std::vector<size_t> cluster_sizes;
+    std::vector<std::vector<BooleanSummary>> cluster_booleans;
+    std::vector<std::vector<CountSummary>> cluster_counts;
+    for (size_t iter = 0; iter < kmodes_max_iters; ++iter) {
+        const size_t cluster_count = tares.size();
+        cluster_sizes.assign(cluster_count, 0);
+        cluster_booleans.assign(cluster_count, booleans);
+        cluster_counts.assign(cluster_count, counts);
+        for (size_t i = 0; i < row_count; ++i) {
+            const size_t k = assignments[i];
+            _add_value(rows[i], cluster_booleans[k], cluster_counts[k]);
+            ++cluster_sizes[k];
+        }
+
+        tares.clear();
+        for (size_t k = 0; k < cluster_count; ++k) {
+            if (cluster_sizes[k]) {
+                tares.push_back(_make_tare(
+                    cluster_booleans[k],
+                    cluster_counts[k],
+                    cluster_sizes[k]));
+            }
+        }
+        set_tares(tares);
+
+        const std::vector<size_t> old_assignments = assignments;
+        assign();
+        if (assignments == old_assignments) {
+            break;
+        }
+    }
+}
+
+inline size_t Differ::_find_tare (const ProductValue & data) const
+{
+    size_t best_tare = 0;
+    size_t best_size = std::numeric_limits<size_t>::max();
+    if (dense_tares_.size() > 1) {
+        for (size_t k = 0; k < dense_tares_.size(); ++k) {
+            const size_t size = _diff_size(data, dense_tares_[k]);
+            if (size < best_size) {
+                best_size = size;
+                best_tare = k;
+            }
+        }
+    }
+    return best_tare;
+}
+
+inline size_t Differ::_diff_size (
+        const ProductValue & data,
+        const ProductValue & tare) const
+{
+    size_t size = 0;
+    BlockIterator block;
+    if (block(schema_.booleans_size)) {
+        size += _diff_size_type<bool>(data, tare, block);
+    }
+    if (block(schema_.counts_size)) {
+        size += _diff_size_type<uint32_t>(data, tare, block);
+    }
+    if (block(schema_.reals_size)) {
+        size += _diff_size_type<float>(data, tare, block);
+    }
+    return size;
+}
+
+template<class T>
+inline size_t Differ::_diff_size_type (
+        const ProductValue & data,
+        const ProductValue & tare,
+        const BlockIterator & block) const
+{
+    const size_t begin = block.begin();
+    const size_t end = block.end();
+    auto tare_observed = tare.observed().dense().begin() + begin;
+    const auto tare_observed_end = tare.observed().dense().begin() + end;
+    auto data_observed = data.observed().dense().begin() + begin;
+    auto tare_value = protobuf::Fields<T>::get(tare).begin();
+    auto data_value = protobuf::Fields<T>::get(data).begin();
+
+    size_t size = 0;
+    while (tare_observed != tare_observed_end) {
+        if (*tare_observed) {
+            if (*data_observed) {
+                if (*data_value != *tare_value) {
+                    size += 2;
+                }
+                ++data_value;
+            } else {
+                size += 1;
+            }
+            ++tare_value;
+        } else {
+            if (*data_observed) {
+                size += 1;
+                ++data_value;
+            }
+        }
+        ++tare_observed;
+        ++data_observed;
+    }
+    return size;
 }
 
 inline void Differ::_compress (ProductValue & data) const
@@ -165,26 +559,80 @@ void Differ::compress_rows (
             "in-place sparsify is not supported");
     }
     protobuf::OutFile diffs(diffs_out);
-    protobuf::Row abs;
-    protobuf::Row rel;
-    ProductValue actual;
-    if (schema_.total_size(dense_tare_)) {
-        while (rows.try_read_stream(abs)) {
-            rel.set_id(abs.id());
-            ProductValue & data = * abs.mutable_diff()->mutable_pos();
-            ProductValue::Diff & diff = * rel.mutable_diff();
-            _abs_to_rel(data, diff);
-            _compress(* rel.mutable_diff());
-            diffs.write_stream(rel);
-            if (LOOM_DEBUG_LEVEL >= 3) {
-                _rel_to_abs(actual, diff);
-                LOOM_ASSERT_EQ(actual, data);
+    const bool has_tare =
+        dense_tares_.size() > 1 or schema_.total_size(dense_tares_[0]);
+
+    // Batches flow through a pipeline: one thread reads batch i+1, an
+    // OpenMP team converts batch i, and one thread writes batch i-1.
+    std::vector<Message> batch;
+    std::vector<Message> next_batch;
+    std::vector<Message> diff_batch;
+    std::vector<Message> write_batch;
+    std::thread writer;
+    read_batch(rows, batch);
+    while (not batch.empty()) {
+        std::thread reader([&](){ read_batch(rows, next_batch); });
+
+        diff_batch.resize(batch.size());
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < batch.size(); ++i) {
+            _compress_row(batch[i], diff_batch[i], has_tare);
+        }
+
+        if (writer.joinable()) {
+            writer.join();
+        }
+        std::swap(diff_batch, write_batch);
+        writer = std::thread([&](){
+            for (const auto & message : write_batch) {
+                diffs.write_stream(message);
             }
+        });
+
+        reader.join();
+        std::swap(batch, next_batch);
+    }
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+// Rows that need no change are passed through by swapping raw buffers.
+inline void Differ::_compress_row (
+        Message & raw,
+        Message & diff_raw,
+        bool has_tare) const
+{
+    static thread_local protobuf::Row * abs = nullptr;
+    static thread_local protobuf::Row * rel = nullptr;
+    static thread_local ProductValue * actual = nullptr;
+    construct_if_null(abs);
+    construct_if_null(rel);
+    construct_if_null(actual);
+
+    bool parsed = abs->ParseFromArray(raw.data(), raw.size());
+    LOOM_ASSERT(parsed, "failed to parse row");
+    if (has_tare) {
+        rel->set_id(abs->id());
+        ProductValue & data = * abs->mutable_diff()->mutable_pos();
+        ProductValue::Diff & diff = * rel->mutable_diff();
+        _abs_to_rel(data, diff);
+        _compress(diff);
+        serialize(* rel, diff_raw);
+        if (LOOM_DEBUG_LEVEL >= 3) {
+            _rel_to_abs(* actual, diff);
+            LOOM_ASSERT_EQ(* actual, data);
         }
     } else {
-        while (rows.try_read_stream(abs)) {
-            _compress(* abs.mutable_diff());
-            diffs.write_stream(abs);
+        ProductValue::Diff & diff = * abs->mutable_diff();
+        const auto pos_sparsity = diff.pos().observed().sparsity();
+        const auto neg_sparsity = diff.neg().observed().sparsity();
+        _compress(diff);
+        if (diff.pos().observed().sparsity() == pos_sparsity and
+            diff.neg().observed().sparsity() == neg_sparsity) {
+            std::swap(raw, diff_raw);
+        } else {
+            serialize(* abs, diff_raw);
         }
     }
 }
@@ -193,9 +641,10 @@ template<class Summaries, class Values>
 inline void Differ::_make_tare_type (
         ProductValue::Observed & observed,
         const Summaries & summaries,
-        Values & values) const
+        Values & values,
+        size_t row_count) const
 {
-    const float count_threshold = 0.5 * row_count_;
+    const float count_threshold = 0.5 * row_count;
     for (const auto & summary : summaries) {
         const auto mode = summary.get_mode();
         bool is_dense = (summary.get_count(mode) > count_threshold);
@@ -249,20 +698,21 @@ inline void Differ::_clean_temporaries (ProductValue & value) const
 template<class T>
 inline void Differ::_abs_to_rel_type (
         const ProductValue & data,
+        const ProductValue & tare,
         ProductValue & pos,
         ProductValue & neg,
         const BlockIterator & block) const
 {
     const size_t begin = block.begin();
     const size_t end = block.end();
-    auto tare_observed = dense_tare_.observed().dense().begin() + begin;
-    const auto tare_observed_end = dense_tare_.observed().dense().begin() + end;
+    auto tare_observed = tare.observed().dense().begin() + begin;
+    const auto tare_observed_end = tare.observed().dense().begin() + end;
     auto data_observed = data.observed().dense().begin() + begin;
     auto pos_observed =
         pos.mutable_observed()->mutable_dense()->begin() + begin;
     auto neg_observed =
         neg.mutable_observed()->mutable_dense()->begin() + begin;
-    auto tare_value = protobuf::Fields<T>::get(dense_tare_).begin();
+    auto tare_value = protobuf::Fields<T>::get(tare).begin();
     auto data_value = protobuf::Fields<T>::get(data).begin();
     auto & pos_values = protobuf::Fields<T>::get(pos);
     auto & neg_values = protobuf::Fields<T>::get(neg);
@@ -301,19 +751,20 @@ inline void Differ::_abs_to_rel_type (
 template<class T>
 inline void Differ::_rel_to_abs_type (
         ProductValue & data,
+        const ProductValue & tare,
         const ProductValue & pos,
         const ProductValue & neg,
         const BlockIterator & block) const
 {
     const size_t begin = block.begin();
     const size_t end = block.end();
-    auto tare_observed = dense_tare_.observed().dense().begin() + begin;
-    const auto tare_observed_end = dense_tare_.observed().dense().begin() + end;
+    auto tare_observed = tare.observed().dense().begin() + begin;
+    const auto tare_observed_end = tare.observed().dense().begin() + end;
     auto data_observed =
         data.mutable_observed()->mutable_dense()->begin() + begin;
     auto pos_observed = pos.observed().dense().begin() + begin;
     auto neg_observed = neg.observed().dense().begin() + begin;
-    auto tare_value = protobuf::Fields<T>::get(dense_tare_).begin();
+    auto tare_value = protobuf::Fields<T>::get(tare).begin();
     auto & data_values = protobuf::Fields<T>::get(data);
     auto pos_value = protobuf::Fields<T>::get(pos).begin();
 
@@ -340,10 +791,11 @@ inline void Differ::_rel_to_abs_type (
 
 inline void Differ::_validate_diff (
         const ProductValue & data,
-        const ProductValue::Diff & diff) const
+        const ProductValue::Diff & diff,
+        const ProductValue & tare) const
 {
     if (LOOM_DEBUG_LEVEL >= 3) {
-        const auto & tare_dense = dense_tare_.observed().dense();
+        const auto & tare_dense = tare.observed().dense();
         const auto & data_dense = data.observed().dense();
         const auto & pos_dense = diff.pos().observed().dense();
         const auto & neg_dense = diff.neg().observed().dense();
@@ -373,23 +825,25 @@ inline void Differ::_abs_to_rel (
     _build_temporaries(data);
     pos = blank_;
     neg = blank_;
+    const size_t tare_id = _find_tare(data);
+    const ProductValue & tare = dense_tares_[tare_id];
     diff.clear_tares();
-    diff.add_tares(0);
+    diff.add_tares(tare_id);
 
     {
         BlockIterator block;
         if (block(schema_.booleans_size)) {
-            _abs_to_rel_type<bool>(data, pos, neg, block);
+            _abs_to_rel_type<bool>(data, tare, pos, neg, block);
         }
         if (block(schema_.counts_size)) {
-            _abs_to_rel_type<uint32_t>(data, pos, neg, block);
+            _abs_to_rel_type<uint32_t>(data, tare, pos, neg, block);
         }
         if (block(schema_.reals_size)) {
-            _abs_to_rel_type<float>(data, pos, neg, block);
+            _abs_to_rel_type<float>(data, tare, pos, neg, block);
         }
     }
 
-    _validate_diff(data, diff);
+    _validate_diff(data, diff, tare);
     _clean_temporaries(data);
 
     if (LOOM_DEBUG_LEVEL >= 2) {
@@ -412,22 +866,24 @@ inline void Differ::_rel_to_abs (
     data = blank_;
     _build_temporaries(pos);
     _build_temporaries(neg);
-    LOOM_ASSERT1(diff.tares_size(), "diff has no tares");
+    LOOM_ASSERT1(diff.tares_size() == 1, "expected one tare per diff");
+    LOOM_ASSERT1(diff.tares(0) < dense_tares_.size(), "unknown tare");
+    const ProductValue & tare = dense_tares_[diff.tares(0)];
 
     {
         BlockIterator block;
         if (block(schema_.booleans_size)) {
-            _rel_to_abs_type<bool>(data, pos, neg, block);
+            _rel_to_abs_type<bool>(data, tare, pos, neg, block);
         }
         if (block(schema_.counts_size)) {
-            _rel_to_abs_type<uint32_t>(data, pos, neg, block);
+            _rel_to_abs_type<uint32_t>(data, tare, pos, neg, block);
         }
         if (block(schema_.reals_size)) {
-            _rel_to_abs_type<float>(data, pos, neg, block);
+            _rel_to_abs_type<float>(data, tare, pos, neg, block);
         }
     }
 
-    _validate_diff(data, diff);
+    _validate_diff(data, diff, tare);
     _clean_temporaries(pos);
     _clean_temporaries(neg);
 
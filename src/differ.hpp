@@ -41,10 +41,30 @@ public:
 
     Differ (const ValueSchema & schema);
     Differ (const ValueSchema & schema, const ProductValue & tare);
-
-    void add_rows (const char * rows_in);
-    const ProductValue & get_tare () const { return small_tare_; }
+    Differ (
+            const ValueSchema & schema,
+            const std::vector<ProductValue> & tares);
+
+    // If sample_count > 0, draws a uniform sample of at most that many rows
+    // into memory and summarizes it in random order, stopping early once
+    // every column's tare decision holds with the given confidence.
+    // Drawing the sample reads all of rows_in, unless rows_in is already
+    // shuffled, in which case its first sample_count rows are the sample.
+    // If tare_count > 1, refines the tare into up to tare_count tares by
+    // k-modes over a uniform sample of the rows read.
+    void add_rows (
+            const char * rows_in,
+            size_t sample_count = 0,
+            double confidence = 0.999,
+            size_t tare_count = 1,
+            bool shuffled = false);
+    const ProductValue & get_tare () const { return small_tares_[0]; }
+    const std::vector<ProductValue> & get_tares () const
+    {
+        return small_tares_;
+    }
     void set_tare (const ProductValue & tare);
+    void set_tares (const std::vector<ProductValue> & tares);
 
     void compress_rows (const char * rows_in, const char * diffs_out) const;
 
@@ -57,6 +77,11 @@ private:
 
         BooleanSummary () : counts{0, 0} {}
         void add (Value value) { ++counts[value]; }
+        void merge (const BooleanSummary & other)
+        {
+            counts[0] += other.counts[0];
+            counts[1] += other.counts[1];
+        }
         Value get_mode () const { return counts[1] > counts[0]; }
         size_t get_count (Value value) const { return counts[value]; }
     };
@@ -77,6 +102,13 @@ private:
             }
         }
 
+        void merge (const CountSummary & other)
+        {
+            for (size_t i = 0; i < max_count; ++i) {
+                counts[i] += other.counts[i];
+            }
+        }
+
         Value get_mode () const
         {
             Value value = 0;
@@ -95,27 +127,70 @@ private:
         }
     };
 
-    void _make_tare ();
+    void _add_row (
+            const protobuf::Row & row,
+            std::vector<BooleanSummary> & booleans,
+            std::vector<CountSummary> & counts) const;
+    void _add_value (
+            const ProductValue & value,
+            std::vector<BooleanSummary> & booleans,
+            std::vector<CountSummary> & counts) const;
+
+    template<class Summaries>
+    static void _merge (Summaries & destin, const Summaries & source);
+
+    bool _tare_is_settled (double confidence, size_t look_count) const;
+
+    template<class Summaries>
+    bool _tare_is_settled_type (
+            const Summaries & summaries,
+            double radius) const;
+
+    ProductValue _make_tare (
+            const std::vector<BooleanSummary> & booleans,
+            const std::vector<CountSummary> & counts,
+            size_t row_count) const;
 
     template<class Summaries, class Values>
     void _make_tare_type (
             ProductValue::Observed & observed,
             const Summaries & summaries,
-            Values & values) const;
+            Values & values,
+            size_t row_count) const;
+
+    void _make_tares (
+            size_t tare_count,
+            const std::vector<std::vector<char>> & sample);
+    size_t _find_tare (const ProductValue & data) const;
+    size_t _diff_size (
+            const ProductValue & data,
+            const ProductValue & tare) const;
+
+    template<class T>
+    size_t _diff_size_type (
+            const ProductValue & data,
+            const ProductValue & tare,
+            const BlockIterator & block) const;
 
+    void _compress_row (
+            std::vector<char> & raw,
+            std::vector<char> & diff_raw,
+            bool has_tare) const;
     void _compress (ProductValue & data) const;
     void _compress (ProductValue::Diff & diff) const;
     void _abs_to_rel (ProductValue & data, ProductValue::Diff & diff) const;
     void _rel_to_abs (ProductValue & data, ProductValue::Diff & diff) const;
     void _validate_diff (
             const ProductValue & data,
-            const ProductValue::Diff & diff) const;
+            const ProductValue::Diff & diff,
+            const ProductValue & tare) const;
     void _build_temporaries (ProductValue & value) const;
     void _clean_temporaries (ProductValue & value) const;
 
     template<class T>
     void _abs_to_rel_type (
             const ProductValue & abs,
+            const ProductValue & tare,
             ProductValue & pos,
             ProductValue & neg,
             const BlockIterator & block) const;
@@ -123,6 +198,7 @@ private:
     template<class T>
     void _rel_to_abs_type (
             ProductValue & abs,
+            const ProductValue & tare,
             const ProductValue & pos,
             const ProductValue & neg,
             const BlockIterator & block) const;
@@ -133,8 +209,8 @@ private:
     size_t row_count_;
     std::vector<BooleanSummary> booleans_;
     std::vector<CountSummary> counts_;
-    protobuf::ProductValue small_tare_;
-    protobuf::ProductValue dense_tare_;
+    std::vector<protobuf::ProductValue> small_tares_;
+    std::vector<protobuf::ProductValue> dense_tares_;
 };
 
 } // namespace loom
@@ -0,0 +1,121 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <loom/common.hpp>
+
+namespace loom
+{
+
+// A fixed-width set of feature indices, usable as a hash key.
+
+class FeatureSet
+{
+    typedef uint64_t Word;
+    enum { word_bits = 64 };
+
+    std::vector<Word> words_;
+
+public:
+
+    FeatureSet () : words_() {}
+
+    explicit FeatureSet (size_t feature_count) :
+        words_((feature_count + word_bits - 1) / word_bits, 0)
+    {
+    }
+
+    size_t capacity () const { return words_.size() * word_bits; }
+
+    void add (size_t i)
+    {
+        if (LOOM_DEBUG_LEVEL >= 1) {
+            LOOM_ASSERT_LT(i, capacity());
+        }
+        words_[i / word_bits] |= Word(1) << (i % word_bits);
+    }
+
+    bool contains (size_t i) const
+    {
+        if (LOOM_DEBUG_LEVEL >= 1) {
+            LOOM_ASSERT_LT(i, capacity());
+        }
+        return (words_[i / word_bits] >> (i % word_bits)) & Word(1);
+    }
+
+    size_t count () const
+    {
+        size_t result = 0;
+        for (Word word : words_) {
+            result += __builtin_popcountll(word);
+        }
+        return result;
+    }
+
+    // calls fun(i) for each member i in increasing order
+    template<class Fun>
+    void for_each (Fun fun) const
+    {
+        for (size_t w = 0, size = words_.size(); w < size; ++w) {
+            for (Word word = words_[w]; word; word &= word - 1) {
+                fun(w * word_bits + __builtin_ctzll(word));
+            }
+        }
+    }
+
+    FeatureSet & operator|= (const FeatureSet & other)
+    {
+        LOOM_ASSERT1(other.words_.size() == words_.size(), "width mismatch");
+        for (size_t w = 0, size = words_.size(); w < size; ++w) {
+            words_[w] |= other.words_[w];
+        }
+        return * this;
+    }
+
+    bool operator== (const FeatureSet & other) const
+    {
+        return words_ == other.words_;
+    }
+
+    struct Hash
+    {
+        size_t operator() (const FeatureSet & set) const
+        {
+            uint64_t hash = 0x9e3779b97f4a7c15ULL;
+            for (Word word : set.words_) {
+                hash ^= word;
+                hash *= 0xff51afd7ed558ccdULL;
+                hash ^= hash >> 32;
+            }
+            return hash;
+        }
+    };
+};
+
+} // namespace loom
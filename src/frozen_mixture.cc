@@ -0,0 +1,220 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/frozen_mixture.hpp>
+
+namespace loom
+{
+
+namespace
+{
+inline size_t value_count (const BB::Shared &)
+{
+    return 2;
+}
+
+inline size_t value_count (const DD16::Shared & shared)
+{
+    return shared.dim;
+}
+
+inline size_t value_count (const DD256::Shared & shared)
+{
+    return shared.dim;
+}
+} // anonymous namespace
+
+struct FrozenMixture::init_tables_fun
+{
+    const ProductModel::Features & shareds;
+    const FastProductMixture::Features & mixtures;
+    const size_t group_count;
+    Tables & tables;
+    rng_t & rng;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        const size_t feature_count = shareds[t].size();
+        tables[t].resize(feature_count);
+        for (size_t i = 0; i < feature_count; ++i) {
+            const auto & shared = shareds[t][i];
+            const auto & mixture = mixtures[t][i];
+            const size_t dim = value_count(shared);
+            VectorFloat & table = tables[t][i];
+            table.resize(dim * group_count);
+            VectorFloat scores;
+            for (size_t value = 0; value < dim; ++value) {
+                scores.resize(group_count);
+                distributions::vector_zero(group_count, scores.data());
+                mixture.score_value(
+                    shared,
+                    static_cast<typename T::Value>(value),
+                    scores,
+                    rng);
+                std::copy(
+                    scores.begin(),
+                    scores.end(),
+                    table.begin() + value * group_count);
+            }
+        }
+    }
+};
+
+FrozenMixture::FrozenMixture (
+        const ProductModel & model,
+        const FastProductMixture & mixture,
+        rng_t & rng) :
+    mixture_(mixture),
+    group_count_(mixture.clustering.counts().size())
+{
+    LOOM_ASSERT(mixture.maintaining_cache, "cache is not being maintained");
+
+    init_tables_fun fun = {
+        model.features,
+        mixture.features,
+        group_count_,
+        tables_,
+        rng};
+    fun(BB::null());
+    fun(DD16::null());
+    fun(DD256::null());
+}
+
+struct FrozenMixture::score_value_fun
+{
+    const Tables & tables;
+    const FastProductMixture::Features & mixtures;
+    const ProductModel::Features & shareds;
+    const size_t group_count;
+    VectorFloat & scores;
+    rng_t & rng;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::Value & value)
+    {
+        mixtures[t][i].score_value(shareds[t][i], value, scores, rng);
+    }
+
+    void operator() (BB * t, size_t i, const BB::Value & value)
+    {
+        gather(tables[t][i], value);
+    }
+
+    void operator() (DD16 * t, size_t i, const DD16::Value & value)
+    {
+        gather(tables[t][i], value);
+    }
+
+    void operator() (DD256 * t, size_t i, const DD256::Value & value)
+    {
+        gather(tables[t][i], value);
+    }
+
+    void gather (const VectorFloat & table, size_t value)
+    {
+        if (LOOM_DEBUG_LEVEL >= 1) {
+            LOOM_ASSERT_LT(value * group_count, table.size());
+        }
+        const float * row = table.data() + value * group_count;
+        distributions::vector_add(group_count, scores.data(), row);
+    }
+};
+
+void FrozenMixture::score_value (
+        const ProductModel & model,
+        const Value & value,
+        VectorFloat & scores,
+        rng_t & rng) const
+{
+    scores.resize(group_count_);
+    mixture_.clustering.score_value(model.clustering, scores);
+    score_value_fun fun = {
+        tables_,
+        mixture_.features,
+        model.features,
+        group_count_,
+        scores,
+        rng};
+    read_value(fun, model.schema, mixture_.features, value);
+}
+
+void FrozenMixture::score_diff (
+        const ProductModel & model,
+        const Value::Diff & diff,
+        VectorFloat & scores,
+        rng_t & rng) const
+{
+    const size_t size = group_count_;
+    scores.resize(size);
+    mixture_.clustering.score_value(model.clustering, scores);
+    score_value_fun fun = {
+        tables_,
+        mixture_.features,
+        model.features,
+        group_count_,
+        scores,
+        rng};
+    read_value(fun, model.schema, mixture_.features, diff.pos());
+    if (model.schema.total_size(diff.neg())) {
+        distributions::vector_negate(size, scores.data());
+        read_value(fun, model.schema, mixture_.features, diff.neg());
+        distributions::vector_negate(size, scores.data());
+    }
+    for (auto id : diff.tares()) {
+        LOOM_ASSERT1(id < model.tares.size(), "bad tare id: " << id);
+        const auto & tare_scores = mixture_.tare_caches[id].scores;
+        distributions::vector_add(size, scores.data(), tare_scores.data());
+    }
+}
+
+struct FrozenMixture::table_bytes_fun
+{
+    const Tables & tables;
+    size_t bytes;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        for (const auto & table : tables[t]) {
+            bytes += sizeof(float) * table.size();
+        }
+    }
+};
+
+size_t FrozenMixture::table_bytes () const
+{
+    table_bytes_fun fun = {tables_, 0};
+    for_each_feature_type(fun);
+    return fun.bytes;
+}
+
+} // namespace loom
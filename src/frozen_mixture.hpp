@@ -0,0 +1,91 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <loom/product_mixture.hpp>
+
+namespace loom
+{
+
+// A read-only view of a FastProductMixture that precomputes, for each
+// categorical feature (BB, DD16, DD256) and each of its values, a dense
+// array of per-group log-probabilities.  Scoring a categorical cell then
+// reduces to a single gather-add over groups.  Other feature types fall
+// through to the wrapped mixture.
+//
+// The wrapped mixture must not be modified while a FrozenMixture exists.
+
+class FrozenMixture : noncopyable
+{
+public:
+
+    typedef protobuf::ProductValue Value;
+
+    FrozenMixture (
+            const ProductModel & model,
+            const FastProductMixture & mixture,
+            rng_t & rng);
+
+    void score_value (
+            const ProductModel & model,
+            const Value & value,
+            VectorFloat & scores,
+            rng_t & rng) const;
+
+    void score_diff (
+            const ProductModel & model,
+            const Value::Diff & diff,
+            VectorFloat & scores,
+            rng_t & rng) const;
+
+    size_t table_bytes () const;
+
+private:
+
+    struct Table
+    {
+        template<class T>
+        struct Container
+        {
+            // tables[i][value * group_count + groupid]
+            typedef std::vector<VectorFloat> t;
+        };
+    };
+    typedef ForEachFeatureType<Table> Tables;
+
+    struct init_tables_fun;
+    struct score_value_fun;
+    struct table_bytes_fun;
+
+    const FastProductMixture & mixture_;
+    const size_t group_count_;
+    Tables tables_;
+};
+
+} // namespace loom
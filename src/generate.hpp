@@ -26,14 +26,150 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <thread>
 #include <loom/cat_kernel.hpp>
 #include <loom/hyper_kernel.hpp>
 #include <loom/kind_proposer.hpp>
 #include <loom/infer_grid.hpp>
+#include <loom/mapped_file.hpp>
+#include <loom/snapshot.hpp>
 
 namespace loom
 {
 
+//----------------------------------------------------------------------------
+// Parallel generation
+//
+// Rows are generated in rounds.  A round scores each kind's clustering
+// once, then samples its rows in blocks, in parallel, each block with its
+// own rng and its own gzip member; members are appended in order while
+// the round's values are added to each kind's mixture, kinds in parallel.
+//
+// This relaxes the sequential CRP: rows of a round see the groups as they
+// were when the round began, so rows that open a new group in one kind in
+// the same round all join one new group.  Rounds hold at most a sixteenth
+// of the rows generated before them, so a round is expected to open only
+// about alpha * log(17/16) new groups under the CRP, and early rows, which
+// shape the clustering most, are generated nearly sequentially.
+
+void generate_rows_parallel (
+        const protobuf::Config::Generate & config,
+        CrossCat & cross_cat,
+        Assignments & assignments,
+        const char * rows_out,
+        rng_t & rng)
+{
+    const size_t kind_count = cross_cat.kinds.size();
+    const size_t row_count = config.row_count();
+    const float density = config.density();
+    const bool compressed = protobuf::endswith(rows_out, ".gz");
+    const size_t block_size = 1UL << 14;
+    const size_t max_block_count = 64;
+
+    std::vector<VectorFloat> probs(kind_count);
+    std::vector<std::vector<ProductModel::Value>> values(kind_count);
+    std::vector<std::vector<uint32_t>> groupids(kind_count);
+    std::vector<std::string> chunks;
+    std::vector<uint64_t> seeds;
+    BinaryOutFile rows(rows_out);
+
+    for (size_t begin = 0; begin < row_count;) {
+        const size_t round_size = std::min(
+            row_count - begin,
+            std::max<size_t>(
+                1,
+                std::min(block_size * max_block_count, begin / 16)));
+        const size_t block_count = (round_size + block_size - 1) / block_size;
+
+        for (size_t k = 0; k < kind_count; ++k) {
+            const auto & kind = cross_cat.kinds[k];
+            auto & scores = probs[k];
+            scores.resize(kind.mixture.clustering.counts().size());
+            kind.mixture.clustering.score_value(
+                kind.model.clustering,
+                scores);
+            distributions::scores_to_probs(scores);
+            values[k].resize(round_size);
+            groupids[k].resize(round_size);
+        }
+        chunks.resize(block_count);
+        seeds.resize(block_count + kind_count);
+        for (auto & seed : seeds) {
+            seed = rng();
+        }
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t b = 0; b < block_count; ++b) {
+            rng_t block_rng(seeds[b]);
+            std::vector<ProductModel::Value> partial_values(kind_count);
+            protobuf::Row row;
+            cross_cat.schema.clear(* row.mutable_diff());
+            ProductValue & full_value = * row.mutable_diff()->mutable_pos();
+
+            std::string & chunk = chunks[b];
+            chunk.clear();
+            protobuf::OutFile chunk_file(chunk, compressed);
+            const size_t block_begin = b * block_size;
+            const size_t block_end =
+                std::min(round_size, block_begin + block_size);
+            for (size_t r = block_begin; r < block_end; ++r) {
+                for (size_t k = 0; k < kind_count; ++k) {
+                    const auto & kind = cross_cat.kinds[k];
+                    ProductValue & value = partial_values[k];
+
+                    auto & observed = * value.mutable_observed();
+                    ValueSchema::clear(observed);
+                    observed.set_sparsity(ProductModel::Value::Observed::DENSE);
+                    const size_t feature_count = kind.featureids.size();
+                    for (size_t f = 0; f < feature_count; ++f) {
+                        bool is_observed =
+                            distributions::sample_bernoulli(block_rng, density);
+                        observed.add_dense(is_observed);
+                    }
+                    groupids[k][r] = kind.mixture.sample_value(
+                        kind.model,
+                        probs[k],
+                        value,
+                        block_rng);
+                    values[k][r] = value;
+                }
+
+                row.set_id(begin + r);
+                cross_cat.splitter.join(full_value, partial_values);
+                chunk_file.write_stream(row);
+            }
+        }
+
+        std::thread writer([&](){
+            for (const auto & chunk : chunks) {
+                rows.write(chunk.data(), chunk.size());
+            }
+        });
+
+        for (size_t r = 0; r < round_size; ++r) {
+            assignments.rowids().try_push(begin + r);
+        }
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t k = 0; k < kind_count; ++k) {
+            rng_t kind_rng(seeds[block_count + k]);
+            auto & kind = cross_cat.kinds[k];
+            auto & kind_groupids = assignments.groupids(k);
+            for (size_t r = 0; r < round_size; ++r) {
+                const ProductValue & value = values[k][r];
+                const size_t groupid = groupids[k][r];
+                kind.model.add_value(value, kind_rng);
+                kind.mixture.add_value(kind.model, groupid, value, kind_rng);
+                kind_groupids.push(groupid);
+            }
+        }
+
+        writer.join();
+        begin += round_size;
+    }
+}
+
+// With config.parallel and a file to write, rows are generated by
+// generate_rows_parallel; otherwise each row is generated sequentially.
 void generate_rows (
         const protobuf::Config::Generate & config,
         CrossCat & cross_cat,
@@ -46,15 +182,21 @@ void generate_rows (
     const float density = config.density();
     LOOM_ASSERT_LE(0.0, density);
     LOOM_ASSERT_LE(density, 1.0);
-    VectorFloat scores;
-    std::vector<ProductModel::Value> partial_values(kind_count);
-    protobuf::Row row;
-    protobuf::OutFile rows(rows_out);
 
     for (auto & kind : cross_cat.kinds) {
         kind.model.realize(rng);
     }
 
+    if (config.parallel() and row_count and snapshot::is_file(rows_out)) {
+        generate_rows_parallel(config, cross_cat, assignments, rows_out, rng);
+        return;
+    }
+
+    VectorFloat scores;
+    std::vector<ProductModel::Value> partial_values(kind_count);
+    protobuf::Row row;
+    protobuf::OutFile rows(rows_out);
+
     cross_cat.schema.clear(* row.mutable_diff());
     ProductValue & full_value = * row.mutable_diff()->mutable_pos();
     for (size_t id = 0; id < row_count; ++id) {
@@ -0,0 +1,64 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/args.hpp>
+#include <loom/csv_importer.hpp>
+#include <loom/protobuf_stream.hpp>
+
+const char * help_message =
+"Usage: import ENCODING_IN ROWS_CSV_IN ROWS_OUT [ID_OFFSET=0] [ID_STRIDE=1]"
+"\nArguments:"
+"\n  ENCODING_IN   filename of protobuf encoding (e.g. encoding.pb.gz)"
+"\n  ROWS_CSV_IN   filename of input csv file (e.g. rows.csv.gz)"
+"\n  ROWS_OUT      filename of output dataset stream (e.g. rows.pbs.gz)"
+"\n  ID_OFFSET     id of the first row"
+"\n  ID_STRIDE     difference between ids of successive rows"
+"\nNotes:"
+"\n  ROWS_CSV_IN may be plain or gzipped; records must end with '\\n'."
+"\n  ROWS_OUT must be a file; it can end with .gz to indicate compression."
+;
+
+int main (int argc, char ** argv)
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    Args args(argc, argv, help_message);
+    const char * encoding_in = args.pop();
+    const char * rows_csv_in = args.pop();
+    const char * rows_out = args.pop();
+    const int64_t id_offset = args.pop_default(0L);
+    const int64_t id_stride = args.pop_default(1L);
+    args.done();
+
+    loom::protobuf::Encoding encoding;
+    loom::protobuf::InFile(encoding_in).read(encoding);
+    loom::CsvImporter importer(encoding);
+    importer.import_rows(rows_csv_in, rows_out, id_offset, id_stride);
+
+    return 0;
+}
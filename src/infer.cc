@@ -95,8 +95,13 @@ int main (int argc, char ** argv)
 
     if (config.schedule().extra_passes() > 0) {
 
-        engine.infer_multi_pass(rng, rows_in, checkpoint_in, checkpoint_out);
-        engine.dump(model_out, groups_out, assign_out);
+        const bool assign_delta = engine.infer_multi_pass(
+            rng,
+            rows_in,
+            checkpoint_in,
+            checkpoint_out,
+            assign_out);
+        engine.dump(model_out, groups_out, assign_delta ? nullptr : assign_out);
 
     } else {
 
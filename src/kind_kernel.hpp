@@ -58,9 +58,11 @@ public:
     void validate () const;
     void log_metrics (Logger::Message & message);
 
-    size_t add_to_cross_cat (
+    void add_to_kind (
             size_t kindid,
             const ProductValue::Diff & partial_diff,
+            const ProductValue::Diff & diff,
+            size_t count,
             VectorFloat & scores,
             rng_t & rng);
 
@@ -70,9 +72,10 @@ public:
             const ProductValue::Diff & diff,
             rng_t & rng);
 
-    size_t remove_from_cross_cat (
+    void remove_from_kind (
             size_t kindid,
             const ProductValue::Diff & partial_diff,
+            size_t count,
             rng_t & rng);
 
     void remove_from_kind_proposer (
@@ -148,8 +151,11 @@ inline void KindKernel::log_metrics (Logger::Message & message)
 inline void KindKernel::add_row (const protobuf::Row & row)
 {
     Timer::Scope timer(timer_);
-    bool ok = assignments_.rowids().try_push(row.id());
-    LOOM_ASSERT1(ok, "duplicate row: " << row.id());
+    const size_t count = protobuf::row_multiplicity(row);
+    for (size_t c = 0; c < count; ++c) {
+        bool ok = assignments_.rowids().try_push(protobuf::row_id(row, c));
+        LOOM_ASSERT1(ok, "duplicate row: " << protobuf::row_id(row, c));
+    }
 
     LOOM_ASSERT_EQ(cross_cat_.kinds.size(), kind_proposer_.kinds.size());
     const size_t kind_count = cross_cat_.kinds.size();
@@ -157,38 +163,32 @@ inline void KindKernel::add_row (const protobuf::Row & row)
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
     for (size_t i = 0; i < kind_count; ++i) {
-        auto groupid = add_to_cross_cat(i, partial_diffs_[i], scores_, rng_);
-        add_to_kind_proposer(i, groupid, row.diff(), rng_);
+        add_to_kind(i, partial_diffs_[i], row.diff(), count, scores_, rng_);
     }
 }
 
-inline size_t KindKernel::add_to_cross_cat (
+inline void KindKernel::add_to_kind (
         size_t kindid,
         const ProductValue::Diff & partial_diff,
+        const ProductValue::Diff & diff,
+        size_t count,
         VectorFloat & scores,
         rng_t & rng)
 {
     LOOM_ASSERT3(kindid < cross_cat_.kinds.size(), "bad kindid: " << kindid);
     auto & kind = cross_cat_.kinds[kindid];
-    ProductModel & model = kind.model;
-    auto & mixture = kind.mixture;
-
-    size_t groupid;
-    if (cross_cat_.tares.empty()) {
-        auto & value = partial_diff.pos();
-        model.add_value(value, rng);
-        mixture.score_value(model, value, scores, rng);
-        groupid = sample_from_scores_overwrite(rng, scores);
-        mixture.add_value(model, groupid, value, rng);
-    } else {
-        model.add_diff(partial_diff, rng);
-        mixture.score_diff(model, partial_diff, scores, rng);
-        groupid = sample_from_scores_overwrite(rng, scores);
-        mixture.add_diff(model, groupid, partial_diff, rng);
-    }
-    size_t global_groupid = mixture.id_tracker.packed_to_global(groupid);
-    assignments_.groupids(kindid).push(global_groupid);
-    return groupid;
+    const auto & id_tracker = kind.mixture.id_tracker;
+    auto & groupids = assignments_.groupids(kindid);
+    cross_cat_.add_copies(
+        kind,
+        partial_diff,
+        count,
+        scores,
+        rng,
+        [&](size_t groupid){
+            groupids.push(id_tracker.packed_to_global(groupid));
+            add_to_kind_proposer(kindid, groupid, diff, rng);
+        });
 }
 
 inline void KindKernel::add_to_kind_proposer (
@@ -220,9 +220,12 @@ inline void KindKernel::add_to_kind_proposer (
 inline void KindKernel::remove_row (const protobuf::Row & row)
 {
     Timer::Scope timer(timer_);
-    const auto rowid = assignments_.rowids().pop();
-    if (LOOM_DEBUG_LEVEL >= 1) {
-        LOOM_ASSERT_EQ(rowid, row.id());
+    const size_t count = protobuf::row_multiplicity(row);
+    for (size_t c = 0; c < count; ++c) {
+        const auto rowid = assignments_.rowids().pop();
+        if (LOOM_DEBUG_LEVEL >= 1) {
+            LOOM_ASSERT_EQ(rowid, protobuf::row_id(row, c));
+        }
     }
 
     LOOM_ASSERT_EQ(cross_cat_.kinds.size(), kind_proposer_.kinds.size());
@@ -231,32 +234,35 @@ inline void KindKernel::remove_row (const protobuf::Row & row)
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
     for (size_t i = 0; i < kind_count; ++i) {
-        auto groupid = remove_from_cross_cat(i, partial_diffs_[i], rng_);
-        remove_from_kind_proposer(i, groupid);
+        remove_from_kind(i, partial_diffs_[i], count, rng_);
     }
 }
 
-inline size_t KindKernel::remove_from_cross_cat (
+inline void KindKernel::remove_from_kind (
         size_t kindid,
         const ProductValue::Diff & partial_diff,
+        size_t count,
         rng_t & rng)
 {
     LOOM_ASSERT3(kindid < cross_cat_.kinds.size(), "bad kindid: " << kindid);
     auto & kind = cross_cat_.kinds[kindid];
     ProductModel & model = kind.model;
     auto & mixture = kind.mixture;
-
-    auto global_groupid = assignments_.groupids(kindid).pop();
-    auto groupid = mixture.id_tracker.global_to_packed(global_groupid);
-    if (cross_cat_.tares.empty()) {
-        auto & value = partial_diff.pos();
-        mixture.remove_value(model, groupid, value, rng);
-        model.remove_value(value, rng);
-    } else {
-        mixture.remove_diff(model, groupid, partial_diff, rng);
-        model.remove_diff(partial_diff, rng);
+    auto & groupids = assignments_.groupids(kindid);
+
+    for (size_t c = 0; c < count; ++c) {
+        auto global_groupid = groupids.pop();
+        auto groupid = mixture.id_tracker.global_to_packed(global_groupid);
+        if (cross_cat_.tares.empty()) {
+            auto & value = partial_diff.pos();
+            mixture.remove_value(model, groupid, value, rng);
+            model.remove_value(value, rng);
+        } else {
+            mixture.remove_diff(model, groupid, partial_diff, rng);
+            model.remove_diff(partial_diff, rng);
+        }
+        remove_from_kind_proposer(kindid, groupid);
     }
-    return groupid;
 }
 
 inline void KindKernel::remove_from_kind_proposer (
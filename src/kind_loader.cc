@@ -0,0 +1,153 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/kind_loader.hpp>
+
+namespace loom
+{
+
+KindLoader::KindLoader (
+        const std::vector<Latent> & latents,
+        size_t mem_bytes) :
+    latents_(latents),
+    mem_bytes_(mem_bytes),
+    residents_(latents.size()),
+    lru_(),
+    resident_bytes_(0),
+    load_count_(0),
+    evict_count_(0)
+{
+    const Resident unloaded = {false, 0, lru_.end()};
+    for (size_t l = 0; l < latents_.size(); ++l) {
+        const size_t kind_count = latents_[l].cross_cat->kinds.size();
+        residents_[l].resize(kind_count, unloaded);
+    }
+}
+
+void KindLoader::load (const FeatureSet & features)
+{
+    std::vector<LatentKind> needed;
+    std::vector<bool> is_needed;
+    for (size_t l = 0; l < latents_.size(); ++l) {
+        const auto & featureid_to_kindid =
+            latents_[l].cross_cat->featureid_to_kindid;
+        is_needed.assign(residents_[l].size(), false);
+        features.for_each([&](size_t featureid){
+            const size_t k = featureid_to_kindid[featureid];
+            if (not is_needed[k]) {
+                is_needed[k] = true;
+                needed.push_back(LatentKind(l, k));
+            }
+        });
+    }
+    load(needed);
+}
+
+void KindLoader::load_all ()
+{
+    std::vector<LatentKind> needed;
+    for (size_t l = 0; l < latents_.size(); ++l) {
+        for (size_t k = 0; k < residents_[l].size(); ++k) {
+            needed.push_back(LatentKind(l, k));
+        }
+    }
+    load(needed);
+}
+
+void KindLoader::load (const std::vector<LatentKind> & needed)
+{
+    std::vector<LatentKind> missing;
+    for (const auto & latent_kind : needed) {
+        const size_t l = latent_kind.first;
+        const size_t k = latent_kind.second;
+        if (not residents_[l][k].loaded) {
+            missing.push_back(latent_kind);
+        }
+    }
+
+    // kinds share no mixture state, so they load independently
+    const size_t task_count = missing.size();
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < task_count; ++i) {
+        const size_t l = missing[i].first;
+        const size_t k = missing[i].second;
+        const Latent & latent = latents_[l];
+        latent.cross_cat->mixture_load_kind(
+            latent.groups_in.c_str(),
+            k,
+            latent.empty_group_count,
+            latent.seed);
+    }
+
+    for (const auto & latent_kind : missing) {
+        const size_t l = latent_kind.first;
+        const size_t k = latent_kind.second;
+        Resident & resident = residents_[l][k];
+        resident.loaded = true;
+        resident.bytes = latents_[l].cross_cat->kinds[k].mixture.group_bytes();
+        resident.position = lru_.insert(lru_.begin(), latent_kind);
+        resident_bytes_ += resident.bytes;
+        ++load_count_;
+    }
+
+    // needed kinds move to the front, where eviction never reaches
+    for (const auto & latent_kind : needed) {
+        const size_t l = latent_kind.first;
+        const size_t k = latent_kind.second;
+        lru_.splice(lru_.begin(), lru_, residents_[l][k].position);
+    }
+    evict(needed.size());
+}
+
+void KindLoader::evict (size_t keep_count)
+{
+    while (mem_bytes_ and
+           resident_bytes_ > mem_bytes_ and
+           lru_.size() > keep_count)
+    {
+        const size_t l = lru_.back().first;
+        const size_t k = lru_.back().second;
+        lru_.pop_back();
+
+        const Latent & latent = latents_[l];
+        rng_t rng(latent.seed);
+        latent.cross_cat->mixture_unload_kind(
+            k,
+            latent.empty_group_count,
+            rng);
+
+        Resident & resident = residents_[l][k];
+        resident_bytes_ -= resident.bytes;
+        resident.loaded = false;
+        resident.bytes = 0;
+        resident.position = lru_.end();
+        ++evict_count_;
+    }
+}
+
+} // namespace loom
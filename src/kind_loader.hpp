@@ -0,0 +1,97 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <list>
+#include <loom/common.hpp>
+#include <loom/cross_cat.hpp>
+#include <loom/feature_set.hpp>
+
+namespace loom
+{
+
+//----------------------------------------------------------------------------
+// Kind Loader
+//
+// Design Goals:
+//  * Load a kind's groups only when a query first touches its features.
+//  * Bound resident group memory by evicting least recently used kinds.
+//    The bound is soft: kinds needed by the current request are never
+//    evicted, and group sizes are estimated.
+//  * Leave unloaded kinds as valid unobserved mixtures, so readers that
+//    never touch their features need not check what is resident.
+
+class KindLoader : noncopyable
+{
+public:
+
+    struct Latent
+    {
+        CrossCat * cross_cat;
+        std::string groups_in;
+        size_t empty_group_count;
+        uint64_t seed;
+    };
+
+    // mem_bytes = 0 means unbounded
+    KindLoader (const std::vector<Latent> & latents, size_t mem_bytes);
+
+    // loads, in each latent, every kind holding one of the features
+    void load (const FeatureSet & features);
+    void load_all ();
+
+    size_t load_count () const { return load_count_; }
+    size_t evict_count () const { return evict_count_; }
+    size_t resident_bytes () const { return resident_bytes_; }
+
+private:
+
+    typedef std::pair<size_t, size_t> LatentKind;
+    typedef std::list<LatentKind> Lru;
+
+    struct Resident
+    {
+        bool loaded;
+        size_t bytes;
+        Lru::iterator position;
+    };
+
+    void load (const std::vector<LatentKind> & needed);
+    void evict (size_t keep_count);
+
+    const std::vector<Latent> latents_;
+    const size_t mem_bytes_;
+    std::vector<std::vector<Resident>> residents_;
+    Lru lru_;
+    size_t resident_bytes_;
+    size_t load_count_;
+    size_t evict_count_;
+};
+
+} // namespace loom
@@ -80,9 +80,7 @@ void KindPipeline::start_threads (size_t parser_threads)
     for (size_t i = 0; i < parser_threads; ++i) {
         add_thread(1, [this, parser_threads](Task & task, ThreadState &){
             if (not task.parsed.test_and_set()) {
-                task.row.ParseFromArray(task.raw.data(), task.raw.size());
-                cross_cat_.splitter.split(task.row.diff(), task.partial_diffs);
-                cross_cat_.simplify(task.partial_diffs);
+                rows_.parse_split(task.raw, cross_cat_, task.split);
             }
         });
     }
@@ -90,13 +88,18 @@ void KindPipeline::start_threads (size_t parser_threads)
     // add/remove
     auto & rowids = assignments_.rowids();
     add_thread(2, [&rowids](const Task & task, ThreadState &){
-        if (task.add) {
-            bool ok = rowids.try_push(task.row.id());
-            LOOM_ASSERT1(ok, "duplicate row: " << task.row.id());
-        } else {
-            const auto rowid = rowids.pop();
-            if (LOOM_DEBUG_LEVEL >= 1) {
-                LOOM_ASSERT_EQ(rowid, task.row.id());
+        const auto & row = * task.split.row;
+        const size_t count = protobuf::row_multiplicity(row);
+        for (size_t c = 0; c < count; ++c) {
+            const auto id = protobuf::row_id(row, c);
+            if (task.add) {
+                bool ok = rowids.try_push(id);
+                LOOM_ASSERT1(ok, "duplicate row: " << id);
+            } else {
+                const auto rowid = rowids.pop();
+                if (LOOM_DEBUG_LEVEL >= 1) {
+                    LOOM_ASSERT_EQ(rowid, id);
+                }
             }
         }
     });
@@ -113,26 +116,23 @@ void KindPipeline::start_kind_threads ()
         // add/remove
         add_thread(2, [i, this](const Task & task, ThreadState & thread){
             if (LOOM_LIKELY(i < cross_cat_.kinds.size())) {
+                const auto & row = * task.split.row;
+                const auto & partial_diff = (* task.split.partial_diffs)[i];
+                const size_t count = protobuf::row_multiplicity(row);
                 if (task.add) {
-
-                    auto groupid = kind_kernel_.add_to_cross_cat(
+                    kind_kernel_.add_to_kind(
                         i,
-                        task.partial_diffs[i],
+                        partial_diff,
+                        row.diff(),
+                        count,
                         thread.scores,
                         thread.rng);
-                    kind_kernel_.add_to_kind_proposer(
-                        i,
-                        groupid,
-                        task.row.diff(),
-                        thread.rng);
-
                 } else {
-
-                    auto groupid = kind_kernel_.remove_from_cross_cat(
+                    kind_kernel_.remove_from_kind(
                         i,
-                        task.partial_diffs[i],
+                        partial_diff,
+                        count,
                         thread.rng);
-                    kind_kernel_.remove_from_kind_proposer(i, groupid);
                 }
             }
         });
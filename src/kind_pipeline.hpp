@@ -72,6 +72,9 @@ public:
     {
         bool changed = kind_kernel_.try_run();
         if (changed) {
+            if (auto * resident = rows_.resident()) {
+                resident->clear_split();
+            }
             start_kind_threads();
             pipeline_.validate();
         }
@@ -95,8 +98,7 @@ private:
         std::atomic_flag parsed;
         bool add;
         std::vector<char> raw;
-        protobuf::Row row;
-        std::vector<ProductValue::Diff> partial_diffs;
+        StreamInterval::SplitRow split;
 
         Task () : parsed(ATOMIC_FLAG_INIT) {}
     };
@@ -33,7 +33,11 @@
 #include <loom/kind_kernel.hpp>
 #include <loom/kind_pipeline.hpp>
 #include <loom/stream_interval.hpp>
+#include <loom/columnar.hpp>
+#include <loom/resident_rows.hpp>
 #include <loom/generate.hpp>
+#include <loom/store.hpp>
+#include <loom/snapshot.hpp>
 
 namespace loom
 {
@@ -48,30 +52,73 @@ Loom::Loom (
         const char * groups_in,
         const char * assign_in,
         const char * tares_in) :
+    Loom(
+        rng,
+        config,
+        model_in,
+        groups_in,
+        assign_in,
+        tares_in
+            ? protobuf_stream_load<ProductValue>(tares_in)
+            : std::vector<ProductValue>())
+{
+}
+
+Loom::Loom (
+        rng_t & rng,
+        const protobuf::Config & config,
+        const char * model_in,
+        const char * groups_in,
+        const char * assign_in,
+        const std::vector<ProductValue> & tares) :
     config_(config),
     cross_cat_(),
-    assignments_()
+    assignments_(),
+    assign_base_(),
+    can_dump_delta_(true)
 {
-    cross_cat_.model_load(model_in);
-    const size_t kind_count = cross_cat_.kinds.size();
-    LOOM_ASSERT(kind_count, "no kinds, loom is empty");
-    assignments_.init(kind_count);
-
     const size_t empty_group_count =
         config_.kernels().cat().empty_group_count();
     LOOM_ASSERT_LT(0, empty_group_count);
-    if (groups_in) {
-        cross_cat_.mixture_load(groups_in, empty_group_count, rng);
+    const std::string snapshot_in =
+        groups_in ? store::get_mixture_snapshot_path(groups_in) : "";
+    if (groups_in and CrossCat::snapshot_is_fresh(
+            snapshot_in.c_str(),
+            model_in,
+            groups_in))
+    {
+        cross_cat_.snapshot_load(snapshot_in.c_str(), empty_group_count, rng);
     } else {
-        cross_cat_.mixture_init_unobserved(empty_group_count, rng);
+        cross_cat_.model_load(model_in);
+        if (groups_in) {
+            cross_cat_.mixture_load(groups_in, empty_group_count, rng);
+        } else {
+            cross_cat_.mixture_init_unobserved(empty_group_count, rng);
+        }
     }
+    const size_t kind_count = cross_cat_.kinds.size();
+    LOOM_ASSERT(kind_count, "no kinds, loom is empty");
+    assignments_.init(kind_count);
 
-    if (tares_in) {
-        cross_cat_.tares_load(tares_in, rng);
+    if (not tares.empty()) {
+        cross_cat_.tares_init(tares, rng);
     }
 
     if (assign_in) {
-        assignments_.load(assign_in);
+        const std::string snapshot_in =
+            store::get_assign_snapshot_path(assign_in);
+        if (snapshot::is_file(assign_in) and
+            assignments_.snapshot_is_fresh(snapshot_in.c_str(), assign_in))
+        {
+            assignments_.snapshot_load(snapshot_in.c_str());
+        } else {
+            assignments_.load(assign_in);
+        }
+        if (snapshot::is_file(assign_in)) {
+            assign_base_ = store::get_absolute_path(assign_in);
+        } else {
+            can_dump_delta_ = false;
+        }
         for (const auto & kind : cross_cat_.kinds) {
             LOOM_ASSERT_LE(
                 assignments_.row_count(),
@@ -100,12 +147,27 @@ void Loom::dump (
         std::vector<std::vector<uint32_t>> sorted_to_globals =
             cross_cat_.get_sorted_groupids();
 
+        const bool write_snapshots = config_.schedule().write_snapshots();
+
         if (groups_out) {
             cross_cat_.mixture_dump(groups_out, sorted_to_globals);
+            if (write_snapshots) {
+                cross_cat_.snapshot_dump(
+                    store::get_mixture_snapshot_path(groups_out).c_str(),
+                    model_out,
+                    groups_out,
+                    sorted_to_globals);
+            }
         }
 
         if (assign_out) {
             assignments_.dump(assign_out, sorted_to_globals);
+            if (write_snapshots and snapshot::is_file(assign_out)) {
+                assignments_.snapshot_dump(
+                    store::get_assign_snapshot_path(assign_out).c_str(),
+                    assign_out,
+                    sorted_to_globals);
+            }
         }
     }
 }
@@ -115,18 +177,20 @@ void Loom::infer_single_pass (
         const char * rows_in,
         const char * assign_out)
 {
-    protobuf::InFile rows(rows_in);
+    RowReader rows(rows_in);
     protobuf::Row row;
     CatKernel cat_kernel(config_.kernels().cat(), cross_cat_);
 
     if (assign_out) {
 
         protobuf::OutFile assignments(assign_out);
-        protobuf::Assignment assignment;
+        std::vector<protobuf::Assignment> copies;
 
         while (rows.try_read_stream(row)) {
-            cat_kernel.add_row(rng, row, assignment);
-            assignments.write_stream(assignment);
+            cat_kernel.add_row(rng, row, copies);
+            for (const auto & assignment : copies) {
+                assignments.write_stream(assignment);
+            }
         }
 
     } else {
@@ -165,13 +229,14 @@ void Loom::log_metrics (Logger::Message & message)
     scores.set_kl_divergence(kl_divergence);
 }
 
-void Loom::infer_multi_pass (
+bool Loom::infer_multi_pass (
         rng_t & rng,
         const char * rows_in,
         const char * checkpoint_in,
-        const char * checkpoint_out)
+        const char * checkpoint_out,
+        const char * assign_out)
 {
-    StreamInterval rows(rows_in);
+    StreamInterval rows(rows_in, config_.schedule().resident_rows());
     CombinedSchedule schedule(config_.schedule());
     schedule.annealing.set_extra_passes(
         schedule.accelerating.extra_passes(assignments_.row_count()));
@@ -182,10 +247,28 @@ void Loom::infer_multi_pass (
         rng.seed(checkpoint.seed());
         rows.load(checkpoint.rows());
         schedule.load(checkpoint.schedule());
+        if (not checkpoint.has_record_count()) {
+            checkpoint.set_record_count(checkpoint.row_count());
+        }
         checkpoint.set_tardis_iter(checkpoint.tardis_iter() + 1);
+        if (checkpoint.assign_deltas_size()) {
+            assign_base_ = checkpoint.assign_base();
+            if (assign_base_.empty()) {
+                assignments_.init(cross_cat_.kinds.size());
+            } else {
+                assignments_.load(assign_base_.c_str());
+            }
+            for (const auto & delta : checkpoint.assign_deltas()) {
+                assignments_.delta_load(delta);
+            }
+            assignments_.validate();
+            can_dump_delta_ = true;
+        }
     } else {
-        size_t row_count =
-            protobuf::InFile::stream_stats(rows_in).message_count;
+        size_t record_count;
+        size_t row_count;
+        rows.count_rows(record_count, row_count);
+        checkpoint.set_record_count(record_count);
         checkpoint.set_row_count(row_count);
         if (assignments_.row_count()) {
             rows.init_from_assignments(assignments_);
@@ -207,12 +290,36 @@ void Loom::infer_multi_pass (
         infer_cat_structure(rows, checkpoint, schedule, rng);
     }
 
+    // deltas chain until the limit, then a full dump compacts them
+    bool assign_delta = false;
     if (checkpoint_out) {
+        const size_t delta_limit =
+            config_.schedule().checkpoint_delta_limit();
+        if (assign_out and
+            not checkpoint.finished() and
+            can_dump_delta_ and
+            assignments_.can_dump_delta() and
+            snapshot::is_file(assign_out) and
+            size_t(checkpoint.assign_deltas_size()) < delta_limit)
+        {
+            checkpoint.set_assign_base(assign_base_);
+            assignments_.delta_dump(
+                assign_out,
+                cross_cat_.get_sorted_groupids(),
+                * checkpoint.add_assign_deltas());
+            assign_delta = true;
+        } else {
+            checkpoint.clear_assign_base();
+            checkpoint.clear_assign_deltas();
+        }
+
         checkpoint.set_seed(rng());
         rows.dump(* checkpoint.mutable_rows());
         schedule.dump(* checkpoint.mutable_schedule());
         protobuf::OutFile(checkpoint_out).write(checkpoint);
     }
+
+    return assign_delta;
 }
 
 bool Loom::infer_kind_structure_sequential (
@@ -223,19 +330,30 @@ bool Loom::infer_kind_structure_sequential (
 {
     KindKernel kind_kernel(config_.kernels(), cross_cat_, assignments_, rng());
     HyperKernel hyper_kernel(config_.kernels().hyper(), cross_cat_);
+    const ResidentRows * resident = rows.resident();
     protobuf::Row row;
 
     while (LOOM_LIKELY(assignments_.row_count() != checkpoint.row_count())) {
         if (schedule.annealing.next_action_is_add()) {
 
-            rows.read_unassigned(row);
-            kind_kernel.add_row(row);
+            if (resident) {
+                kind_kernel.add_row(
+                    resident->row(rows.read_unassigned_index()));
+            } else {
+                rows.read_unassigned(row);
+                kind_kernel.add_row(row);
+            }
             schedule.batching.add();
 
         } else {
 
-            rows.read_assigned(row);
-            kind_kernel.remove_row(row);
+            if (resident) {
+                kind_kernel.remove_row(
+                    resident->row(rows.read_assigned_index()));
+            } else {
+                rows.read_assigned(row);
+                kind_kernel.remove_row(row);
+            }
             schedule.batching.remove();
         }
 
@@ -288,24 +406,25 @@ bool Loom::infer_kind_structure_parallel (
         kind_kernel,
         rng);
 
-    size_t row_count = assignments_.row_count();
-    while (LOOM_LIKELY(row_count != checkpoint.row_count())) {
+    // deduplicated rows are only parsed in the pipeline, so count messages
+    const size_t record_count = checkpoint.record_count();
+    size_t assigned_count = rows.assigned_record_count(record_count);
+    while (LOOM_LIKELY(assigned_count != record_count)) {
         if (schedule.annealing.next_action_is_add()) {
 
-            ++row_count;
+            ++assigned_count;
             pipeline.add_row();
             schedule.batching.add();
 
         } else {
 
-            --row_count;
+            --assigned_count;
             pipeline.remove_row();
             schedule.batching.remove();
         }
 
         if (LOOM_UNLIKELY(schedule.batching.test())) {
             pipeline.wait();
-            LOOM_ASSERT_EQ(assignments_.row_count(), row_count);
             schedule.annealing.set_extra_passes(
                 schedule.accelerating.extra_passes(
                     assignments_.row_count()));
@@ -329,6 +448,7 @@ bool Loom::infer_kind_structure_parallel (
     }
 
     pipeline.wait();
+    LOOM_ASSERT_EQ(assignments_.row_count(), checkpoint.row_count());
     checkpoint.set_finished(true);
     checkpoint.set_tardis_iter(checkpoint.tardis_iter() + 1);
     logger([&](Logger::Message & message){
@@ -347,19 +467,56 @@ bool Loom::infer_cat_structure_sequential (
 {
     CatKernel cat_kernel(config_.kernels().cat(), cross_cat_);
     HyperKernel hyper_kernel(config_.kernels().hyper(), cross_cat_);
+    ResidentRows * resident = rows.resident();
+    if (resident) {
+        resident->split(cross_cat_);
+    }
     protobuf::Row row;
+    StreamInterval::SplitRow split;
 
     while (LOOM_LIKELY(assignments_.row_count() != checkpoint.row_count())) {
         if (schedule.annealing.next_action_is_add()) {
 
-            rows.read_unassigned(row);
-            cat_kernel.add_row(rng, row, assignments_);
+            if (resident) {
+                const size_t index = rows.read_unassigned_index();
+                cat_kernel.add_row(
+                    rng,
+                    resident->row(index),
+                    resident->partial_diffs(index),
+                    assignments_);
+            } else if (rows.is_columnar()) {
+                rows.read_unassigned_split(cross_cat_, split);
+                cat_kernel.add_row(
+                    rng,
+                    * split.row,
+                    * split.partial_diffs,
+                    assignments_);
+            } else {
+                rows.read_unassigned(row);
+                cat_kernel.add_row(rng, row, assignments_);
+            }
             schedule.batching.add();
 
         } else {
 
-            rows.read_assigned(row);
-            cat_kernel.remove_row(rng, row, assignments_);
+            if (resident) {
+                const size_t index = rows.read_assigned_index();
+                cat_kernel.remove_row(
+                    rng,
+                    resident->row(index),
+                    resident->partial_diffs(index),
+                    assignments_);
+            } else if (rows.is_columnar()) {
+                rows.read_assigned_split(cross_cat_, split);
+                cat_kernel.remove_row(
+                    rng,
+                    * split.row,
+                    * split.partial_diffs,
+                    assignments_);
+            } else {
+                rows.read_assigned(row);
+                cat_kernel.remove_row(rng, row, assignments_);
+            }
             schedule.batching.remove();
         }
 
@@ -399,6 +556,9 @@ bool Loom::infer_cat_structure_parallel (
 {
     CatKernel cat_kernel(config_.kernels().cat(), cross_cat_);
     HyperKernel hyper_kernel(config_.kernels().hyper(), cross_cat_);
+    if (auto * resident = rows.resident()) {
+        resident->split(cross_cat_);
+    }
     CatPipeline pipeline(
         config_.kernels().cat(),
         cross_cat_,
@@ -407,26 +567,28 @@ bool Loom::infer_cat_structure_parallel (
         cat_kernel,
         rng);
 
-    size_t row_count = assignments_.row_count();
-    while (LOOM_LIKELY(row_count != checkpoint.row_count())) {
+    // deduplicated rows are only parsed in the pipeline, so count messages
+    const size_t record_count = checkpoint.record_count();
+    size_t assigned_count = rows.assigned_record_count(record_count);
+    while (LOOM_LIKELY(assigned_count != record_count)) {
         if (schedule.annealing.next_action_is_add()) {
 
-            ++row_count;
+            ++assigned_count;
             pipeline.add_row();
             schedule.batching.add();
 
         } else {
 
-            --row_count;
+            --assigned_count;
             pipeline.remove_row();
             schedule.batching.remove();
         }
 
         if (LOOM_UNLIKELY(schedule.batching.test())) {
             pipeline.wait();
-            LOOM_ASSERT_EQ(assignments_.row_count(), row_count);
             schedule.annealing.set_extra_passes(
-                schedule.accelerating.extra_passes(row_count));
+                schedule.accelerating.extra_passes(
+                    assignments_.row_count()));
             hyper_kernel.try_run(rng);
             checkpoint.set_tardis_iter(checkpoint.tardis_iter() + 1);
             logger([&](Logger::Message & message){
@@ -441,6 +603,7 @@ bool Loom::infer_cat_structure_parallel (
     }
 
     pipeline.wait();
+    LOOM_ASSERT_EQ(assignments_.row_count(), checkpoint.row_count());
     checkpoint.set_finished(true);
     checkpoint.set_tardis_iter(checkpoint.tardis_iter() + 1);
     logger([&](Logger::Message & message){
@@ -455,7 +618,43 @@ void Loom::posterior_enum (
         const char * rows_in,
         const char * samples_out)
 {
-    const size_t sample_count = config_.posterior_enum().sample_count();
+    StreamInterval rows(rows_in, true);
+    protobuf::OutFile sample_stream(samples_out);
+    run_posterior_enum(
+        rng,
+        rows,
+        config_.posterior_enum().sample_count(),
+        [&](protobuf::PosteriorEnum::Sample & sample){
+            sample_stream.write_stream(sample);
+        });
+}
+
+void Loom::posterior_enum (
+        rng_t & rng,
+        const char * rows_in,
+        const std::shared_ptr<ResidentRows> & resident,
+        size_t sample_count,
+        std::vector<protobuf::PosteriorEnum::Sample> & samples)
+{
+    StreamInterval rows(rows_in, resident);
+    samples.clear();
+    samples.reserve(sample_count);
+    run_posterior_enum(
+        rng,
+        rows,
+        sample_count,
+        [&](const protobuf::PosteriorEnum::Sample & sample){
+            samples.push_back(sample);
+        });
+}
+
+template<class Fun>
+void Loom::run_posterior_enum (
+        rng_t & rng,
+        StreamInterval & rows,
+        size_t sample_count,
+        const Fun & write_sample)
+{
     const size_t sample_skip = config_.posterior_enum().sample_skip();
     LOOM_ASSERT_LE(1, sample_count);
     LOOM_ASSERT(sample_skip > 0 or sample_count == 1, "zero diversity");
@@ -463,16 +662,19 @@ void Loom::posterior_enum (
     CatKernel cat_kernel(config_.kernels().cat(), cross_cat_);
     HyperKernel hyper_kernel(config_.kernels().hyper(), cross_cat_);
 
-    const auto rows = protobuf_stream_load<protobuf::Row>(rows_in);
-
-    LOOM_ASSERT_LT(0, rows.size());
+    // every row is assigned between sweeps, so each sweep removes and
+    // re-adds rows in the order the stream interval serves them
+    ResidentRows & resident = * rows.resident();
+    const size_t record_count = resident.record_count();
+    LOOM_ASSERT_LT(0, record_count);
     if (assignments_.rowids().empty()) {
-        for (const auto & row : rows) {
-            cat_kernel.add_row(rng, row, assignments_);
+        for (size_t i = 0; i < record_count; ++i) {
+            cat_kernel.add_row(rng, resident.row(i), assignments_);
         }
+    } else {
+        rows.init_from_assignments(assignments_);
     }
 
-    protobuf::OutFile sample_stream(samples_out);
     protobuf::PosteriorEnum::Sample sample;
 
     if (config_.kernels().kind().iterations() > 0) {
@@ -483,32 +685,63 @@ void Loom::posterior_enum (
             assignments_,
             rng());
 
-        for (size_t i = 0; i < sample_count; ++i) {
-            for (size_t t = 0; t < sample_skip; ++t) {
-                for (const auto & row : rows) {
-                    kind_kernel.remove_row(row);
-                    kind_kernel.add_row(row);
+        if (config_.kernels().kind().row_queue_capacity()) {
+
+            KindPipeline pipeline(
+                config_.kernels().kind(),
+                cross_cat_,
+                rows,
+                assignments_,
+                kind_kernel,
+                rng);
+
+            for (size_t i = 0; i < sample_count; ++i) {
+                for (size_t t = 0; t < sample_skip; ++t) {
+                    for (size_t r = 0; r < record_count; ++r) {
+                        pipeline.remove_row();
+                        pipeline.add_row();
+                    }
+                    pipeline.wait();
+                    pipeline.try_run();
+                    hyper_kernel.try_run(rng);
+                    pipeline.init_cache();
                 }
-                kind_kernel.try_run();
-                hyper_kernel.try_run(rng);
-                kind_kernel.init_cache();
+                dump_posterior_enum(sample, rng);
+                write_sample(sample);
+            }
+
+        } else {
+
+            for (size_t i = 0; i < sample_count; ++i) {
+                for (size_t t = 0; t < sample_skip; ++t) {
+                    for (size_t r = 0; r < record_count; ++r) {
+                        kind_kernel.remove_row(resident.row(r));
+                        kind_kernel.add_row(resident.row(r));
+                    }
+                    kind_kernel.try_run();
+                    hyper_kernel.try_run(rng);
+                    kind_kernel.init_cache();
+                }
+                dump_posterior_enum(sample, rng);
+                write_sample(sample);
             }
-            dump_posterior_enum(sample, rng);
-            sample_stream.write_stream(sample);
         }
 
     } else {
 
+        resident.split(cross_cat_);
         for (size_t i = 0; i < sample_count; ++i) {
             for (size_t t = 0; t < sample_skip; ++t) {
-                for (const auto & row : rows) {
-                    cat_kernel.remove_row(rng, row, assignments_);
-                    cat_kernel.add_row(rng, row, assignments_);
+                for (size_t r = 0; r < record_count; ++r) {
+                    const auto & row = resident.row(r);
+                    const auto & diffs = resident.partial_diffs(r);
+                    cat_kernel.remove_row(rng, row, diffs, assignments_);
+                    cat_kernel.add_row(rng, row, diffs, assignments_);
                 }
                 hyper_kernel.try_run(rng);
             }
             dump_posterior_enum(sample, rng);
-            sample_stream.write_stream(sample);
+            write_sample(sample);
         }
     }
 }
@@ -573,12 +806,25 @@ void Loom::mix (
     HyperKernel hyper_kernel(config_.kernels().hyper(), cross_cat_);
     KindKernel kind_kernel(config_.kernels(), cross_cat_, assignments_, rng());
 
+    std::unique_ptr<ResidentRows> resident;
+    if (config_.schedule().resident_rows()) {
+        resident.reset(new ResidentRows(rows_in));
+    }
+
     for (size_t i = 0; i < sample_skip; ++i) {
-        protobuf::InFile rows(rows_in);
-        protobuf::Row row;
-        while (rows.try_read_stream(row)) {
-            kind_kernel.remove_row(row);
-            kind_kernel.add_row(row);
+        if (resident) {
+            const size_t record_count = resident->record_count();
+            for (size_t r = 0; r < record_count; ++r) {
+                kind_kernel.remove_row(resident->row(r));
+                kind_kernel.add_row(resident->row(r));
+            }
+        } else {
+            RowReader rows(rows_in);
+            protobuf::Row row;
+            while (rows.try_read_stream(row)) {
+                kind_kernel.remove_row(row);
+                kind_kernel.add_row(row);
+            }
         }
         kind_kernel.try_run();
         hyper_kernel.try_run(rng);
@@ -28,6 +28,7 @@
 
 #pragma once
 
+#include <memory>
 #include <unordered_map>
 #include <loom/common.hpp>
 #include <loom/cross_cat.hpp>
@@ -40,6 +41,7 @@ namespace loom
 {
 
 class StreamInterval;
+class ResidentRows;
 
 class Loom : noncopyable
 {
@@ -55,6 +57,15 @@ public:
             const char * assign_in = nullptr,
             const char * tares_in = nullptr);
 
+    // tares are parsed by the caller, so they can be shared across looms
+    Loom (
+            rng_t & rng,
+            const protobuf::Config & config,
+            const char * model_in,
+            const char * groups_in,
+            const char * assign_in,
+            const std::vector<ProductValue> & tares);
+
     void dump (
             const char * model_out = nullptr,
             const char * groups_out = nullptr,
@@ -65,17 +76,30 @@ public:
             const char * rows_in,
             const char * assign_out = nullptr);
 
-    void infer_multi_pass (
+    // When checkpointing with schedule.checkpoint_delta_limit > 0, this may
+    // write assign_out as a delta; returns whether it did, in which case
+    // dump should not write assign_out again.
+    bool infer_multi_pass (
             rng_t & rng,
             const char * rows_in,
             const char * checkpoint_in = nullptr,
-            const char * checkpoint_out = nullptr);
+            const char * checkpoint_out = nullptr,
+            const char * assign_out = nullptr);
 
     void posterior_enum (
             rng_t & rng,
             const char * rows_in,
             const char * samples_out);
 
+    // runs one of several chains, collecting its sample_count samples;
+    // chains share rows_in, already loaded as resident rows
+    void posterior_enum (
+            rng_t & rng,
+            const char * rows_in,
+            const std::shared_ptr<ResidentRows> & resident,
+            size_t sample_count,
+            std::vector<protobuf::PosteriorEnum::Sample> & samples);
+
     void generate (
             rng_t & rng,
             const char * rows_out);
@@ -126,6 +150,13 @@ private:
 
     void log_metrics (Logger::Message & message);
 
+    template<class Fun>
+    void run_posterior_enum (
+            rng_t & rng,
+            StreamInterval & rows,
+            size_t sample_count,
+            const Fun & write_sample);
+
     void dump_posterior_enum (
             protobuf::PosteriorEnum::Sample & message,
             rng_t & rng);
@@ -133,6 +164,8 @@ private:
     const protobuf::Config & config_;
     CrossCat cross_cat_;
     Assignments assignments_;
+    std::string assign_base_;
+    bool can_dump_delta_;
 };
 
 inline bool Loom::infer_kind_structure (
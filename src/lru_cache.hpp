@@ -0,0 +1,106 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <loom/common.hpp>
+
+namespace loom
+{
+
+//----------------------------------------------------------------------------
+// LRU Cache
+//
+// Design Goals:
+//  * Bound memory by evicting the least recently used entry.
+//  * Provide O(1) find and insert.
+//  * Values are owned by the cache; found pointers are invalidated by
+//    the next insert or clear.
+
+template<class Key, class Value, class Hash = std::hash<Key>>
+class LruCache : noncopyable
+{
+    typedef std::pair<Key, Value> Entry;
+    typedef std::list<Entry> List;
+    typedef std::unordered_map<Key, typename List::iterator, Hash> Map;
+
+    const size_t capacity_;
+    List entries_;
+    Map index_;
+
+public:
+
+    explicit LruCache (size_t capacity) :
+        capacity_(capacity),
+        entries_(),
+        index_()
+    {
+    }
+
+    size_t capacity () const { return capacity_; }
+    size_t size () const { return index_.size(); }
+
+    const Value * find (const Key & key)
+    {
+        auto found = index_.find(key);
+        if (found == index_.end()) {
+            return nullptr;
+        }
+        entries_.splice(entries_.begin(), entries_, found->second);
+        return & found->second->second;
+    }
+
+    void insert (const Key & key, const Value & value)
+    {
+        if (LOOM_UNLIKELY(capacity_ == 0)) {
+            return;
+        }
+        auto found = index_.find(key);
+        if (found != index_.end()) {
+            found->second->second = value;
+            entries_.splice(entries_.begin(), entries_, found->second);
+            return;
+        }
+        if (index_.size() == capacity_) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+        entries_.push_front(Entry(key, value));
+        index_.insert(std::make_pair(key, entries_.begin()));
+    }
+
+    void clear ()
+    {
+        index_.clear();
+        entries_.clear();
+    }
+};
+
+} // namespace loom
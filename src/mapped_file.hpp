@@ -0,0 +1,159 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <loom/common.hpp>
+
+namespace loom
+{
+
+//----------------------------------------------------------------------------
+// Native binary files
+//
+// Design Goals:
+//  * Load large flat arrays with a single mmap and no parsing.
+//  * Map read-only and shared, so that many processes reading the same
+//    file share the same physical pages.
+//  * Keep the format position-independent: offsets, never pointers.
+
+class MappedFile : noncopyable
+{
+public:
+
+    explicit MappedFile (const char * filename) :
+        filename_(filename),
+        data_(nullptr),
+        size_(0)
+    {
+        int fid = open(filename, O_RDONLY);
+        LOOM_ASSERT(fid != -1, "failed to open input file " << filename);
+        struct stat info;
+        LOOM_ASSERT(fstat(fid, & info) == 0, "failed to stat " << filename);
+        size_ = info.st_size;
+        if (size_) {
+            void * data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fid, 0);
+            LOOM_ASSERT(data != MAP_FAILED, "failed to mmap " << filename);
+            data_ = static_cast<const char *>(data);
+        }
+        close(fid);
+    }
+
+    ~MappedFile ()
+    {
+        if (data_) {
+            munmap(const_cast<char *>(data_), size_);
+        }
+    }
+
+    const char * filename () const { return filename_.c_str(); }
+    size_t size () const { return size_; }
+
+    template<class T>
+    const T * at (size_t offset, size_t count = 1) const
+    {
+        LOOM_ASSERT(
+            offset + sizeof(T) * count <= size_,
+            "truncated file " << filename_);
+        LOOM_ASSERT(
+            offset % alignof(T) == 0,
+            "misaligned data in " << filename_);
+        return reinterpret_cast<const T *>(data_ + offset);
+    }
+
+private:
+
+    const std::string filename_;
+    const char * data_;
+    size_t size_;
+};
+
+class BinaryOutFile : noncopyable
+{
+public:
+
+    explicit BinaryOutFile (const char * filename) :
+        filename_(filename),
+        fid_(open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0664)),
+        position_(0)
+    {
+        LOOM_ASSERT(fid_ != -1, "failed to open output file " << filename);
+    }
+
+    ~BinaryOutFile ()
+    {
+        close(fid_);
+    }
+
+    size_t position () const { return position_; }
+
+    void write (const void * data, size_t size)
+    {
+        const char * begin = static_cast<const char *>(data);
+        while (size) {
+            ssize_t written = ::write(fid_, begin, size);
+            LOOM_ASSERT(written > 0, "failed to write to " << filename_);
+            begin += written;
+            size -= written;
+            position_ += written;
+        }
+    }
+
+    template<class T>
+    void write (const T * data, size_t count)
+    {
+        write(static_cast<const void *>(data), sizeof(T) * count);
+    }
+
+    template<class T>
+    void write_pod (const T & value)
+    {
+        write(& value, 1);
+    }
+
+    void pad_to (size_t alignment)
+    {
+        static const char zeros[64] = {0};
+        LOOM_ASSERT_LE(alignment, sizeof(zeros));
+        write(zeros, (alignment - position_ % alignment) % alignment);
+    }
+
+private:
+
+    const std::string filename_;
+    const int fid_;
+    size_t position_;
+};
+
+} // namespace loom
@@ -26,7 +26,9 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
 #include <fstream>
+#include <omp.h>
 #include <loom/store.hpp>
 #include <loom/multi_loom.hpp>
 
@@ -42,16 +44,17 @@ struct MultiLoom::Sample
     Sample (const store::Paths::Sample & paths,
             bool load_groups,
             bool load_assign,
-            const char * tares_in) :
+            const std::vector<ProductValue> & tares,
+            bool lazy) :
         config(protobuf_load<protobuf::Config>(paths.config.c_str())),
         rng(config.seed()),
         loom(
             rng,
             config,
             paths.model.c_str(),
-            load_groups ? paths.groups.c_str() : nullptr,
+            load_groups and not lazy ? paths.groups.c_str() : nullptr,
             load_assign ? paths.assign.c_str() : nullptr,
-            tares_in)
+            tares)
     {
     }
 };
@@ -60,22 +63,59 @@ MultiLoom::MultiLoom (
         const char * root_in,
         bool load_groups,
         bool load_assign,
-        bool load_tares)
+        bool load_tares,
+        bool lazy,
+        size_t lazy_mem_bytes) :
+    samples_(),
+    kind_loader_(nullptr)
 {
     const auto paths = store::get_paths(root_in);
     const char * tares_in = paths.ingest.tares.c_str();
-    if (not (load_tares and std::ifstream(tares_in))) {
-        tares_in = nullptr;
+    std::vector<ProductValue> tares;
+    if (load_tares and std::ifstream(tares_in)) {
+        tares = protobuf_stream_load<ProductValue>(tares_in);
     }
-    for (const auto & sample_paths : paths.samples) {
-        samples_.push_back(
-            new Sample(sample_paths, load_groups, load_assign, tares_in));
+
+    // Samples are independent, so load them concurrently, at most one per
+    // OpenMP thread.  Per-kind loops inside each loom run serially while
+    // nested in this region, so a single sample is loaded outside it.
+    const size_t sample_count = paths.samples.size();
+    const size_t thread_count = std::max<size_t>(1, std::min<size_t>(
+        sample_count,
+        omp_get_max_threads()));
+    samples_.resize(sample_count, nullptr);
+
+    #pragma omp parallel for schedule(dynamic, 1) \
+        num_threads(thread_count) if(sample_count > 1)
+    for (size_t i = 0; i < sample_count; ++i) {
+        samples_[i] =
+            new Sample(
+                paths.samples[i],
+                load_groups,
+                load_assign,
+                tares,
+                lazy);
     }
     LOOM_ASSERT(not samples_.empty(), "no samples were found at " << root_in);
+
+    if (lazy and load_groups) {
+        std::vector<KindLoader::Latent> latents;
+        for (size_t i = 0; i < sample_count; ++i) {
+            Sample & sample = * samples_[i];
+            KindLoader::Latent latent = {
+                const_cast<CrossCat *>(& sample.loom.cross_cat()),
+                paths.samples[i].groups,
+                sample.config.kernels().cat().empty_group_count(),
+                sample.rng()};
+            latents.push_back(latent);
+        }
+        kind_loader_ = new KindLoader(latents, lazy_mem_bytes);
+    }
 }
 
 MultiLoom::~MultiLoom ()
 {
+    delete kind_loader_;
     for (auto * sample : samples_) {
         delete sample;
     }
@@ -29,6 +29,7 @@
 #pragma once
 
 #include <loom/loom.hpp>
+#include <loom/kind_loader.hpp>
 
 namespace loom
 {
@@ -41,16 +42,22 @@ public:
             const char * root_in,
             bool load_groups = false,
             bool load_assign = false,
-            bool load_tares = false);
+            bool load_tares = false,
+            bool lazy = false,
+            size_t lazy_mem_bytes = 0);
     ~MultiLoom ();
 
     const std::vector<const CrossCat *> cross_cats () const;
 
+    // in lazy mode, groups are loaded through this; otherwise null
+    KindLoader * kind_loader () const { return kind_loader_; }
+
 private:
 
     struct Sample;
 
     std::vector<Sample *> samples_;
+    KindLoader * kind_loader_;
 };
 
 } // namespace loom
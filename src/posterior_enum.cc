@@ -26,8 +26,11 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
+#include <omp.h>
 #include <loom/args.hpp>
 #include <loom/protobuf_stream.hpp>
+#include <loom/resident_rows.hpp>
 #include <loom/loom.hpp>
 
 const char * help_message =
@@ -49,8 +52,74 @@ const char * help_message =
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
 "\n  If running kind inference and GROUPS_IN is provided,"
 "\n    then all data in groups must be accounted for in ASSIGN_IN."
+"\n  With config.posterior_enum.chain_count > 1, chains run concurrently"
+"\n    and sample i is drawn by chain i % chain_count.  At most"
+"\n    OMP_NUM_THREADS chains run at once, sharing one copy of ROWS_IN;"
+"\n    each chain runs the kind kernel without a pipeline."
 ;
 
+// Each chain loads its own copy of the model and draws every
+// chain_count-th sample; samples are buffered until all chains finish.
+// Rows are loaded once and shared read-only.  Chains already occupy every
+// thread, so they run the kind kernel serially rather than each starting
+// pipeline threads.
+void posterior_enum_chains (
+        const loom::protobuf::Config & pipelined_config,
+        loom::rng_t & rng,
+        const char * rows_in,
+        const char * tares_in,
+        const char * model_in,
+        const char * groups_in,
+        const char * assign_in,
+        const char * samples_out)
+{
+    loom::protobuf::Config config = pipelined_config;
+    config.mutable_kernels()->mutable_kind()->set_row_queue_capacity(0);
+    const size_t chain_count = config.posterior_enum().chain_count();
+    const size_t sample_count = config.posterior_enum().sample_count();
+    LOOM_ASSERT_LE(chain_count, sample_count);
+
+    const auto tares =
+        tares_in
+            ? loom::protobuf_stream_load<loom::ProductValue>(tares_in)
+            : std::vector<loom::ProductValue>();
+    const auto resident = std::make_shared<loom::ResidentRows>(rows_in);
+    std::vector<uint64_t> seeds;
+    for (size_t c = 0; c < chain_count; ++c) {
+        seeds.push_back(rng());
+    }
+
+    const int thread_count = std::min<size_t>(
+        chain_count,
+        std::max(1, omp_get_max_threads()));
+    std::vector<std::vector<loom::protobuf::PosteriorEnum::Sample>>
+        samples(chain_count);
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(thread_count)
+    for (size_t c = 0; c < chain_count; ++c) {
+        loom::rng_t chain_rng(seeds[c]);
+        loom::Loom engine(
+            chain_rng,
+            config,
+            model_in,
+            groups_in,
+            assign_in,
+            tares);
+        const size_t chain_sample_count =
+            (sample_count - c + chain_count - 1) / chain_count;
+        engine.posterior_enum(
+            chain_rng,
+            rows_in,
+            resident,
+            chain_sample_count,
+            samples[c]);
+    }
+
+    loom::protobuf::OutFile sample_stream(samples_out);
+    for (size_t i = 0; i < sample_count; ++i) {
+        sample_stream.write_stream(samples[i % chain_count][i / chain_count]);
+    }
+}
+
 int main (int argc, char ** argv)
 {
     GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -67,9 +136,28 @@ int main (int argc, char ** argv)
 
     const auto config = loom::protobuf_load<loom::protobuf::Config>(config_in);
     loom::rng_t rng(config.seed());
-    loom::Loom engine(rng, config, model_in, groups_in, assign_in, tares_in);
+    LOOM_ASSERT_LE(1, config.posterior_enum().chain_count());
 
-    engine.posterior_enum(rng, rows_in, samples_out);
+    if (config.posterior_enum().chain_count() == 1) {
+        loom::Loom engine(
+            rng,
+            config,
+            model_in,
+            groups_in,
+            assign_in,
+            tares_in);
+        engine.posterior_enum(rng, rows_in, samples_out);
+    } else {
+        posterior_enum_chains(
+            config,
+            rng,
+            rows_in,
+            tares_in,
+            model_in,
+            groups_in,
+            assign_in,
+            samples_out);
+    }
 
     return 0;
 }
@@ -27,7 +27,9 @@
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <loom/product_mixture.hpp>
+#include <type_traits>
 #include <distributions/assert_close.hpp>
+#include <loom/snapshot.hpp>
 
 namespace loom
 {
@@ -742,17 +744,32 @@ void ProductMixture_<cached>::load_step_1_of_3 (
         const ProductModel & model,
         const char * filename,
         size_t empty_group_count)
+{
+    protobuf::InFile groups(filename);
+    load_step_1_of_3(model, groups, empty_group_count);
+}
+
+template<bool cached>
+void ProductMixture_<cached>::_clear_groups (const ProductModel & model)
 {
     clear_fun fun = {model.features, features};
     for_each_feature_type(fun);
-    auto & counts = clustering.counts();
-    counts.clear();
+    clustering.counts().clear();
     for (auto & tare_cache : tare_caches) {
         tare_cache.scores.clear();
         tare_cache.counts.clear();
     }
+}
+
+template<bool cached>
+void ProductMixture_<cached>::load_step_1_of_3 (
+        const ProductModel & model,
+        protobuf::InFile & groups,
+        size_t empty_group_count)
+{
+    _clear_groups(model);
+    auto & counts = clustering.counts();
 
-    protobuf::InFile groups(filename);
     protobuf::ProductModel::Group message;
     while (groups.try_read_stream(message)) {
         counts.push_back(message.count());
@@ -765,6 +782,75 @@ void ProductMixture_<cached>::load_step_1_of_3 (
     id_tracker.init(counts.size());
 }
 
+// Plain-old-data groups are stored as raw arrays; other groups, whose
+// storage lives on the heap, are stored as a stream of protobuf messages.
+
+template<bool cached>
+struct ProductMixture_<cached>::snapshot_load_fun
+{
+    snapshot::BlockReader & block;
+    const size_t group_count;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t,
+            typename T::template Mixture<cached>::t & mixture)
+    {
+        load(t, mixture.groups(), std::is_pod<typename T::Group>());
+    }
+
+    template<class T>
+    void load (
+            T *,
+            std::vector<typename T::Group> & groups,
+            std::true_type)
+    {
+        const auto * data = block.read<typename T::Group>(group_count);
+        groups.assign(data, data + group_count);
+    }
+
+    template<class T>
+    void load (
+            T *,
+            std::vector<typename T::Group> & groups,
+            std::false_type)
+    {
+        const size_t size = block.read_pod<uint64_t>();
+        protobuf::InFile stream(block.read<char>(size), size);
+        protobuf::ProductModel::Group message;
+        groups.resize(group_count);
+        for (auto & group : groups) {
+            bool success = stream.try_read_stream(message);
+            LOOM_ASSERT(success, "truncated snapshot block");
+            group.protobuf_load(protobuf::Fields<T>::get(message).Get(0));
+        }
+    }
+};
+
+template<bool cached>
+void ProductMixture_<cached>::snapshot_load_step_1_of_3 (
+        const ProductModel & model,
+        const char * data,
+        size_t size,
+        size_t empty_group_count)
+{
+    _clear_groups(model);
+    snapshot::BlockReader block(data, size);
+    const size_t group_count = block.read_pod<uint64_t>();
+    const uint32_t * group_counts = block.read<uint32_t>(group_count);
+    auto & counts = clustering.counts();
+    counts.assign(group_counts, group_counts + group_count);
+
+    snapshot_load_fun fun = {block, group_count};
+    for_each_feature(fun, features);
+    LOOM_ASSERT(block.done(), "snapshot block has trailing data");
+
+    counts.resize(counts.size() + empty_group_count, 0);
+    clustering.init(model.clustering);
+    id_tracker.init(counts.size());
+}
+
 template<bool cached>
 struct ProductMixture_<cached>::init_groups_fun
 {
@@ -833,14 +919,111 @@ struct ProductMixture_<cached>::dump_group_fun
     }
 };
 
+template<bool cached>
+struct ProductMixture_<cached>::snapshot_dump_fun
+{
+    snapshot::BlockWriter & block;
+    const std::vector<size_t> & packeds;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t,
+            const typename T::template Mixture<cached>::t & mixture)
+    {
+        dump(t, mixture, std::is_pod<typename T::Group>());
+    }
+
+    template<class T, class Mixture>
+    void dump (T *, const Mixture & mixture, std::true_type)
+    {
+        for (auto packed : packeds) {
+            block.write(& mixture.groups(packed), 1);
+        }
+    }
+
+    template<class T, class Mixture>
+    void dump (T *, const Mixture & mixture, std::false_type)
+    {
+        std::string data;
+        {
+            protobuf::OutFile stream(data);
+            protobuf::ProductModel::Group message;
+            for (auto packed : packeds) {
+                message.Clear();
+                message.set_count(0);
+                mixture.groups(packed).protobuf_dump(
+                    * protobuf::Fields<T>::get(message).Add());
+                stream.write_stream(message);
+            }
+        }
+        block.write_pod(uint64_t(data.size()));
+        block.write(data.data(), data.size());
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::group_bytes_fun
+{
+    size_t & bytes;
+
+    template<class T>
+    void operator() (
+            T *,
+            size_t,
+            const typename T::template Mixture<cached>::t & mixture)
+    {
+        bytes += mixture.groups().size() * sizeof(typename T::Group);
+    }
+};
+
+template<bool cached>
+size_t ProductMixture_<cached>::group_bytes () const
+{
+    size_t bytes = clustering.counts().size() * sizeof(int);
+    group_bytes_fun fun = {bytes};
+    for_each_feature(fun, features);
+    return bytes;
+}
+
 template<bool cached>
 void ProductMixture_<cached>::dump (
         const char * filename,
         const std::vector<uint32_t> & sorted_to_global) const
+{
+    protobuf::OutFile groups(filename);
+    dump(groups, sorted_to_global);
+}
+
+template<bool cached>
+void ProductMixture_<cached>::snapshot_dump (
+        std::string & data,
+        const std::vector<uint32_t> & sorted_to_global) const
+{
+    const size_t group_count = sorted_to_global.size();
+    std::vector<size_t> packeds;
+    std::vector<uint32_t> counts;
+    for (auto global : sorted_to_global) {
+        auto packed = id_tracker.global_to_packed(global);
+        LOOM_ASSERT_LT(0, clustering.counts(packed));
+        packeds.push_back(packed);
+        counts.push_back(clustering.counts(packed));
+    }
+
+    snapshot::BlockWriter block(data);
+    block.write_pod(uint64_t(group_count));
+    block.write(counts.data(), group_count);
+    snapshot_dump_fun fun = {block, packeds};
+    for_each_feature(fun, features);
+}
+
+template<bool cached>
+void ProductMixture_<cached>::dump (
+        protobuf::OutFile & groups_stream,
+        const std::vector<uint32_t> & sorted_to_global) const
 {
     const size_t group_count = clustering.counts().size();
     LOOM_ASSERT_LT(sorted_to_global.size(), group_count);
-    protobuf::OutFile groups_stream(filename);
     protobuf::ProductModel::Group message;
     for (auto global : sorted_to_global) {
         auto packed = id_tracker.global_to_packed(global);
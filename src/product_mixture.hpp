@@ -73,6 +73,18 @@ struct ProductMixture_
             const char * filename,
             size_t empty_group_count);
 
+    void load_step_1_of_3 (
+            const ProductModel & model,
+            protobuf::InFile & groups,
+            size_t empty_group_count);
+
+    // reads a block written by snapshot_dump
+    void snapshot_load_step_1_of_3 (
+            const ProductModel & model,
+            const char * data,
+            size_t size,
+            size_t empty_group_count);
+
     void load_step_2_of_3 (
             const ProductModel & model,
             size_t featureid,
@@ -87,6 +99,15 @@ struct ProductMixture_
             const char * filename,
             const std::vector<uint32_t> & sorted_to_global) const;
 
+    void dump (
+            protobuf::OutFile & groups,
+            const std::vector<uint32_t> & sorted_to_global) const;
+
+    // appends a native block of the nonempty groups in sorted order
+    void snapshot_dump (
+            std::string & data,
+            const std::vector<uint32_t> & sorted_to_global) const;
+
     void add_value (
             const ProductModel & model,
             size_t groupid,
@@ -178,6 +199,9 @@ struct ProductMixture_
 
     void validate (const ProductModel & model) const;
 
+    // approximate, ignoring caches and heap storage within groups
+    size_t group_bytes () const;
+
     size_t count_rows () const
     {
         const auto & counts = clustering.counts();
@@ -192,6 +216,7 @@ private:
             const ProductModel & model,
             size_t groupid,
             rng_t & rng);
+    void _clear_groups (const ProductModel & model);
 
     struct validate_fun;
     struct clear_fun;
@@ -201,6 +226,9 @@ private:
     struct init_unobserved_fun;
     struct sort_groups_fun;
     struct dump_group_fun;
+    struct snapshot_load_fun;
+    struct snapshot_dump_fun;
+    struct group_bytes_fun;
     struct add_group_fun;
     struct add_value_fun;
     struct remove_group_fun;
@@ -937,6 +937,17 @@ struct ValueSplitter : noncopyable
 {
     const ValueSchema & schema () const { return schema_; }
     const ValueSchema & schema (size_t i) const { return part_schemas_[i]; }
+    size_t part_count () const { return part_schemas_.size(); }
+
+    // where full feature full_pos lands: which part, and its position there
+    uint32_t partid (size_t full_pos) const
+    {
+        return full_to_partid_[full_pos];
+    }
+    uint32_t part_pos (size_t full_pos) const
+    {
+        return full_to_part_[full_pos];
+    }
 
     void init (
             const ValueSchema & schema,
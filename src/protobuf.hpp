@@ -71,6 +71,19 @@ DECLARE_FIELDS(float, reals)
 
 #undef DECLARE_FIELDS
 
+//----------------------------------------------------------------------------
+// Rows
+
+inline size_t row_multiplicity (const Row & row)
+{
+    return 1 + row.dup_ids_size();
+}
+
+inline uint64_t row_id (const Row & row, size_t i)
+{
+    return i ? row.dup_ids(i - 1) : row.id();
+}
+
 //----------------------------------------------------------------------------
 // Models
 
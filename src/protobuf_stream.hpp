@@ -52,17 +52,29 @@ class InFile : noncopyable
 {
 public:
 
-    InFile (int fid) : fid_(fid)
+    InFile (int fid) : data_(nullptr), size_(0), fid_(fid)
     {
         _open();
     }
 
-    InFile (const char * filename) : filename_(filename)
+    InFile (const char * filename) :
+        filename_(filename),
+        data_(nullptr),
+        size_(0)
     {
         LOOM_ASSERT(not filename_.empty(), "empty filename is not supported");
         _open();
     }
 
+    // reads an uncompressed stream from memory, e.g. from a MappedFile
+    InFile (const void * data, size_t size) :
+        filename_("<memory>"),
+        data_(data),
+        size_(size)
+    {
+        _open();
+    }
+
     ~InFile ()
     {
         _close();
@@ -149,6 +161,7 @@ public:
         bool is_file;
         uint64_t message_count;
         uint32_t max_message_size;
+        uint64_t total_message_bytes;
     };
 
     static StreamStats stream_stats (const char * filename)
@@ -159,6 +172,7 @@ public:
         stats.is_file = file.is_file();
         stats.message_count = 0;
         stats.max_message_size = 0;
+        stats.total_message_bytes = 0;
 
         while (true) {
             google::protobuf::io::CodedInputStream coded(file.stream_);
@@ -169,6 +183,7 @@ public:
                 ++stats.message_count;
                 stats.max_message_size =
                     std::max(stats.max_message_size, message_size);
+                stats.total_message_bytes += message_size;
             } else {
                 break;
             }
@@ -180,6 +195,15 @@ private:
 
     void _open ()
     {
+        if (data_) {
+            position_ = 0;
+            is_file_ = false;
+            file_ = nullptr;
+            gzip_ = nullptr;
+            stream_ = new google::protobuf::io::ArrayInputStream(data_, size_);
+            return;
+        }
+
         if (filename_.empty()) {
             is_file_ = false;
         } else if (filename_ == "-" or filename_ == "-.gz") {
@@ -206,6 +230,10 @@ private:
 
     void _close ()
     {
+        if (data_) {
+            delete stream_;
+            return;
+        }
         delete gzip_;
         delete file_;
         if (is_file()) {
@@ -214,6 +242,8 @@ private:
     }
 
     const std::string filename_;
+    const void * const data_;
+    const size_t size_;
     int fid_;
     bool is_file_;
     google::protobuf::io::FileInputStream * file_;
@@ -229,20 +259,40 @@ public:
 
     enum { APPEND = O_APPEND };
 
-    OutFile (int fid) : fid_(fid)
+    OutFile (int fid) : fid_(fid), string_(nullptr)
     {
         _open();
     }
 
-    OutFile (const char * filename, int flags = 0) : filename_(filename)
+    OutFile (const char * filename, int flags = 0) :
+        filename_(filename),
+        string_(nullptr)
     {
         LOOM_ASSERT(not filename_.empty(), "empty filename is not supported");
         _open(flags);
     }
 
+    // appends a stream to buffer, e.g. for a native snapshot;
+    // a compressed buffer is a complete gzip member once this is destroyed
+    OutFile (std::string & buffer, bool compressed = false) :
+        filename_("<memory>"),
+        fid_(-1),
+        is_file_(false),
+        file_(nullptr),
+        gzip_(nullptr),
+        string_(new google::protobuf::io::StringOutputStream(& buffer)),
+        stream_(string_)
+    {
+        if (compressed) {
+            gzip_ = new google::protobuf::io::GzipOutputStream(string_);
+            stream_ = gzip_;
+        }
+    }
+
     ~OutFile ()
     {
         delete gzip_;
+        delete string_;
         delete file_;
         if (is_file()) {
             close(fid_);
@@ -282,7 +332,9 @@ public:
         if (gzip_) {
             gzip_->Flush();
         }
-        file_->Flush();
+        if (file_) {
+            file_->Flush();
+        }
     }
 
 private:
@@ -318,6 +370,7 @@ private:
     bool is_file_;
     google::protobuf::io::FileOutputStream * file_;
     google::protobuf::io::GzipOutputStream * gzip_;
+    google::protobuf::io::StringOutputStream * string_;
     google::protobuf::io::ZeroCopyOutputStream * stream_;
 };
 
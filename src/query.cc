@@ -69,9 +69,19 @@ int main (int argc, char ** argv)
     const bool load_groups = true;
     const bool load_assign = false;
     const bool load_tares = true;
-    loom::MultiLoom engine(root_in, load_groups, load_assign, load_tares);
     const auto config = loom::protobuf_load<loom::protobuf::Config>(config_in);
-    loom::QueryServer server(engine.cross_cats(), config, rows_in);
+    loom::MultiLoom engine(
+        root_in,
+        load_groups,
+        load_assign,
+        load_tares,
+        config.query().lazy(),
+        config.query().lazy_mem_bytes());
+    loom::QueryServer server(
+        engine.cross_cats(),
+        config,
+        rows_in,
+        engine.kind_loader());
     loom::rng_t rng(config.seed());
 
     server.serve(rng, requests_in, responses_out);
@@ -27,13 +27,125 @@
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <loom/query_server.hpp>
-#include <loom/compressed_vector.hpp>
 #include <loom/scorer.hpp>
 #include <loom/cat_kernel.hpp>
+#include <loom/logger.hpp>
 
 namespace loom
 {
 
+QueryServer::QueryServer (
+        const std::vector<const CrossCat *> & cross_cats,
+        const protobuf::Config & config,
+        const char * rows_in,
+        KindLoader * kind_loader) :
+    config_(config),
+    cross_cats_(cross_cats),
+    rows_in_(rows_in),
+    latent_kinds_(),
+    frozen_mixtures_(),
+    kind_loader_(kind_loader),
+    row_cache_(),
+    row_cache_loaded_(false),
+    result_cache_(config.query().cache_size()),
+    generation_(0),
+    cache_hits_(0),
+    cache_misses_(0)
+{
+    LOOM_ASSERT(not cross_cats_.empty(), "no cross cats found");
+    LOOM_ASSERT(
+        not (kind_loader_ and config_.query().frozen()),
+        "lazy loading is incompatible with frozen tables");
+
+    const size_t latent_count = cross_cats_.size();
+    for (size_t l = 0; l < latent_count; ++l) {
+        const size_t kind_count = cross_cats_[l]->kinds.size();
+        for (size_t k = 0; k < kind_count; ++k) {
+            latent_kinds_.push_back(std::make_pair(l, k));
+        }
+    }
+
+    if (config_.query().frozen()) {
+        frozen_mixtures_.resize(latent_count);
+        for (size_t l = 0; l < latent_count; ++l) {
+            const size_t kind_count = cross_cats_[l]->kinds.size();
+            frozen_mixtures_[l].resize(kind_count, nullptr);
+        }
+
+        const size_t task_count = latent_kinds_.size();
+        const uint64_t seed = config_.seed();
+        #pragma omp parallel for schedule(dynamic, 1) \
+            if(config_.query().parallel())
+        for (size_t i = 0; i < task_count; ++i) {
+            const size_t l = latent_kinds_[i].first;
+            const size_t k = latent_kinds_[i].second;
+            const auto & kind = cross_cats_[l]->kinds[k];
+            rng_t rng(seed + i);
+            frozen_mixtures_[l][k] =
+                new FrozenMixture(kind.model, kind.mixture, rng);
+        }
+
+        size_t table_bytes = 0;
+        for (const auto & frozen_mixtures : frozen_mixtures_) {
+            for (const auto * frozen_mixture : frozen_mixtures) {
+                table_bytes += frozen_mixture->table_bytes();
+            }
+        }
+        logger([&](Logger::Message & message){
+            message.mutable_query()->set_frozen_table_bytes(table_bytes);
+        });
+    }
+}
+
+QueryServer::~QueryServer ()
+{
+    for (const auto & frozen_mixtures : frozen_mixtures_) {
+        for (const auto * frozen_mixture : frozen_mixtures) {
+            delete frozen_mixture;
+        }
+    }
+}
+
+inline void QueryServer::score_value (
+        size_t latentid,
+        size_t kindid,
+        const ProductValue & value,
+        VectorFloat & scores,
+        rng_t & rng,
+        bool frozen) const
+{
+    const auto & kind = cross_cats_[latentid]->kinds[kindid];
+    if (not frozen) {
+        kind.mixture.score_value(kind.model, value, scores, rng);
+    } else {
+        frozen_mixtures_[latentid][kindid]->score_value(
+            kind.model,
+            value,
+            scores,
+            rng);
+    }
+}
+
+inline void QueryServer::score_diff (
+        size_t latentid,
+        size_t kindid,
+        const ProductValue::Diff & diff,
+        VectorFloat & scores,
+        rng_t & rng,
+        bool frozen) const
+{
+    const auto & kind = cross_cats_[latentid]->kinds[kindid];
+    if (not frozen) {
+        kind.mixture.score_diff(kind.model, diff, scores, rng);
+    } else {
+        frozen_mixtures_[latentid][kindid]->score_diff(
+            kind.model,
+            diff,
+            scores,
+            rng);
+    }
+}
+
 void QueryServer::serve (
         rng_t & rng,
         const char * requests_in,
@@ -50,20 +162,206 @@ void QueryServer::serve (
         response.set_id(request.id());
         Errors & errors = * response.mutable_error();
         if (request.has_sample() and validate(request.sample(), errors)) {
-            call(rng, request.sample(), * response.mutable_sample());
+            cached_call(rng, request.sample(), * response.mutable_sample());
+        }
+        if (request.has_batch_sample() and
+            validate(request.batch_sample(), errors))
+        {
+            load_kinds(request.batch_sample());
+            call(
+                rng,
+                request.batch_sample(),
+                * response.mutable_batch_sample());
         }
         if (request.has_score() and validate(request.score(), errors)) {
-            call(rng, request.score(), * response.mutable_score());
+            cached_call(rng, request.score(), * response.mutable_score());
         }
         if (request.has_entropy() and validate(request.entropy(), errors)) {
-            call(rng, request.entropy(), * response.mutable_entropy());
+            cached_call(rng, request.entropy(), * response.mutable_entropy());
         }
         if (request.has_score_derivative() and validate(request.score_derivative(), errors)) {
+            load_kinds(request.score_derivative());
             call(rng, request.score_derivative(), * response.mutable_score_derivative());
+            invalidate_cache();
+        }
+        if (request.has_mutual_information_matrix() and
+            validate(request.mutual_information_matrix(), errors))
+        {
+            load_kinds(request.mutual_information_matrix());
+            call(
+                rng,
+                request.mutual_information_matrix(),
+                * response.mutable_mutual_information_matrix());
         }
         response_stream.write_stream(response);
         response_stream.flush();
     }
+
+    if (result_cache_.capacity()) {
+        logger([&](Logger::Message & message){
+            auto & status = * message.mutable_query();
+            status.set_cache_hits(cache_hits_);
+            status.set_cache_misses(cache_misses_);
+        });
+    }
+    if (kind_loader_) {
+        logger([&](Logger::Message & message){
+            auto & status = * message.mutable_query();
+            status.set_kind_loads(kind_loader_->load_count());
+            status.set_kind_evictions(kind_loader_->evict_count());
+            status.set_resident_group_bytes(kind_loader_->resident_bytes());
+        });
+    }
+}
+
+void QueryServer::canonicalize (Query::Sample::Request & request) const
+{
+    schema().normalize_small(* request.mutable_data());
+    schema().normalize_small(* request.mutable_to_sample());
+}
+
+void QueryServer::canonicalize (Query::Score::Request & request) const
+{
+    schema().normalize_small(* request.mutable_data());
+}
+
+void QueryServer::canonicalize (Query::Entropy::Request & request) const
+{
+    for (auto & row_set : * request.mutable_row_sets()) {
+        schema().normalize_small(row_set);
+    }
+    for (auto & col_set : * request.mutable_col_sets()) {
+        schema().normalize_small(col_set);
+    }
+    schema().normalize_small(* request.mutable_conditional());
+}
+
+template<class Request, class Response>
+void QueryServer::cached_call (
+        rng_t & rng,
+        const Request & request,
+        Response & response)
+{
+    if (not result_cache_.capacity() or not cacheable(request)) {
+        load_kinds(request);
+        call(rng, request, response);
+        return;
+    }
+
+    // never freed
+    static thread_local Request * canonical = nullptr;
+    static thread_local std::string * key = nullptr;
+    construct_if_null(canonical);
+    construct_if_null(key);
+
+    * canonical = request;
+    canonicalize(* canonical);
+    * key = Request::descriptor()->full_name();
+    key->push_back('\0');
+    key->append(
+        reinterpret_cast<const char *>(& generation_),
+        sizeof(generation_));
+    canonical->AppendToString(key);
+
+    if (const std::string * cached = result_cache_.find(* key)) {
+        ++cache_hits_;
+        response.ParseFromString(* cached);
+    } else {
+        ++cache_misses_;
+        load_kinds(request);
+        call(rng, request, response);
+        result_cache_.insert(* key, response.SerializeAsString());
+    }
+}
+
+void QueryServer::invalidate_cache ()
+{
+    ++generation_;
+    result_cache_.clear();
+}
+
+// Unloaded kinds hold unobserved groups, whose normalized scores sum to
+// one, so kinds a request never touches contribute nothing either way.
+
+void QueryServer::load_kinds (const Query::Sample::Request & request)
+{
+    if (kind_loader_) {
+        FeatureSet features = to_feature_set(request.to_sample());
+        load_kinds(features, add_features(request.data(), features));
+    }
+}
+
+void QueryServer::load_kinds (const Query::BatchSample::Request & request)
+{
+    if (kind_loader_) {
+        FeatureSet features(schema().total_size());
+        bool has_tares = false;
+        for (const auto & sample_request : request.requests()) {
+            features |= to_feature_set(sample_request.to_sample());
+            has_tares |= add_features(sample_request.data(), features);
+        }
+        load_kinds(features, has_tares);
+    }
+}
+
+void QueryServer::load_kinds (const Query::Score::Request & request)
+{
+    if (kind_loader_) {
+        FeatureSet features(schema().total_size());
+        load_kinds(features, add_features(request.data(), features));
+    }
+}
+
+void QueryServer::load_kinds (const Query::Entropy::Request & request)
+{
+    if (kind_loader_) {
+        FeatureSet features(schema().total_size());
+        for (const auto & row_set : request.row_sets()) {
+            features |= to_feature_set(row_set);
+        }
+        for (const auto & col_set : request.col_sets()) {
+            features |= to_feature_set(col_set);
+        }
+        load_kinds(features, add_features(request.conditional(), features));
+    }
+}
+
+void QueryServer::load_kinds (const Query::ScoreDerivative::Request &)
+{
+    // scores every cached row and updates every kind
+    if (kind_loader_) {
+        kind_loader_->load_all();
+    }
+}
+
+void QueryServer::load_kinds (
+        const Query::MutualInformationMatrix::Request & request)
+{
+    if (kind_loader_) {
+        FeatureSet features(schema().total_size());
+        for (const auto & feature_set : request.feature_sets()) {
+            features |= to_feature_set(feature_set);
+        }
+        load_kinds(features, add_features(request.conditional(), features));
+    }
+}
+
+void QueryServer::load_kinds (const FeatureSet & features, bool has_tares)
+{
+    if (has_tares) {
+        kind_loader_->load_all();
+    } else {
+        kind_loader_->load(features);
+    }
+}
+
+bool QueryServer::add_features (
+        const ProductValue::Diff & diff,
+        FeatureSet & features) const
+{
+    features |= to_feature_set(diff.pos().observed());
+    features |= to_feature_set(diff.neg().observed());
+    return diff.tares_size();
 }
 
 bool QueryServer::validate (
@@ -88,46 +386,125 @@ bool QueryServer::validate (
     return true;
 }
 
+struct QueryServer::SampleScratch
+{
+    std::vector<std::vector<ProductValue::Diff>> conditional_diffs;
+    std::vector<std::vector<VectorFloat>> latent_kind_scores;
+    VectorFloat kind_totals;
+    VectorFloat latent_scores;
+    std::vector<size_t> latent_counts;
+    ProductValue::Diff blank;
+    std::vector<std::vector<ProductValue::Diff>> result_diffs;
+    std::vector<std::vector<ProductValue::Diff>> latent_samples;
+};
+
 void QueryServer::call (
         rng_t & rng,
         const Query::Sample::Request & request,
         Query::Sample::Response & response) const
 {
+    const bool parallel = config_.query().parallel();
+    if (request.has_seed()) {
+        rng_t seeded_rng(request.seed());
+        sample(seeded_rng, request, response, parallel);
+    } else {
+        sample(rng, request, response, parallel);
+    }
+}
+
+bool QueryServer::validate (
+        const Query::BatchSample::Request & request,
+        Errors & errors) const
+{
+    for (const auto & sample_request : request.requests()) {
+        if (not validate(sample_request, errors)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void QueryServer::call (
+        rng_t & rng,
+        const Query::BatchSample::Request & request,
+        Query::BatchSample::Response & response) const
+{
+    const size_t request_count = request.requests_size();
+    for (size_t i = 0; i < request_count; ++i) {
+        response.add_responses();
+    }
+
+    // parallelize across requests rather than within each request
+    const uint64_t seed = rng();
+    #pragma omp parallel for schedule(dynamic, 1) if(config_.query().parallel())
+    for (size_t i = 0; i < request_count; ++i) {
+        const auto & sample_request = request.requests(i);
+        rng_t request_rng(
+            sample_request.has_seed() ? sample_request.seed() : seed + i);
+        sample(
+            request_rng,
+            sample_request,
+            * response.mutable_responses(i),
+            false);
+    }
+}
+
+void QueryServer::sample (
+        rng_t & rng,
+        const Query::Sample::Request & request,
+        Query::Sample::Response & response,
+        bool parallel) const
+{
+    // never freed
+    static thread_local SampleScratch * scratch = nullptr;
+    construct_if_null(scratch);
+
     const size_t latent_count = cross_cats_.size();
-    std::vector<std::vector<VectorFloat>> latent_kind_scores(latent_count);
-    VectorFloat latent_scores(latent_count, 0.f);
-    {
-        std::vector<ProductValue::Diff> conditional_diffs;
-        for (size_t l = 0; l < latent_count; ++l) {
-            const auto & cross_cat = * cross_cats_[l];
-            auto & kind_scores = latent_kind_scores[l];
-            cross_cat.splitter.split(request.data(), conditional_diffs);
+    const size_t task_count = latent_kinds_.size();
 
-            const size_t kind_count = cross_cat.kinds.size();
-            kind_scores.resize(kind_count);
-            for (size_t k = 0; k < kind_count; ++k) {
-                const ProductValue::Diff & diff = conditional_diffs[k];
-                auto & kind = cross_cat.kinds[k];
-                const ProductModel & model = kind.model;
-                auto & mixture = kind.mixture;
-                auto & scores = kind_scores[k];
-
-                if (diff.tares_size()) {
-                    mixture.score_diff(model, diff, scores, rng);
-                } else {
-                    mixture.score_value(model, diff.pos(), scores, rng);
-                }
+    auto & conditional_diffs = scratch->conditional_diffs;
+    auto & latent_kind_scores = scratch->latent_kind_scores;
+    conditional_diffs.resize(latent_count);
+    latent_kind_scores.resize(latent_count);
+    for (size_t l = 0; l < latent_count; ++l) {
+        const auto & cross_cat = * cross_cats_[l];
+        cross_cat.splitter.split(request.data(), conditional_diffs[l]);
+        latent_kind_scores[l].resize(cross_cat.kinds.size());
+    }
 
-                latent_scores[l] += distributions::log_sum_exp(scores);
-                distributions::scores_to_probs(scores);
-            }
+    // score each (latent, kind) pair in parallel
+    VectorFloat & kind_totals = scratch->kind_totals;
+    kind_totals.resize(task_count);
+    const uint64_t score_seed = rng();
+    #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+    for (size_t i = 0; i < task_count; ++i) {
+        const size_t l = latent_kinds_[i].first;
+        const size_t k = latent_kinds_[i].second;
+        const ProductValue::Diff & diff = conditional_diffs[l][k];
+        auto & scores = latent_kind_scores[l][k];
+        rng_t task_rng(score_seed + i);
+
+        if (diff.tares_size()) {
+            score_diff(l, k, diff, scores, task_rng, frozen());
+        } else {
+            score_value(l, k, diff.pos(), scores, task_rng, frozen());
         }
 
-        distributions::scores_to_probs(latent_scores);
+        kind_totals[i] = distributions::log_sum_exp(scores);
+        distributions::scores_to_probs(scores);
+    }
+
+    VectorFloat & latent_scores = scratch->latent_scores;
+    latent_scores.assign(latent_count, 0.f);
+    for (size_t i = 0; i < task_count; ++i) {
+        latent_scores[latent_kinds_[i].first] += kind_totals[i];
     }
+    distributions::scores_to_probs(latent_scores);
 
     const size_t sample_count = request.sample_count();
-    std::vector<size_t> latent_counts(latent_count, 0);
+    std::vector<size_t> & latent_counts = scratch->latent_counts;
+    latent_counts.assign(latent_count, 0);
     for (size_t s = 0; s < sample_count; ++s) {
         size_t l = distributions::sample_discrete(
             rng,
@@ -136,20 +513,32 @@ void QueryServer::call (
         ++latent_counts[l];
     }
 
-    ProductValue::Diff blank;
+    ProductValue::Diff & blank = scratch->blank;
     schema().clear(blank);
     * blank.mutable_pos()->mutable_observed() = request.to_sample();
     schema().fill_data_with_zeros(* blank.mutable_pos());
 
-    std::vector<ProductValue::Diff> result_diffs;
+    // sample each latent in parallel, then concatenate in latent order
+    auto & latent_samples = scratch->latent_samples;
+    auto & latent_result_diffs = scratch->result_diffs;
+    latent_samples.resize(latent_count);
+    latent_result_diffs.resize(latent_count);
+    const uint64_t sample_seed = rng();
+    #pragma omp parallel for schedule(dynamic, 1) if(parallel)
     for (size_t l = 0; l < latent_count; ++l) {
         const auto & cross_cat = * cross_cats_[l];
-        auto & kind_scores = latent_kind_scores[l];
+        const auto & kind_scores = latent_kind_scores[l];
+        auto & samples = latent_samples[l];
+        samples.resize(latent_counts[l]);
+        rng_t latent_rng(sample_seed + l);
 
-        for (size_t s = 0; s < latent_counts[l]; ++s) {
-            cross_cat.splitter.split(blank, result_diffs);
+        // sample_value overwrites all observed fields, so one split of
+        // the blank diff is shared by every sample of this latent
+        auto & result_diffs = latent_result_diffs[l];
+        cross_cat.splitter.split(blank, result_diffs);
 
-            const size_t kind_count = cross_cat.kinds.size();
+        const size_t kind_count = cross_cat.kinds.size();
+        for (auto & sample : samples) {
             for (size_t k = 0; k < kind_count; ++k) {
                 if (cross_cat.schema.observed_count(
                     result_diffs[k].pos().observed()))
@@ -160,14 +549,19 @@ void QueryServer::call (
                     auto & probs = kind_scores[k];
 
                     ProductValue & value = * result_diffs[k].mutable_pos();
-                    mixture.sample_value(model, probs, value, rng);
+                    mixture.sample_value(model, probs, value, latent_rng);
                 }
             }
 
-            auto & sample = * response.add_samples();
             cross_cat.splitter.join(sample, result_diffs);
         }
     }
+
+    for (auto & samples : latent_samples) {
+        for (auto & sample : samples) {
+            response.add_samples()->Swap(& sample);
+        }
+    }
 }
 
 bool QueryServer::validate (
@@ -192,43 +586,68 @@ void QueryServer::call (
         rng_t & rng,
         const Query::Score::Request & request,
         Query::Score::Response & response) const
+{
+    response.set_score(score(rng, request.data(), frozen()));
+}
+
+float QueryServer::score (
+        rng_t & rng,
+        const ProductValue::Diff & data,
+        bool frozen) const
 {
     // not freed
-    static thread_local std::vector<ProductValue::Diff> *
-    partial_diffs = nullptr;
-    static thread_local VectorFloat * scores = nullptr;
-    construct_if_null(partial_diffs);
-    construct_if_null(scores);
+    static thread_local std::vector<std::vector<ProductValue::Diff>> *
+    latent_diffs = nullptr;
+    static thread_local VectorFloat * kind_totals = nullptr;
+    construct_if_null(latent_diffs);
+    construct_if_null(kind_totals);
 
-    const auto NONE = ProductValue::Observed::NONE;
-    VectorFloat latent_scores(cross_cats_.size(), 0.f);
     const size_t latent_count = cross_cats_.size();
+    const size_t task_count = latent_kinds_.size();
+    auto & partial_diffs = * latent_diffs;
+    partial_diffs.resize(latent_count);
     for (size_t l = 0; l < latent_count; ++l) {
-        const auto & cross_cat = * cross_cats_[l];
-        float & score = latent_scores[l];
-
-        cross_cat.splitter.split(request.data(), *partial_diffs);
-
-        const size_t kind_count = cross_cat.kinds.size();
-        for (size_t k = 0; k < kind_count; ++k) {
-            ProductValue::Diff & diff = (*partial_diffs)[k];
-            cross_cat.splitter.schema(k).normalize_small(diff);
-            auto & kind = cross_cat.kinds[k];
-            const ProductModel & model = kind.model;
-            auto & mixture = kind.mixture;
+        cross_cats_[l]->splitter.split(data, partial_diffs[l]);
+    }
+    kind_totals->resize(task_count);
+    float * totals = kind_totals->data();
 
+    // score each (latent, kind) pair in parallel;
+    // this is serialized when called from within a parallel region
+    const auto NONE = ProductValue::Observed::NONE;
+    const uint64_t seed = rng();
+    #pragma omp parallel if(config_.query().parallel())
+    {
+        // not freed
+        static thread_local VectorFloat * scores = nullptr;
+        construct_if_null(scores);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t i = 0; i < task_count; ++i) {
+            const size_t l = latent_kinds_[i].first;
+            const size_t k = latent_kinds_[i].second;
+            ProductValue::Diff & diff = partial_diffs[l][k];
+            rng_t task_rng(seed + i);
+            cross_cats_[l]->splitter.schema(k).normalize_small(diff);
+
+            float total = 0;
             if (diff.tares_size()) {
-                mixture.score_diff(model, diff, *scores, rng);
-                score += distributions::log_sum_exp(*scores);
+                score_diff(l, k, diff, *scores, task_rng, frozen);
+                total = distributions::log_sum_exp(*scores);
             } else if (diff.pos().observed().sparsity() != NONE) {
-                mixture.score_value(model, diff.pos(), *scores, rng);
-                score += distributions::log_sum_exp(*scores);
+                score_value(l, k, diff.pos(), *scores, task_rng, frozen);
+                total = distributions::log_sum_exp(*scores);
             }
+            totals[i] = total;
         }
     }
-    float score = distributions::log_sum_exp(latent_scores)
-                - distributions::fast_log(latent_count);
-    response.set_score(score);
+
+    VectorFloat latent_scores(latent_count, 0.f);
+    for (size_t i = 0; i < task_count; ++i) {
+        latent_scores[latent_kinds_[i].first] += totals[i];
+    }
+    return distributions::log_sum_exp(latent_scores)
+         - distributions::fast_log(latent_count);
 }
 
 bool QueryServer::validate (
@@ -265,145 +684,220 @@ bool QueryServer::validate (
     return true;
 }
 
-namespace
+// Welford's running mean and variance, mergeable across threads
+class QueryServer::Accum
 {
-class Accum
-{
-    typedef distributions::NormalInverseChiSq::Shared Shared;
-    typedef distributions::NormalInverseChiSq::Group Group;
-
-    Group group_;
+    size_t count_;
+    double mean_;
+    double m2_;
 
 public:
 
-    Accum ()
+    Accum () : count_(0), mean_(0), m2_(0) {}
+
+    void add (double x)
     {
-        static rng_t rng;
-        static Shared shared;
-        group_.init(shared, rng);
+        ++count_;
+        const double delta = x - mean_;
+        mean_ += delta / count_;
+        m2_ += delta * (x - mean_);
     }
 
-    void add (float x)
+    void merge (const Accum & other)
     {
-        static rng_t rng;
-        static Shared shared;
-        group_.add_value(shared, x, rng);
+        if (other.count_ == 0) {
+            return;
+        }
+        if (count_ == 0) {
+            * this = other;
+            return;
+        }
+        const double count = count_ + other.count_;
+        const double delta = other.mean_ - mean_;
+        mean_ += delta * (other.count_ / count);
+        m2_ += other.m2_ + delta * delta * (count_ * (other.count_ / count));
+        count_ += other.count_;
     }
 
     float mean () const
     {
-        return group_.mean;
+        return mean_;
     }
 
     float variance () const
     {
-        return group_.count_times_variance / (group_.count - 1);
+        return m2_ / (count_ - 1);
     }
 };
-} // anonymous namespace
 
-void QueryServer::call (
+FeatureSet QueryServer::to_feature_set (
+        const ProductValue::Observed & observed) const
+{
+    FeatureSet result(schema().total_size());
+    schema().for_each(observed, [&](size_t i){
+        result.add(i);
+    });
+    return result;
+}
+
+template<class Fun>
+void QueryServer::estimate (
         rng_t & rng,
-        const Query::Entropy::Request & request,
-        Query::Entropy::Response & response) const
+        const ProductValue::Diff & conditional,
+        const ProductValue::Observed & to_sample,
+        size_t sample_count,
+        const Tasks & tasks,
+        const Fun & fun,
+        std::vector<Accum> & accums) const
 {
     Query::Sample::Request sample_request;
     Query::Sample::Response sample_response;
     Errors errors;
-
-    * sample_request.mutable_data() = request.conditional();
-    sample_request.set_sample_count(request.sample_count());
-    auto & to_sample = * sample_request.mutable_to_sample();
-    schema().clear(to_sample);
-    schema().normalize_dense(to_sample);
-    for (const auto & feature_set : request.row_sets()) {
-        schema().for_each(feature_set, [&](int i){
-            to_sample.set_dense(i, true);
-        });
-    }
-    for (const auto & feature_set : request.col_sets()) {
-        schema().for_each(feature_set, [&](int i){
-            to_sample.set_dense(i, true);
-        });
-    }
+    * sample_request.mutable_data() = conditional;
+    * sample_request.mutable_to_sample() = to_sample;
+    sample_request.set_sample_count(sample_count);
     LOOM_ASSERT1(validate(sample_request, errors), errors);
     call(rng, sample_request, sample_response);
 
     Query::Score::Request score_request;
-    Query::Score::Response score_response;
-    * score_request.mutable_data() = request.conditional();
+    * score_request.mutable_data() = conditional;
     LOOM_ASSERT1(validate(score_request, errors), errors);
-    call(rng, score_request, score_response);
-    const float base_score = score_response.score();
+    const float base_score = score(rng, conditional, frozen());
 
-    const size_t row_count = request.row_sets_size();
-    const size_t col_count = request.col_sets_size();
-    const size_t cell_count = row_count * col_count;
     const size_t latent_count = cross_cats_.size();
-
     std::vector<RestrictionScorer *> scorers(latent_count, nullptr);
     for (size_t l = 0; l < latent_count; ++l) {
-        scorers[l] = new RestrictionScorer(
-            *cross_cats_[l],
-            request.conditional(),
-            rng);
+        scorers[l] = new RestrictionScorer(*cross_cats_[l], conditional, rng);
     }
     const float score_shift =
         distributions::fast_log(latent_count) + base_score;
 
-    CompressedVector<ProductValue::Observed> tasks;
-    ProductValue::Observed union_set;
-    for (size_t i = 0; i < row_count; ++i) {
-        ProductValue::Observed row_set = request.row_sets(i);
-        schema().normalize_dense(row_set);
-        for (size_t j = 0; j < col_count; ++j) {
-            union_set = row_set;
-            schema().for_each(request.col_sets(j), [&](size_t f){
-                union_set.set_dense(f, true);
-            });
-            schema().normalize_small(union_set);
-            tasks.push_back(union_set);
-        }
-    }
-    tasks.init_index();
-
     const size_t task_count = tasks.unique_count();
     for (size_t t = 0; t < task_count; ++t) {
-        tasks.unique_value(t, union_set);
+        const FeatureSet & restriction = tasks.unique_value(t);
         for (size_t l = 0; l < latent_count; ++l) {
-            scorers[l]->add_restriction(union_set);
+            scorers[l]->add_restriction(restriction);
         }
     }
 
-    std::vector<Accum> accums(task_count);
+    // Scores are computed a block of samples at a time into a buffer of
+    // [sample][task][latent] scores, so that threads only synchronize
+    // between blocks.  Each thread accumulates its own share of outputs.
+    const size_t output_count = accums.size();
+    const size_t max_buffer_size = 1UL << 24;
+    const size_t block_size = std::max<size_t>(1, std::min<size_t>(
+        sample_count,
+        max_buffer_size / (task_count * latent_count + 1)));
+    std::vector<float> latent_scores(block_size * task_count * latent_count);
+    std::vector<float> task_scores(block_size * task_count);
+    std::vector<rng_t> latent_rngs;
+    const uint64_t seed = rng();
+    for (size_t l = 0; l < latent_count; ++l) {
+        latent_rngs.push_back(rng_t(seed + l));
+    }
+
     #pragma omp parallel if(config_.query().parallel())
     {
+        std::vector<Accum> thread_accums(output_count);
         VectorFloat scores(latent_count);
-        for (const auto & sample : sample_response.samples()) {
 
-            #pragma omp barrier
-            #pragma omp for
+        for (size_t begin = 0; begin < sample_count; begin += block_size) {
+            const size_t end = std::min(sample_count, begin + block_size);
+
+            #pragma omp for schedule(dynamic, 1)
             for (size_t l = 0; l < latent_count; ++l) {
-                scorers[l]->set_value(sample.pos(), rng);
+                auto & scorer = * scorers[l];
+                for (size_t s = begin; s < end; ++s) {
+                    const auto & sample = sample_response.samples(s);
+                    scorer.set_value(sample.pos(), latent_rngs[l]);
+                    float * out = latent_scores.data()
+                                + (s - begin) * task_count * latent_count
+                                + l;
+                    for (size_t t = 0; t < task_count; ++t) {
+                        out[t * latent_count] = scorer.get_score(t);
+                    }
+                }
             }
 
-            #pragma omp barrier
-            #pragma omp for
+            #pragma omp for schedule(static)
             for (size_t t = 0; t < task_count; ++t) {
-                for (size_t l = 0; l < latent_count; ++l) {
-                    scores[l] = scorers[l]->get_score(t);
+                for (size_t s = 0; s < end - begin; ++s) {
+                    const float * in = latent_scores.data()
+                                     + (s * task_count + t) * latent_count;
+                    std::copy(in, in + latent_count, scores.begin());
+                    task_scores[s * task_count + t] =
+                        score_shift - distributions::log_sum_exp(scores);
                 }
-                float score = score_shift - distributions::log_sum_exp(scores);
+            }
 
-                // FIXME this should be atomic
-                accums[t].add(score);
+            #pragma omp for schedule(static)
+            for (size_t o = 0; o < output_count; ++o) {
+                auto & accum = thread_accums[o];
+                for (size_t s = 0; s < end - begin; ++s) {
+                    accum.add(fun(o, task_scores.data() + s * task_count));
+                }
             }
         }
+
+        #pragma omp critical
+        for (size_t o = 0; o < output_count; ++o) {
+            accums[o].merge(thread_accums[o]);
+        }
     }
 
     for (auto scorer : scorers) {
         delete scorer;
     }
+}
+
+void QueryServer::call (
+        rng_t & rng,
+        const Query::Entropy::Request & request,
+        Query::Entropy::Response & response) const
+{
+    ProductValue::Observed to_sample;
+    schema().clear(to_sample);
+    schema().normalize_dense(to_sample);
+    for (const auto & feature_set : request.row_sets()) {
+        schema().for_each(feature_set, [&](int i){
+            to_sample.set_dense(i, true);
+        });
+    }
+    for (const auto & feature_set : request.col_sets()) {
+        schema().for_each(feature_set, [&](int i){
+            to_sample.set_dense(i, true);
+        });
+    }
+
+    const size_t row_count = request.row_sets_size();
+    const size_t col_count = request.col_sets_size();
+    const size_t cell_count = row_count * col_count;
+
+    std::vector<FeatureSet> col_sets;
+    for (const auto & col_set : request.col_sets()) {
+        col_sets.push_back(to_feature_set(col_set));
+    }
+    Tasks tasks;
+    for (const auto & row_set : request.row_sets()) {
+        const FeatureSet row_features = to_feature_set(row_set);
+        for (const auto & col_features : col_sets) {
+            FeatureSet union_set = row_features;
+            union_set |= col_features;
+            tasks.push_back(union_set);
+        }
+    }
+    tasks.init_index();
+
+    std::vector<Accum> accums(tasks.unique_count());
+    estimate(
+        rng,
+        request.conditional(),
+        to_sample,
+        request.sample_count(),
+        tasks,
+        [](size_t t, const float * task_scores){ return task_scores[t]; },
+        accums);
+
     for (size_t i = 0; i < cell_count; ++i) {
         const Accum & accum = accums[tasks.unique_id(i)];
         response.add_means(accum.mean());
@@ -411,6 +905,104 @@ void QueryServer::call (
     }
 }
 
+bool QueryServer::validate (
+        const Query::MutualInformationMatrix::Request & request,
+        Errors & errors) const
+{
+    if (not schema().is_valid(request.conditional())) {
+        * errors.Add() =
+            "invalid request.mutual_information_matrix.conditional";
+        return false;
+    }
+    for (auto id : request.conditional().tares()) {
+        if (id >= tares().size()) {
+            * errors.Add() =
+                "invalid request.mutual_information_matrix.conditional.tares";
+            return false;
+        }
+    }
+    for (const auto & feature_set : request.feature_sets()) {
+        if (not schema().is_valid(feature_set)) {
+            * errors.Add() =
+                "invalid request.mutual_information_matrix.feature_sets";
+            return false;
+        }
+    }
+    if (request.sample_count() <= 1) {
+        * errors.Add() =
+            "invalid request.mutual_information_matrix.sample_count";
+        return false;
+    }
+
+    return true;
+}
+
+void QueryServer::call (
+        rng_t & rng,
+        const Query::MutualInformationMatrix::Request & request,
+        Query::MutualInformationMatrix::Response & response) const
+{
+    ProductValue::Observed to_sample;
+    schema().clear(to_sample);
+    schema().normalize_dense(to_sample);
+    for (const auto & feature_set : request.feature_sets()) {
+        schema().for_each(feature_set, [&](int i){
+            to_sample.set_dense(i, true);
+        });
+    }
+
+    // tasks are the single sets followed by all pairwise unions;
+    // duplicates are scored only once
+    const size_t set_count = request.feature_sets_size();
+    Tasks tasks;
+    std::vector<FeatureSet> sets;
+    for (const auto & feature_set : request.feature_sets()) {
+        sets.push_back(to_feature_set(feature_set));
+        tasks.push_back(sets.back());
+    }
+    for (size_t i = 0; i < set_count; ++i) {
+        for (size_t j = 0; j < set_count; ++j) {
+            FeatureSet union_set = sets[i];
+            union_set |= sets[j];
+            tasks.push_back(union_set);
+        }
+    }
+    tasks.init_index();
+
+    // each sample contributes H(i) + H(j) - H(i,j) to cell (i, j)
+    const size_t cell_count = set_count * set_count;
+    std::vector<uint32_t> single_ids(set_count);
+    std::vector<uint32_t> union_ids(cell_count);
+    for (size_t i = 0; i < set_count; ++i) {
+        single_ids[i] = tasks.unique_id(i);
+    }
+    for (size_t c = 0; c < cell_count; ++c) {
+        union_ids[c] = tasks.unique_id(set_count + c);
+    }
+    auto fun = [&](size_t c, const float * task_scores){
+        const size_t i = c / set_count;
+        const size_t j = c % set_count;
+        return task_scores[single_ids[i]]
+             + task_scores[single_ids[j]]
+             - task_scores[union_ids[c]];
+    };
+
+    std::vector<Accum> accums(cell_count);
+    estimate(
+        rng,
+        request.conditional(),
+        to_sample,
+        request.sample_count(),
+        tasks,
+        fun,
+        accums);
+
+    for (const auto & accum : accums) {
+        response.add_means(accum.mean());
+        response.add_variances(accum.variance() / request.sample_count());
+    }
+}
+
 bool QueryServer::validate (
         const Query::ScoreDerivative::Request & request,
         Errors & errors) const
@@ -441,6 +1033,20 @@ bool QueryServer::validate (
     return true;
 }
 
+const std::vector<protobuf::Row> & QueryServer::cached_rows () const
+{
+    if (not row_cache_loaded_) {
+        protobuf::InFile rows(rows_in_);
+        protobuf::Row row;
+        while (rows.try_read_stream(row)) {
+            row_cache_.push_back(row);
+        }
+        row_cache_.shrink_to_fit();
+        row_cache_loaded_ = true;
+    }
+    return row_cache_;
+}
+
 // not threadsafe
 void QueryServer::call (
         rng_t & rng,
@@ -448,100 +1054,95 @@ void QueryServer::call (
         Query::ScoreDerivative::Response & response) const
 {
     const size_t latent_count = cross_cats_.size();
-
-    Query::Score::Request score_request;
-    Query::Score::Response score_response;
-
-    protobuf::Assignment assignment;
-    protobuf::Row row;
-
-    std::vector<protobuf::Assignment> assignments;
-    std::vector<CatKernel *> cat_kernels;
+    const bool parallel = config_.query().parallel();
+
+    typedef std::pair<uint64_t, const ProductValue::Diff *> Target;
+    std::vector<Target> targets;
+    if (request.score_data_size() == 0) {
+        for (const auto & row : cached_rows()) {
+            const size_t count = protobuf::row_multiplicity(row);
+            for (size_t c = 0; c < count; ++c) {
+                const uint64_t id = protobuf::row_id(row, c);
+                targets.push_back(Target(id, & row.diff()));
+            }
+        }
+    } else {
+        for (size_t i = 0; i < request.score_data_size(); ++i) {
+            targets.push_back(Target(i, & request.score_data(i)));
+        }
+    }
+    const size_t target_count = targets.size();
+
+    // every row is assigned in every kind, so the model knows the row count
+    LOOM_ASSERT(not cross_cats_[0]->kinds.empty(), "no kinds found");
+    const size_t row_count = cross_cats_[0]->kinds[0].mixture.count_rows();
+
+    // frozen tables are bypassed, since the models change below
+    std::vector<float> score_diffs(target_count, 0.f);
+    auto add_scores = [&](float sign){
+        const uint64_t seed = rng();
+        #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+        for (size_t i = 0; i < target_count; ++i) {
+            const auto & data = * targets[i].second;
+            rng_t target_rng(seed + i);
+            score_diffs[i] += sign * score(target_rng, data, false);
+        }
+    };
 
     protobuf::Row update_row;
     update_row.set_id(0);
     * update_row.mutable_diff() = request.update_data();
-
-
-    //FIXME is there a better way to get the row count?
-    size_t row_count = 0;
-    protobuf::InFile all_rows(rows_in_);
-    while (all_rows.try_read_stream(row)) {
-        row_count++;
-    }
-
+    std::vector<protobuf::Assignment> assignments(latent_count);
+    std::vector<CatKernel *> cat_kernels;
     for (const auto * cross_cat : cross_cats_) {
         cat_kernels.push_back(
             new CatKernel(
                 config_.kernels().cat(),
                 * const_cast<CrossCat*>(cross_cat)));
-        assignments.push_back(assignment);
     }
 
-    typedef std::pair<int, float> ScoreDiff;
-    std::vector<ScoreDiff> score_diffs;
-
-    {
-        if (request.score_data_size() == 0) {
-            protobuf::InFile all_rows(rows_in_);
-            while (all_rows.try_read_stream(row)) {
-                * score_request.mutable_data() = row.diff();
-                call(rng, score_request, score_response);
-                score_diffs.push_back(
-                    std::make_pair(row.id(), -score_response.score()));
-            }
-        }
-        else {
-            for (size_t i = 0; i < request.score_data_size(); i++) {
-                * score_request.mutable_data() = request.score_data(i);
-                call(rng, score_request, score_response);
-                score_diffs.push_back(
-                    std::make_pair(i, -score_response.score()));
-            }
-        }
-    }
+    add_scores(-1.f);
 
-    for (size_t i = 0; i < latent_count; ++i){
-        cat_kernels[i]->add_row(rng, update_row, assignments[i]);
+    const uint64_t add_seed = rng();
+    #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+    for (size_t l = 0; l < latent_count; ++l) {
+        rng_t latent_rng(add_seed + l);
+        cat_kernels[l]->add_row(latent_rng, update_row, assignments[l]);
     }
 
-    {
-        int i = 0;
-        if (request.score_data_size() == 0) {
-            protobuf::InFile all_rows(rows_in_);
-            while (all_rows.try_read_stream(row)) {
-                * score_request.mutable_data() = row.diff();
-                call(rng, score_request, score_response);
-                score_diffs[i].second += score_response.score();
-                score_diffs[i].second *= row_count;
-                i++;
-            }
-        }
-        else {
-            for (size_t i = 0; i < request.score_data_size(); i++) {
-                * score_request.mutable_data() = request.score_data(i);
-                call(rng, score_request, score_response);
-                score_diffs[i].second += score_response.score();
-                score_diffs[i].second *= row_count;
-                i++;
-            }
-        }
-    }
+    add_scores(+1.f);
 
-    for (size_t i = 0; i < latent_count; ++i) {
-        cat_kernels[i]->remove_row(rng, update_row, assignments[i]);
-        delete cat_kernels[i];
+    const uint64_t remove_seed = rng();
+    #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+    for (size_t l = 0; l < latent_count; ++l) {
+        rng_t latent_rng(remove_seed + l);
+        cat_kernels[l]->remove_row(latent_rng, update_row, assignments[l]);
+        delete cat_kernels[l];
     }
 
-    std::sort(score_diffs.begin(), score_diffs.end(),
-            [](const ScoreDiff & a, const ScoreDiff & b) {
-                return a.second > b.second;
-            });
-    if (score_diffs.size() > request.row_limit()) {
-        score_diffs.resize(request.row_limit());
+    // keep the row_limit largest score diffs in a min-heap
+    typedef std::pair<uint64_t, float> ScoreDiff;
+    const auto greater = [](const ScoreDiff & a, const ScoreDiff & b) {
+        return a.second > b.second;
+    };
+    const size_t row_limit = request.row_limit();
+    std::vector<ScoreDiff> top;
+    top.reserve(std::min(row_limit, target_count));
+    for (size_t i = 0; i < target_count; ++i) {
+        const float score = score_diffs[i] * row_count;
+        const ScoreDiff score_diff(targets[i].first, score);
+        if (top.size() < row_limit) {
+            top.push_back(score_diff);
+            std::push_heap(top.begin(), top.end(), greater);
+        } else if (row_limit and greater(score_diff, top.front())) {
+            std::pop_heap(top.begin(), top.end(), greater);
+            top.back() = score_diff;
+            std::push_heap(top.begin(), top.end(), greater);
+        }
     }
+    std::sort_heap(top.begin(), top.end(), greater);
 
-    for (const auto & score_diff : score_diffs) {
+    for (const auto & score_diff : top) {
         response.add_ids(score_diff.first);
         response.add_score_diffs(score_diff.second);
     }
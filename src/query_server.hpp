@@ -30,11 +30,16 @@
 
 #include <loom/timer.hpp>
 #include <loom/cross_cat.hpp>
+#include <loom/frozen_mixture.hpp>
+#include <loom/feature_set.hpp>
+#include <loom/compressed_vector.hpp>
+#include <loom/lru_cache.hpp>
+#include <loom/kind_loader.hpp>
 
 namespace loom
 {
 
-class QueryServer
+class QueryServer : noncopyable
 {
 public:
 
@@ -44,13 +49,10 @@ public:
     QueryServer (
             const std::vector<const CrossCat *> & cross_cats,
             const protobuf::Config & config,
-            const char * rows_in) :
-        config_(config),
-        cross_cats_(cross_cats),
-        rows_in_(rows_in)
-    {
-        LOOM_ASSERT(not cross_cats_.empty(), "no cross cats found");
-    }
+            const char * rows_in,
+            KindLoader * kind_loader = nullptr);
+
+    ~QueryServer ();
 
     void serve (
             rng_t & rng,
@@ -65,10 +67,86 @@ private:
         return cross_cats_[0]->tares;
     }
 
+    bool frozen () const { return not frozen_mixtures_.empty(); }
+
+    void score_value (
+            size_t latentid,
+            size_t kindid,
+            const ProductValue & value,
+            VectorFloat & scores,
+            rng_t & rng,
+            bool frozen) const;
+
+    void score_diff (
+            size_t latentid,
+            size_t kindid,
+            const ProductValue::Diff & diff,
+            VectorFloat & scores,
+            rng_t & rng,
+            bool frozen) const;
+
+    void canonicalize (Query::Sample::Request & request) const;
+    void canonicalize (Query::Score::Request & request) const;
+    void canonicalize (Query::Entropy::Request & request) const;
+
+    bool cacheable (const Query::Sample::Request & request) const
+    {
+        return request.has_seed();
+    }
+    bool cacheable (const Query::Score::Request &) const { return true; }
+    bool cacheable (const Query::Entropy::Request &) const { return true; }
+
+    // serves from the result cache when possible, else calls and caches
+    template<class Request, class Response>
+    void cached_call (
+            rng_t & rng,
+            const Request & request,
+            Response & response);
+
+    // call whenever the models change
+    void invalidate_cache ();
+
+    // in lazy mode, loads every kind a request may touch before calling;
+    // elsewhere does nothing
+    void load_kinds (const Query::Sample::Request & request);
+    void load_kinds (const Query::BatchSample::Request & request);
+    void load_kinds (const Query::Score::Request & request);
+    void load_kinds (const Query::Entropy::Request & request);
+    void load_kinds (const Query::ScoreDerivative::Request & request);
+    void load_kinds (const Query::MutualInformationMatrix::Request & request);
+    void load_kinds (const FeatureSet & features, bool has_tares);
+
+    // returns whether the diff has tares, which touch every kind
+    bool add_features (
+            const ProductValue::Diff & diff,
+            FeatureSet & features) const;
+
+    struct SampleScratch;
+
+    // uses per-thread scratch space; nested parallelism is optional
+    void sample (
+            rng_t & rng,
+            const Query::Sample::Request & request,
+            Query::Sample::Response & response,
+            bool parallel) const;
+
+    // lazily loaded and kept for the lifetime of the server
+    const std::vector<protobuf::Row> & cached_rows () const;
+
+    // frozen tables are invalid while the models are being modified
+    float score (
+            rng_t & rng,
+            const ProductValue::Diff & data,
+            bool frozen) const;
+
     bool validate (
             const Query::Sample::Request & request,
             Errors & errors) const;
 
+    bool validate (
+            const Query::BatchSample::Request & request,
+            Errors & errors) const;
+
     bool validate (
             const Query::Score::Request & request,
             Errors & errors) const;
@@ -81,11 +159,20 @@ private:
             const Query::ScoreDerivative::Request & request,
             Errors & errors) const;
 
+    bool validate (
+            const Query::MutualInformationMatrix::Request & request,
+            Errors & errors) const;
+
     void call (
             rng_t & rng,
             const Query::Sample::Request & request,
             Query::Sample::Response & response) const;
 
+    void call (
+            rng_t & rng,
+            const Query::BatchSample::Request & request,
+            Query::BatchSample::Response & response) const;
+
     void call (
             rng_t & rng,
             const Query::Score::Request & request,
@@ -102,9 +189,39 @@ private:
             const Query::ScoreDerivative::Request & request,
             Query::ScoreDerivative::Response & response) const;
 
+    void call (
+            rng_t & rng,
+            const Query::MutualInformationMatrix::Request & request,
+            Query::MutualInformationMatrix::Response & response) const;
+
+    class Accum;
+    typedef CompressedVector<FeatureSet, FeatureSet::Hash> Tasks;
+
+    FeatureSet to_feature_set (const ProductValue::Observed & observed) const;
+
+    // accumulates fun(output, task_scores) over samples for each output
+    template<class Fun>
+    void estimate (
+            rng_t & rng,
+            const ProductValue::Diff & conditional,
+            const ProductValue::Observed & to_sample,
+            size_t sample_count,
+            const Tasks & tasks,
+            const Fun & fun,
+            std::vector<Accum> & accums) const;
+
     const protobuf::Config config_;
     const std::vector<const CrossCat *> cross_cats_;
     const char * rows_in_;
+    std::vector<std::pair<size_t, size_t>> latent_kinds_;
+    std::vector<std::vector<const FrozenMixture *>> frozen_mixtures_;
+    KindLoader * kind_loader_;
+    mutable std::vector<protobuf::Row> row_cache_;
+    mutable bool row_cache_loaded_;
+    LruCache<std::string, std::string> result_cache_;
+    uint64_t generation_;
+    uint64_t cache_hits_;
+    uint64_t cache_misses_;
     Timer timer_;
 };
 
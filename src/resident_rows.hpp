@@ -0,0 +1,164 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <vector>
+#include <loom/common.hpp>
+#include <loom/protobuf.hpp>
+#include <loom/cross_cat.hpp>
+#include <loom/columnar.hpp>
+
+namespace loom
+{
+
+//----------------------------------------------------------------------------
+// Resident rows
+//
+// Holds a whole dataset in memory, parsed once, for schedules that read
+// the same rows many times.  Rows may additionally be pre-split into
+// simplified partial diffs, one per kind; the split depends only on which
+// kind each feature belongs to, so it stays valid until kinds change.
+
+class ResidentRows : noncopyable
+{
+public:
+
+    explicit ResidentRows (const char * rows_in) :
+        rows_(),
+        row_count_(0),
+        partial_diffs_(),
+        split_kind_count_(0),
+        split_featureid_to_kindid_()
+    {
+        if (ColumnarRows::is_columnar(rows_in)) {
+            load_columns(rows_in);
+        } else {
+            load_stream(rows_in);
+        }
+        for (const auto & row : rows_) {
+            row_count_ += protobuf::row_multiplicity(row);
+        }
+    }
+
+    size_t record_count () const { return rows_.size(); }
+    size_t row_count () const { return row_count_; }
+
+    const protobuf::Row & row (size_t index) const
+    {
+        LOOM_ASSERT2(index < rows_.size(), "bad index: " << index);
+        return rows_[index];
+    }
+
+    bool is_split () const { return not partial_diffs_.empty(); }
+
+    // only valid while is_split()
+    const std::vector<ProductValue::Diff> & partial_diffs (size_t index) const
+    {
+        LOOM_ASSERT2(index < partial_diffs_.size(), "bad index: " << index);
+        return partial_diffs_[index];
+    }
+
+    // splits every row for the current kinds, unless already split for them.
+    // Chains sharing rows split them for identical models, so whichever
+    // chain splits first serves the rest.
+    void split (const CrossCat & cross_cat)
+    {
+        #pragma omp critical(loom_resident_rows_split)
+        if (not is_split() or
+            split_kind_count_ != cross_cat.kinds.size() or
+            split_featureid_to_kindid_ != cross_cat.featureid_to_kindid)
+        {
+            const size_t record_count = rows_.size();
+            partial_diffs_.resize(record_count);
+            #pragma omp parallel for schedule(dynamic, 256)
+            for (size_t i = 0; i < record_count; ++i) {
+                auto & partial_diffs = partial_diffs_[i];
+                cross_cat.splitter.split(rows_[i].diff(), partial_diffs);
+                cross_cat.simplify(partial_diffs);
+            }
+            split_kind_count_ = cross_cat.kinds.size();
+            split_featureid_to_kindid_ = cross_cat.featureid_to_kindid;
+        }
+    }
+
+    void clear_split ()
+    {
+        std::vector<std::vector<ProductValue::Diff>>().swap(partial_diffs_);
+        split_kind_count_ = 0;
+        split_featureid_to_kindid_.clear();
+    }
+
+private:
+
+    void load_columns (const char * rows_in)
+    {
+        ColumnarRows columns(rows_in);
+        const size_t record_count = columns.record_count();
+        rows_.resize(record_count);
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (size_t i = 0; i < record_count; ++i) {
+            columns.read(i, rows_[i]);
+        }
+    }
+
+    // reads raw messages serially and parses them in parallel, in batches
+    // so that raw bytes never outweigh the parsed rows
+    void load_stream (const char * rows_in)
+    {
+        const size_t batch_size = 1 << 14;
+        protobuf::InFile stream(rows_in);
+        std::vector<std::vector<char>> raws(batch_size);
+        bool done = false;
+        while (not done) {
+            size_t count = 0;
+            while (count < batch_size and stream.try_read_stream(raws[count])) {
+                ++count;
+            }
+            done = (count < batch_size);
+
+            const size_t begin = rows_.size();
+            rows_.resize(begin + count);
+            #pragma omp parallel for schedule(dynamic, 256)
+            for (size_t i = 0; i < count; ++i) {
+                const auto & raw = raws[i];
+                bool success =
+                    rows_[begin + i].ParseFromArray(raw.data(), raw.size());
+                LOOM_ASSERT(success, "failed to parse row from " << rows_in);
+            }
+        }
+    }
+
+    std::vector<protobuf::Row> rows_;
+    size_t row_count_;
+    std::vector<std::vector<ProductValue::Diff>> partial_diffs_;
+    size_t split_kind_count_;
+    std::vector<uint32_t> split_featureid_to_kindid_;
+};
+
+} // namespace loom
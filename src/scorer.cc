@@ -40,7 +40,11 @@ RestrictionScorerKind::RestrictionScorerKind (
     likelihoods_(kind.model.schema.total_size()),
     restriction_to_hash_(),
     pos_to_hash_(),
-    hash_to_score_()
+    hash_to_features_(),
+    hash_to_score_(),
+    sorted_hashes_(),
+    shared_prefix_sizes_(),
+    prefix_sums_()
 {
     kind.mixture.score_diff(kind.model, conditional, prior_, rng);
 }
@@ -48,17 +52,25 @@ RestrictionScorerKind::RestrictionScorerKind (
 inline void RestrictionScorerKind::add_restriction (
         const ProductValue::Observed & restriction)
 {
-    // never freed
-    static thread_local Map::value_type * to_insert = nullptr;
-    construct_if_null(to_insert);
+    if (LOOM_DEBUG_LEVEL >= 1) {
+        kind_.model.schema.validate(restriction);
+    }
+    FeatureSet features(kind_.model.schema.total_size());
+    kind_.model.schema.for_each(restriction, [&](size_t i){
+        features.add(i);
+    });
 
-    restriction.SerializeToString(
-        const_cast<std::string *>(& to_insert->first));
-    auto inserted = restriction_to_hash_.insert(*to_insert);
-    uint32_t & hash = inserted.first->second;
+    const uint32_t new_hash = hash_to_features_.size();
+    auto inserted =
+        restriction_to_hash_.insert(std::make_pair(features, new_hash));
+    const uint32_t hash = inserted.first->second;
     if (LOOM_UNLIKELY(inserted.second)) {
-        hash = hash_to_score_.size();
+        hash_to_features_.resize(hash_to_features_.size() + 1);
+        features.for_each([&](size_t i){
+            hash_to_features_.back().push_back(i);
+        });
         hash_to_score_.push_back(NAN);
+        sorted_hashes_.clear();
     }
     pos_to_hash_.push_back(hash);
 
@@ -67,6 +79,67 @@ inline void RestrictionScorerKind::add_restriction (
     }
 }
 
+void RestrictionScorerKind::_sort_restrictions ()
+{
+    const size_t hash_count = hash_to_features_.size();
+    sorted_hashes_.resize(hash_count);
+    for (size_t hash = 0; hash < hash_count; ++hash) {
+        sorted_hashes_[hash] = hash;
+    }
+    std::sort(
+        sorted_hashes_.begin(),
+        sorted_hashes_.end(),
+        [&](uint32_t x, uint32_t y){
+            return hash_to_features_[x] < hash_to_features_[y];
+        });
+
+    shared_prefix_sizes_.resize(hash_count);
+    size_t max_size = 0;
+    const std::vector<uint32_t> * prev = nullptr;
+    for (size_t r = 0; r < hash_count; ++r) {
+        const auto & features = hash_to_features_[sorted_hashes_[r]];
+        size_t shared = 0;
+        if (prev) {
+            const size_t size = std::min(prev->size(), features.size());
+            while (shared < size and (*prev)[shared] == features[shared]) {
+                ++shared;
+            }
+        }
+        shared_prefix_sizes_[r] = shared;
+        max_size = std::max(max_size, features.size());
+        prev = & features;
+    }
+    prefix_sums_.resize(max_size + 1);
+}
+
+inline void RestrictionScorerKind::_compute_scores ()
+{
+    if (LOOM_UNLIKELY(sorted_hashes_.size() != hash_to_features_.size())) {
+        _sort_restrictions();
+    }
+
+    const size_t group_count = prior_.size();
+    prefix_sums_[0] = prior_;
+    for (size_t r = 0, size = sorted_hashes_.size(); r < size; ++r) {
+        const uint32_t hash = sorted_hashes_[r];
+        const auto & features = hash_to_features_[hash];
+        for (size_t d = shared_prefix_sizes_[r]; d < features.size(); ++d) {
+            const auto & likelihoods = likelihoods_[features[d]];
+            if (LOOM_DEBUG_LEVEL >= 1) {
+                LOOM_ASSERT_EQ(likelihoods.size(), group_count);
+            }
+            VectorFloat & sum = prefix_sums_[d + 1];
+            sum = prefix_sums_[d];
+            distributions::vector_add(
+                group_count,
+                sum.data(),
+                likelihoods.data());
+        }
+        hash_to_score_[hash] =
+            distributions::log_sum_exp(prefix_sums_[features.size()]);
+    }
+}
+
 inline void RestrictionScorerKind::set_value (
         const ProductValue & value,
         rng_t & rng)
@@ -88,36 +161,7 @@ inline void RestrictionScorerKind::set_value (
         *feature_scores,
         rng);
 
-    for (const auto & pair : restriction_to_hash_) {
-        hash_to_score_[pair.second] = _compute_score(pair.first);
-    }
-}
-
-inline float RestrictionScorerKind::_compute_score (
-        const std::string & message) const
-{
-    // never freed
-    static thread_local ProductValue::Observed * restriction = nullptr;
-    static thread_local VectorFloat * scores = nullptr;
-    construct_if_null(restriction);
-    construct_if_null(scores);
-
-    restriction->ParseFromString(message);
-    if (LOOM_DEBUG_LEVEL >= 1) {
-        kind_.model.schema.validate(*restriction);
-    }
-    *scores = prior_;
-    kind_.model.schema.for_each(*restriction, [&](size_t i){
-        if (LOOM_DEBUG_LEVEL >= 1) {
-            LOOM_ASSERT_LT(i, likelihoods_.size());
-            LOOM_ASSERT_EQ(likelihoods_[i].size(), scores->size());
-        }
-        distributions::vector_add(
-                scores->size(),
-                scores->data(),
-                likelihoods_[i].data());
-    });
-    return distributions::log_sum_exp(*scores);
+    _compute_scores();
 }
 
 RestrictionScorer::RestrictionScorer (
@@ -145,16 +189,23 @@ RestrictionScorer::~RestrictionScorer ()
     }
 }
 
-void RestrictionScorer::add_restriction (
-        const ProductValue::Observed & restriction)
+void RestrictionScorer::add_restriction (const FeatureSet & restriction)
 {
     // never freed
+    static thread_local ProductValue::Observed * full_restriction = nullptr;
     static thread_local std::vector<ProductValue::Observed> *
     partial_restrictions = nullptr;
+    construct_if_null(full_restriction);
     construct_if_null(partial_restrictions);
 
+    full_restriction->Clear();
+    full_restriction->set_sparsity(ProductValue::Observed::SPARSE);
+    restriction.for_each([&](size_t i){
+        full_restriction->add_sparse(i);
+    });
+
     const size_t kind_count = cross_cat_.kinds.size();
-    cross_cat_.splitter.split(restriction, *partial_restrictions);
+    cross_cat_.splitter.split(*full_restriction, *partial_restrictions);
     for (size_t k = 0; k < kind_count; ++k) {
         kinds_[k]->add_restriction((*partial_restrictions)[k]);
     }
@@ -30,21 +30,29 @@
 
 #include <unordered_map>
 #include <loom/cross_cat.hpp>
+#include <loom/feature_set.hpp>
 
 namespace loom
 {
 
 class RestrictionScorerKind
 {
-    typedef std::unordered_map<std::string, uint32_t> Map;
+    typedef std::unordered_map<FeatureSet, uint32_t, FeatureSet::Hash> Map;
 
     const CrossCat::Kind & kind_;
     VectorFloat prior_;
     std::vector<VectorFloat> likelihoods_;
     Map restriction_to_hash_;
     std::vector<uint32_t> pos_to_hash_;
+    std::vector<std::vector<uint32_t>> hash_to_features_;
     std::vector<float> hash_to_score_;
 
+    // restrictions are scored in lexicographic order of their features,
+    // so that each reuses the partial sum of its shared prefix
+    std::vector<uint32_t> sorted_hashes_;
+    std::vector<uint32_t> shared_prefix_sizes_;
+    std::vector<VectorFloat> prefix_sums_;
+
 public:
 
     RestrictionScorerKind (
@@ -67,7 +75,8 @@ public:
 
 private:
 
-    float _compute_score (const std::string & message) const;
+    void _sort_restrictions ();
+    void _compute_scores ();
 };
 
 class RestrictionScorer : noncopyable
@@ -84,7 +93,7 @@ public:
 
     ~RestrictionScorer ();
 
-    void add_restriction (const ProductValue::Observed & restriction);
+    void add_restriction (const FeatureSet & restriction);
     void set_value (const ProductValue & value, rng_t & rng);
 
     float get_score (size_t i) const
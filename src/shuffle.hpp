@@ -28,14 +28,33 @@
 
 #pragma once
 
-#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sstream>
 #include <algorithm>
+#include <omp.h>
 #include <loom/common.hpp>
 #include <loom/protobuf_stream.hpp>
+#include <loom/snapshot.hpp>
 
 namespace loom
 {
 
+//----------------------------------------------------------------------------
+// External shuffle
+//
+// Each message is assigned a random 64-bit key from a single seeded stream,
+// and the output is the messages sorted by key (ties broken by input order).
+// This is a uniform random permutation that depends only on the seed, not on
+// the memory target nor on the number of threads.
+//
+// Phase 1 reads the input once, scattering keyed messages into temporary
+// compressed bucket files by key range.  Phase 2 loads buckets a few at a
+// time in parallel, sorts each in memory, and appends them in bucket order.
+// When everything fits in memory the temporary files are skipped.
+
 inline void shuffle_stream (
         const char * messages_in,
         const char * shuffled_out,
@@ -43,45 +62,156 @@ inline void shuffle_stream (
         double target_mem_bytes)
 {
     typedef std::vector<char> Message;
-    typedef uint32_t pos_t;
+    typedef uint64_t Key;
+    struct Record
+    {
+        Key key;
+        Message message;
+    };
+    typedef std::vector<Record> Bucket;
 
     LOOM_ASSERT(
         std::string(messages_in) != std::string(shuffled_out),
         "cannot shuffle file in-place: " << messages_in);
     const auto stats = protobuf::InFile::stream_stats(messages_in);
     LOOM_ASSERT(stats.is_file, "shuffle input is not a file: " << messages_in);
-    const uint64_t max_message_count = std::numeric_limits<pos_t>::max();
-    LOOM_ASSERT(stats.message_count, max_message_count);
     const size_t message_count = stats.message_count;
 
-    double index_bytes = sizeof(pos_t) * message_count;
-    double target_chunk_size = std::max(1.0, std::min(double(message_count),
-        (target_mem_bytes - index_bytes) / stats.max_message_size));
-    size_t chunk_size = static_cast<size_t>(std::round(target_chunk_size));
+    // Buckets are sized so that one bucket per thread fits in the target.
+    // The number of open bucket files is capped, so very small targets may
+    // be exceeded.
+    const size_t max_bucket_count = 256;
+    const size_t thread_count = std::max(1, omp_get_max_threads());
+    const double record_bytes = sizeof(Record) + sizeof(Key);
+    const double total_bytes =
+        stats.total_message_bytes + record_bytes * message_count;
+    const double target_bucket_bytes =
+        std::max(1.0, target_mem_bytes / thread_count);
+    const size_t bucket_count = std::max<size_t>(1, std::min<double>(
+        max_bucket_count, std::ceil(total_bytes / target_bucket_bytes)));
+    const double bucket_bytes = total_bytes / bucket_count;
+    const size_t wave_size = std::max<size_t>(1, std::min<double>(
+        thread_count, std::floor(target_mem_bytes / bucket_bytes)));
 
-    std::vector<pos_t> index(message_count);
-    for (size_t i = 0; i < message_count; ++i) {
-        index[i] = i;
-    }
-    std::shuffle(index.begin(), index.end(), loom::rng_t(seed));
-
-    Message message;
-    std::vector<Message> chunk;
-    protobuf::OutFile shuffled(shuffled_out);
-    for (size_t begin = 0; begin < message_count; begin += chunk_size) {
-        size_t end = std::min(begin + chunk_size, message_count);
-        chunk.resize(end - begin);
+    rng_t rng(seed);
+    std::uniform_int_distribution<Key> sample_key;
+    auto get_bucket = [bucket_count](Key key){
+        return ((key >> 32) * bucket_count) >> 32;
+    };
+
+    // phase 1: scatter keyed messages into buckets
+
+    std::vector<std::string> bucket_filenames;
+    if (bucket_count > 1) {
+        std::string prefix;
+        if (snapshot::is_file(shuffled_out)) {
+            prefix = shuffled_out;
+        } else {
+            std::ostringstream path;
+            path << "/tmp/loom_shuffle." << getpid();
+            prefix = path.str();
+        }
+        for (size_t b = 0; b < bucket_count; ++b) {
+            std::ostringstream filename;
+            filename << prefix << ".bucket." << b << ".pbs.gz";
+            bucket_filenames.push_back(filename.str());
+        }
+
+        std::vector<protobuf::OutFile *> buckets;
+        for (const auto & filename : bucket_filenames) {
+            buckets.push_back(new protobuf::OutFile(filename.c_str()));
+        }
         protobuf::InFile messages(messages_in);
-        for (size_t i : index) {
-            messages.try_read_stream(message);
-            if (begin <= i and i < end) {
-                std::swap(message, chunk[i - begin]);
+        Message message;
+        Message keyed;
+        const Message & const_keyed = keyed;
+        while (messages.try_read_stream(message)) {
+            const Key key = sample_key(rng);
+            keyed.resize(sizeof(Key) + message.size());
+            memcpy(keyed.data(), & key, sizeof(Key));
+            std::copy(message.begin(), message.end(),
+                keyed.begin() + sizeof(Key));
+            buckets[get_bucket(key)]->write_stream(const_keyed);
+        }
+        for (auto * bucket : buckets) {
+            delete bucket;
+        }
+    }
+
+    auto load_bucket = [&](size_t b, Bucket & records){
+        records.clear();
+        if (bucket_count == 1) {
+            protobuf::InFile messages(messages_in);
+            records.reserve(message_count);
+            Record record;
+            while (messages.try_read_stream(record.message)) {
+                record.key = sample_key(rng);
+                records.push_back(std::move(record));
+            }
+        } else {
+            protobuf::InFile keyed_messages(bucket_filenames[b].c_str());
+            Message keyed;
+            Record record;
+            while (keyed_messages.try_read_stream(keyed)) {
+                LOOM_ASSERT_LE(sizeof(Key), keyed.size());
+                memcpy(& record.key, keyed.data(), sizeof(Key));
+                record.message.assign(keyed.begin() + sizeof(Key), keyed.end());
+                records.push_back(std::move(record));
+            }
+            std::remove(bucket_filenames[b].c_str());
+        }
+        std::stable_sort(records.begin(), records.end(),
+            [](const Record & x, const Record & y){ return x.key < y.key; });
+    };
+
+    // phase 2: sort buckets in parallel and append them in order
+
+    auto dump_bucket = [](protobuf::OutFile & file, const Bucket & records){
+        for (const auto & record : records) {
+            file.write_stream(record.message);
+        }
+    };
+
+    // Real files get each bucket serialized and compressed in parallel, as
+    // concatenated gzip members; stdout is written sequentially.
+    const bool parallel_dump = snapshot::is_file(shuffled_out);
+    const bool compressed = protobuf::endswith(shuffled_out, ".gz");
+    std::vector<Bucket> buckets(wave_size);
+    std::vector<std::string> chunks(parallel_dump ? wave_size : 0);
+    BinaryOutFile * binary_file =
+        parallel_dump ? new BinaryOutFile(shuffled_out) : nullptr;
+    protobuf::OutFile * stream_file =
+        parallel_dump ? nullptr : new protobuf::OutFile(shuffled_out);
+    for (size_t wave = 0; wave < bucket_count; wave += wave_size) {
+        const size_t wave_end = std::min(bucket_count, wave + wave_size);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t b = wave; b < wave_end; ++b) {
+            Bucket & records = buckets[b - wave];
+            load_bucket(b, records);
+            if (parallel_dump) {
+                std::string & chunk = chunks[b - wave];
+                chunk.clear();
+                {
+                    protobuf::OutFile chunk_file(chunk, compressed);
+                    dump_bucket(chunk_file, records);
+                }
+                Bucket().swap(records);
             }
         }
-        for (const auto & message : chunk) {
-            shuffled.write_stream(message);
+
+        for (size_t b = wave; b < wave_end; ++b) {
+            if (parallel_dump) {
+                const std::string & chunk = chunks[b - wave];
+                binary_file->write(chunk.data(), chunk.size());
+            } else {
+                dump_bucket(* stream_file, buckets[b - wave]);
+                Bucket().swap(buckets[b - wave]);
+            }
         }
     }
+    delete binary_file;
+    delete stream_file;
 }
 
 } // namespace loom
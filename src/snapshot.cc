@@ -0,0 +1,115 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/args.hpp>
+#include <loom/cross_cat.hpp>
+#include <loom/assignments.hpp>
+#include <loom/store.hpp>
+#include <loom/snapshot.hpp>
+
+const char * help_message =
+"Usage: snapshot COMMAND MODEL_IN GROUPS ASSIGN"
+"\nArguments:"
+"\n  COMMAND       'native' to convert protobuf files to native snapshots"
+"\n                or 'protobuf' to convert native snapshots to protobuf"
+"\n  MODEL_IN      filename of model (e.g. model.pb.gz);"
+"\n                'protobuf' reads the model from the snapshot instead"
+"\n  GROUPS        dirname of per-kind group files"
+"\n  ASSIGN        filename of assignments stream (e.g. assign.pbs.gz)"
+"\n                or --none to convert only groups"
+"\nNotes:"
+"\n  Snapshots are written next to the protobuf files, as"
+"\n  GROUPS.bin and ASSIGN with its .pbs.gz suffix replaced by .bin."
+;
+
+int main (int argc, char ** argv)
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    Args args(argc, argv, help_message);
+    const std::string command = args.pop();
+    const char * model_in = args.pop();
+    const char * groups = args.pop();
+    const char * assign = args.pop_optional_file();
+    args.done();
+
+    const bool to_native = (command == "native");
+    LOOM_ASSERT(
+        to_native or command == "protobuf",
+        "unknown command: " << command);
+
+    const std::string mixture_snapshot =
+        loom::store::get_mixture_snapshot_path(groups);
+    const std::string assign_snapshot =
+        assign ? loom::store::get_assign_snapshot_path(assign) : "";
+
+    loom::rng_t rng(0);
+    const size_t empty_group_count = 1;
+    loom::CrossCat cross_cat;
+    if (to_native) {
+        cross_cat.model_load(model_in);
+        cross_cat.mixture_load(groups, empty_group_count, rng);
+    } else {
+        cross_cat.snapshot_load(
+            mixture_snapshot.c_str(),
+            empty_group_count,
+            rng);
+    }
+
+    loom::Assignments assignments;
+    assignments.init(cross_cat.kinds.size());
+    if (assign) {
+        if (to_native) {
+            assignments.load(assign);
+        } else {
+            assignments.snapshot_load(assign_snapshot.c_str());
+        }
+    }
+
+    const auto sorted_to_globals = cross_cat.get_sorted_groupids();
+    if (to_native) {
+        cross_cat.snapshot_dump(
+            mixture_snapshot.c_str(),
+            model_in,
+            groups,
+            sorted_to_globals);
+        if (assign) {
+            assignments.snapshot_dump(
+                assign_snapshot.c_str(),
+                assign,
+                sorted_to_globals);
+        }
+    } else {
+        cross_cat.mixture_dump(groups, sorted_to_globals);
+        if (assign) {
+            assignments.dump(assign, sorted_to_globals);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstring>
+#include <loom/common.hpp>
+#include <loom/mapped_file.hpp>
+
+namespace loom
+{
+namespace snapshot
+{
+
+//----------------------------------------------------------------------------
+// Native binary snapshots
+//
+// Design Goals:
+//  * Load models, mixtures and assignments from one mmapped file each,
+//    as a few large array copies with no decompression.
+//  * Write snapshots alongside the protobuf outputs, and record a
+//    fingerprint of each protobuf file they were written beside.
+//  * Prefer a snapshot when loading only if every fingerprint still
+//    matches its protobuf file; otherwise fall back to the protobuf files.
+//  * Refuse to load snapshots written by a different format version.
+
+enum { version = 2, alignment = 64 };
+
+struct Header
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t size0;
+    uint64_t size1;
+};
+
+// identifies the state of a source file; zero if it does not exist
+struct Fingerprint
+{
+    uint64_t size;
+    uint64_t mtime_nsec;
+
+    bool operator== (const Fingerprint & other) const
+    {
+        return size == other.size and mtime_nsec == other.mtime_nsec;
+    }
+};
+
+inline Fingerprint fingerprint (const std::string & filename)
+{
+    Fingerprint result = {0, 0};
+    struct stat info;
+    if (stat(filename.c_str(), & info) == 0) {
+        result.size = info.st_size;
+        result.mtime_nsec =
+            uint64_t(info.st_mtim.tv_sec) * 1000000000UL +
+            info.st_mtim.tv_nsec;
+    }
+    return result;
+}
+
+// a source matches only if it existed when the snapshot was written
+inline bool matches (const Fingerprint & source, const std::string & filename)
+{
+    return (source.size or source.mtime_nsec) and
+        source == fingerprint(filename);
+}
+
+inline size_t align_up (size_t position)
+{
+    return (position + alignment - 1) / alignment * alignment;
+}
+
+inline Header make_header (const char * magic, size_t size0, size_t size1)
+{
+    Header header;
+    memset(& header, 0, sizeof(header));
+    strncpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.size0 = size0;
+    header.size1 = size1;
+    return header;
+}
+
+inline bool has_header (const MappedFile & file, const char * magic)
+{
+    if (file.size() < sizeof(Header)) {
+        return false;
+    }
+    const Header & header = * file.at<Header>(0);
+    return strncmp(header.magic, magic, sizeof(header.magic)) == 0 and
+        header.version == version;
+}
+
+inline const Header & check_header (
+        const MappedFile & file,
+        const char * magic)
+{
+    const Header & header = * file.at<Header>(0);
+    LOOM_ASSERT(
+        strncmp(header.magic, magic, sizeof(header.magic)) == 0,
+        "not a " << magic << " snapshot: " << file.filename());
+    LOOM_ASSERT(
+        header.version == version,
+        "unsupported snapshot version " << header.version
+        << " in " << file.filename());
+    return header;
+}
+
+// snapshots are only written next to real files, not stdin/stdout
+inline bool is_file (const char * filename)
+{
+    return strcmp(filename, "-") != 0 and strcmp(filename, "-.gz") != 0;
+}
+
+inline bool exists (const std::string & filename)
+{
+    struct stat info;
+    return stat(filename.c_str(), & info) == 0;
+}
+
+// Blocks are written to memory and read from an mmapped file.
+// Each array is aligned relative to the block start, and each block
+// starts at a multiple of alignment in its file.
+
+class BlockWriter : noncopyable
+{
+public:
+
+    explicit BlockWriter (std::string & data) : data_(data) {}
+
+    template<class T>
+    void write (const T * data, size_t count)
+    {
+        static_assert(alignof(T) <= alignment, "over-aligned type");
+        data_.resize((data_.size() + alignof(T) - 1) / alignof(T) * alignof(T));
+        data_.append(reinterpret_cast<const char *>(data), sizeof(T) * count);
+    }
+
+    template<class T>
+    void write_pod (const T & value)
+    {
+        write(& value, 1);
+    }
+
+private:
+
+    std::string & data_;
+};
+
+class BlockReader : noncopyable
+{
+public:
+
+    BlockReader (const char * data, size_t size) :
+        data_(data),
+        size_(size),
+        position_(0)
+    {
+    }
+
+    template<class T>
+    const T * read (size_t count)
+    {
+        position_ = (position_ + alignof(T) - 1) / alignof(T) * alignof(T);
+        LOOM_ASSERT_LE(position_ + sizeof(T) * count, size_);
+        const T * result = reinterpret_cast<const T *>(data_ + position_);
+        position_ += sizeof(T) * count;
+        return result;
+    }
+
+    template<class T>
+    const T & read_pod ()
+    {
+        return * read<T>(1);
+    }
+
+    bool done () const { return position_ == size_; }
+
+private:
+
+    const char * data_;
+    const size_t size_;
+    size_t position_;
+};
+
+} // namespace snapshot
+} // namespace loom
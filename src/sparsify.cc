@@ -26,17 +26,23 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <unistd.h>
+#include <cstdio>
+#include <sstream>
 #include <loom/args.hpp>
 #include <loom/differ.hpp>
+#include <loom/dedup.hpp>
 #include <loom/protobuf_stream.hpp>
+#include <loom/snapshot.hpp>
 
 const char * help_message =
-"Usage: sparsify SCHEMA_ROW_IN TARES_IN ROWS_IN ROWS_OUT"
+"Usage: sparsify SCHEMA_ROW_IN TARES_IN ROWS_IN ROWS_OUT [DEDUP=0]"
 "\nArguments:"
 "\n  SCHEMA_ROW_IN filename of schema row (e.g. schema.pb.gz)"
 "\n  TARES_IN      filename of tare rows (e.g. tares.pbs.gz)"
 "\n  ROWS_IN       filename of input dataset stream (e.g. rows.pbs.gz)"
 "\n  ROWS_OUT      filename of output dataset stream (e.g. diffs.pbs.gz)"
+"\n  DEDUP         whether to collapse rows with identical diffs"
 "\nNotes:"
 "\n  Any filename can end with .gz to indicate gzip compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
@@ -51,6 +57,7 @@ int main (int argc, char ** argv)
     const char * tares_in = args.pop();
     const char * rows_in = args.pop();
     const char * rows_out = args.pop();
+    const bool dedup = args.pop_default(0L);
     args.done();
 
     loom::ProductValue value;
@@ -61,12 +68,24 @@ int main (int argc, char ** argv)
     if (tares.size() == 0) {
         tares.resize(1);
         schema.clear(tares[0]);
-    } else if (tares.size() > 1) {
-        TODO("support multiple tare values in sparsify");
     }
 
-    loom::Differ differ(schema, tares[0]);
-    differ.compress_rows(rows_in, rows_out);
+    loom::Differ differ(schema, tares);
+    if (dedup) {
+        std::string temp;
+        if (loom::snapshot::is_file(rows_out)) {
+            temp = std::string(rows_out) + ".undeduped.pbs.gz";
+        } else {
+            std::ostringstream path;
+            path << "/tmp/loom_sparsify." << getpid() << ".pbs.gz";
+            temp = path.str();
+        }
+        differ.compress_rows(rows_in, temp.c_str());
+        loom::dedup_rows(temp.c_str(), rows_out);
+        std::remove(temp.c_str());
+    } else {
+        differ.compress_rows(rows_in, rows_out);
+    }
 
     return 0;
 }
@@ -30,6 +30,8 @@
 
 #include <sstream>
 #include <fstream>
+#include <cstring>
+#include <cstdlib>
 #include <loom/common.hpp>
 
 namespace loom
@@ -66,6 +68,38 @@ inline std::string get_mixture_path (
     return filename.str();
 }
 
+// a sibling of the groups dir, so that dir holds only per-kind files
+inline std::string get_mixture_snapshot_path (std::string groups_path)
+{
+    while (groups_path.size() > 1 and groups_path.back() == '/') {
+        groups_path.pop_back();
+    }
+    return groups_path + ".bin";
+}
+
+inline std::string get_assign_snapshot_path (const std::string & assign_path)
+{
+    for (const char * suffix : {".pbs.gz", ".pbs"}) {
+        const size_t size = strlen(suffix);
+        if (assign_path.size() > size and
+            assign_path.compare(assign_path.size() - size, size, suffix) == 0)
+        {
+            return assign_path.substr(0, assign_path.size() - size) + ".bin";
+        }
+    }
+    return assign_path + ".bin";
+}
+
+// checkpoint deltas refer to earlier files by absolute path
+inline std::string get_absolute_path (const char * filename)
+{
+    char * path = realpath(filename, nullptr);
+    LOOM_ASSERT(path, "failed to resolve path " << filename);
+    std::string result(path);
+    free(path);
+    return result;
+}
+
 inline std::string get_sample_path (
         const std::string & root,
         size_t seed)
@@ -28,25 +28,77 @@
 
 #pragma once
 
+#include <cstring>
+#include <memory>
 #include <loom/common.hpp>
 #include <loom/protobuf.hpp>
+#include <loom/cross_cat.hpp>
 #include <loom/assignments.hpp>
+#include <loom/columnar.hpp>
+#include <loom/resident_rows.hpp>
 
 namespace loom
 {
 
+// Rows are read from either a protobuf stream or a columnar file, or are
+// held resident in memory.  Raw reads of columnar or resident rows yield
+// only the row's index, and parse() builds the row from its columns or
+// copies it, so pipelines can parse in parallel either way.  Positions
+// always count messages, so checkpoints are portable between modes.
 class StreamInterval : noncopyable
 {
 public:
 
-    StreamInterval (const char * rows_in) :
+    // A row ready for the kernels: pointing into resident rows when they
+    // are pre-split, otherwise parsed and split into the buffers.
+    struct SplitRow
+    {
+        const protobuf::Row * row;
+        const std::vector<ProductValue::Diff> * partial_diffs;
+        protobuf::Row row_buffer;
+        std::vector<ProductValue::Diff> partial_diffs_buffer;
+    };
+
+    StreamInterval (const char * rows_in, bool resident = false) :
+        resident_(resident ? new ResidentRows(rows_in) : nullptr),
+        columns_(
+            not resident and ColumnarRows::is_columnar(rows_in)
+                ? new ColumnarRows(rows_in)
+                : nullptr),
+        unassigned_(rows_in),
+        assigned_(rows_in),
+        unassigned_pos_(0),
+        assigned_pos_(0)
+    {
+    }
+
+    // shares rows already held resident, e.g. by concurrent chains
+    StreamInterval (
+            const char * rows_in,
+            const std::shared_ptr<ResidentRows> & resident) :
+        resident_(resident),
+        columns_(nullptr),
         unassigned_(rows_in),
-        assigned_(rows_in)
+        assigned_(rows_in),
+        unassigned_pos_(0),
+        assigned_pos_(0)
     {
+        LOOM_ASSERT(resident_, "expected resident rows");
     }
 
+    bool is_columnar () const { return columns_ != nullptr; }
+
+    ResidentRows * resident () { return resident_.get(); }
+    const ResidentRows * resident () const { return resident_.get(); }
+
     void load (const protobuf::Checkpoint::StreamInterval & rows)
     {
+        if (is_indexed()) {
+            unassigned_pos_ = rows.unassigned_pos();
+            assigned_pos_ = rows.assigned_pos();
+            return;
+        }
+
         #pragma omp parallel sections
         {
             #pragma omp section
@@ -59,8 +111,33 @@ public:
 
     void dump (protobuf::Checkpoint::StreamInterval & rows)
     {
-        rows.set_unassigned_pos(unassigned_.position());
-        rows.set_assigned_pos(assigned_.position());
+        if (is_indexed()) {
+            rows.set_unassigned_pos(unassigned_pos_);
+            rows.set_assigned_pos(assigned_pos_);
+        } else {
+            rows.set_unassigned_pos(unassigned_.position());
+            rows.set_assigned_pos(assigned_.position());
+        }
+    }
+
+    void count_rows (size_t & record_count, size_t & row_count) const
+    {
+        if (resident_) {
+            record_count = resident_->record_count();
+            row_count = resident_->row_count();
+        } else if (columns_) {
+            record_count = columns_->record_count();
+            row_count = columns_->row_count();
+        } else {
+            record_count = 0;
+            row_count = 0;
+            protobuf::InFile stream(unassigned_.filename());
+            protobuf::Row row;
+            while (stream.try_read_stream(row)) {
+                ++record_count;
+                row_count += protobuf::row_multiplicity(row);
+            }
+        }
     }
 
     void init_from_assignments (const Assignments & assignments)
@@ -68,6 +145,11 @@ public:
         LOOM_ASSERT(assignments.row_count(), "nothing to initialize");
         LOOM_ASSERT(assigned_.is_file(), "only files support StreamInterval");
 
+        if (is_indexed()) {
+            seek_indices(assignments);
+            return;
+        }
+
         #pragma omp parallel sections
         {
             #pragma omp section
@@ -78,20 +160,203 @@ public:
         }
     }
 
+    // Counts assigned stream messages, given the total count.  This is only
+    // ambiguous when every message is assigned, which callers rule out.
+    size_t assigned_record_count (size_t record_count) const
+    {
+        LOOM_ASSERT_LT(0, record_count);
+        const size_t unassigned_pos =
+            is_indexed() ? unassigned_pos_ : unassigned_.position();
+        const size_t assigned_pos =
+            is_indexed() ? assigned_pos_ : assigned_.position();
+        return (unassigned_pos + record_count - assigned_pos) % record_count;
+    }
+
     template<class Message>
     void read_unassigned (Message & message)
     {
-        unassigned_.cyclic_read_stream(message);
+        if (is_indexed()) {
+            read_index(unassigned_pos_, message);
+        } else {
+            unassigned_.cyclic_read_stream(message);
+        }
     }
 
     template<class Message>
     void read_assigned (Message & message)
     {
-        assigned_.cyclic_read_stream(message);
+        if (is_indexed()) {
+            read_index(assigned_pos_, message);
+        } else {
+            assigned_.cyclic_read_stream(message);
+        }
+    }
+
+    // resident reads need no parsing; serve them by index instead
+    size_t read_unassigned_index ()
+    {
+        LOOM_ASSERT1(resident_, "rows are not resident");
+        return next_index(unassigned_pos_);
+    }
+
+    size_t read_assigned_index ()
+    {
+        LOOM_ASSERT1(resident_, "rows are not resident");
+        return next_index(assigned_pos_);
+    }
+
+    void parse (const std::vector<char> & raw, protobuf::Row & row) const
+    {
+        if (resident_) {
+            row = resident_->row(raw_index(raw));
+        } else if (columns_) {
+            columns_->read(raw_index(raw), row);
+        } else {
+            row.ParseFromArray(raw.data(), raw.size());
+        }
+    }
+
+    // columnar reads split rows straight from their columns
+    void read_unassigned_split (const CrossCat & cross_cat, SplitRow & split)
+    {
+        LOOM_ASSERT1(columns_, "rows are not columnar");
+        read_columns_split(next_index(unassigned_pos_), cross_cat, split);
+    }
+
+    void read_assigned_split (const CrossCat & cross_cat, SplitRow & split)
+    {
+        LOOM_ASSERT1(columns_, "rows are not columnar");
+        read_columns_split(next_index(assigned_pos_), cross_cat, split);
+    }
+
+    // Unless full_row, columnar rows are split straight from their columns
+    // and split.row carries only id and dup_ids.
+    void parse_split (
+            const std::vector<char> & raw,
+            const CrossCat & cross_cat,
+            SplitRow & split,
+            bool full_row = true) const
+    {
+        if (columns_ and not full_row) {
+            read_columns_split(raw_index(raw), cross_cat, split);
+            return;
+        }
+        if (resident_) {
+            const size_t index = raw_index(raw);
+            split.row = & resident_->row(index);
+            if (resident_->is_split()) {
+                split.partial_diffs = & resident_->partial_diffs(index);
+                return;
+            }
+        } else {
+            parse(raw, split.row_buffer);
+            split.row = & split.row_buffer;
+        }
+        cross_cat.splitter.split(split.row->diff(), split.partial_diffs_buffer);
+        cross_cat.simplify(split.partial_diffs_buffer);
+        split.partial_diffs = & split.partial_diffs_buffer;
     }
 
 private:
 
+    bool is_indexed () const { return resident_ or columns_; }
+
+    void read_columns_split (
+            size_t index,
+            const CrossCat & cross_cat,
+            SplitRow & split) const
+    {
+        columns_->read_ids(index, split.row_buffer);
+        split.row = & split.row_buffer;
+        columns_->read_split(
+            index,
+            cross_cat.splitter,
+            split.partial_diffs_buffer);
+        cross_cat.simplify(split.partial_diffs_buffer);
+        split.partial_diffs = & split.partial_diffs_buffer;
+    }
+
+    size_t record_count () const
+    {
+        return resident_ ? resident_->record_count() : columns_->record_count();
+    }
+
+    size_t multiplicity (size_t index) const
+    {
+        return resident_
+            ? protobuf::row_multiplicity(resident_->row(index))
+            : columns_->multiplicity(index);
+    }
+
+    uint64_t row_id (size_t index, size_t i) const
+    {
+        return resident_
+            ? protobuf::row_id(resident_->row(index), i)
+            : columns_->row_id(index, i);
+    }
+
+    static size_t raw_index (const std::vector<char> & raw)
+    {
+        uint64_t index;
+        LOOM_ASSERT2(raw.size() == sizeof(index), "bad raw row");
+        memcpy(& index, raw.data(), sizeof(index));
+        return index;
+    }
+
+    // positions mimic protobuf::InFile: a cyclic read past the end
+    // restarts at zero, so positions lie in [0, record_count]
+    size_t next_index (size_t & pos) const
+    {
+        const size_t record_count = this->record_count();
+        if (LOOM_UNLIKELY(pos == record_count)) {
+            pos = 0;
+        }
+        LOOM_ASSERT(pos < record_count, "stream is empty");
+        return pos++;
+    }
+
+    void read_index (size_t & pos, protobuf::Row & row) const
+    {
+        if (resident_) {
+            row = resident_->row(next_index(pos));
+        } else {
+            columns_->read(next_index(pos), row);
+        }
+    }
+
+    void read_index (size_t & pos, std::vector<char> & raw) const
+    {
+        const uint64_t index = next_index(pos);
+        raw.resize(sizeof(index));
+        memcpy(raw.data(), & index, sizeof(index));
+    }
+
+    void seek_indices (const Assignments & assignments)
+    {
+        const auto last_assigned_rowid = assignments.rowids().back();
+        const auto first_assigned_rowid = assignments.rowids().front();
+        const size_t record_count = this->record_count();
+        bool found_unassigned = false;
+        bool found_assigned = false;
+        for (size_t i = 0; i < record_count; ++i) {
+            const size_t last = multiplicity(i) - 1;
+            if (row_id(i, last) == last_assigned_rowid) {
+                unassigned_pos_ = i + 1;
+                found_unassigned = true;
+            }
+            if (row_id(i, 0) == first_assigned_rowid) {
+                assigned_pos_ = i;
+                found_assigned = true;
+            }
+        }
+        LOOM_ASSERT(
+            found_unassigned,
+            "row.id not found: " << last_assigned_rowid);
+        LOOM_ASSERT(
+            found_assigned,
+            "row.id not found: " << first_assigned_rowid);
+    }
+
     void seek_first_unassigned_row (const Assignments & assignments)
     {
         const auto last_assigned_rowid = assignments.rowids().back();
@@ -100,7 +365,8 @@ private:
         while (true) {
             bool success = unassigned_.try_read_stream(row);
             LOOM_ASSERT(success, "row.id not found: " << last_assigned_rowid);
-            if (row.id() == last_assigned_rowid) {
+            const size_t count = protobuf::row_multiplicity(row);
+            if (protobuf::row_id(row, count - 1) == last_assigned_rowid) {
                 break;
             }
         }
@@ -123,8 +389,12 @@ private:
         }
     }
 
+    std::shared_ptr<ResidentRows> resident_;
+    std::unique_ptr<ColumnarRows> columns_;
     protobuf::InFile unassigned_;
     protobuf::InFile assigned_;
+    size_t unassigned_pos_;
+    size_t assigned_pos_;
 };
 
 } // namespace loom
@@ -31,11 +31,21 @@
 
 const char * help_message =
 "Usage: tare SCHEMA_ROW_IN ROWS_IN TARES_OUT"
+"\n  [SAMPLE_COUNT=0] [CONFIDENCE=0.999] [TARE_COUNT=1] [SHUFFLED=0]"
 "\nArguments:"
 "\n  SCHEMA_ROW_IN filename of schema row (e.g. schema.pb.gz)"
 "\n  ROWS_IN       filename of input dataset stream (e.g. rows.pbs.gz)"
 "\n  TARES_OUT     filename of output tare rows (e.g. tares.pbs.gz)"
+"\n  SAMPLE_COUNT  if positive, estimate tares from a uniform sample of at"
+"\n                most this many rows, stopping early once every column"
+"\n                is settled"
+"\n  CONFIDENCE    confidence level for stopping early when sampling"
+"\n  TARE_COUNT    maximum number of tare rows to find by k-modes"
+"\n  SHUFFLED      1 if ROWS_IN is already in random order, so that"
+"\n                sampling reads only its first SAMPLE_COUNT rows"
 "\nNotes:"
+"\n  Sampling reads and decompresses all of ROWS_IN, but parses only the"
+"\n  sampled rows, unless SHUFFLED."
 "\n  Any filename can end with .gz to indicate gzip compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
 ;
@@ -48,6 +58,10 @@ int main (int argc, char ** argv)
     const char * schema_row_in = args.pop();
     const char * rows_in = args.pop();
     const char * tares_out = args.pop();
+    const int64_t sample_count = args.pop_default(0L);
+    const double confidence = args.pop_default(0.999);
+    const int64_t tare_count = args.pop_default(1L);
+    const int32_t shuffled = args.pop_default(0);
     args.done();
 
     loom::ProductValue value;
@@ -56,12 +70,19 @@ int main (int argc, char ** argv)
     schema.load(value);
 
     loom::Differ differ(schema);
-    differ.add_rows(rows_in);
+    differ.add_rows(
+        rows_in,
+        sample_count,
+        confidence,
+        tare_count,
+        shuffled);
 
     loom::protobuf::OutFile tares(tares_out);
-    const auto & tare = differ.get_tare();
-    if (schema.total_size(tare)) {
-        tares.write_stream(tare);
+    const auto & found = differ.get_tares();
+    if (found.size() > 1 or schema.total_size(found[0])) {
+        for (const auto & tare : found) {
+            tares.write_stream(tare);
+        }
     }
 
     return 0;